@@ -24,7 +24,10 @@ class Bench
         m_file<<"numThreads,";
         m_file<<"numVerts,";
         m_file<<"frame,";
-        m_file<<"startup\n";
+        m_file<<"startup,";
+        m_file<<"framesInFlight,";
+        m_file<<"perFrameRecord,";
+        m_file<<"record\n";
     }
 
     void numThreads(size_t numThreads)
@@ -32,11 +35,26 @@ class Bench
         m_numThreads = numThreads;
     }
     
+    void framesInFlight(uint32_t framesInFlight)
+    {
+        m_framesInFlight = framesInFlight;
+    }
+
+    void perFrameRecord(bool perFrameRecord)
+    {
+        m_perFrameRecord = perFrameRecord;
+    }
+
     void numVerts(size_t numVerts)
     {
         m_numVerts = numVerts;
     }
 
+    void recordTime(float recordTime)
+    {
+        m_record = recordTime;
+    }
+
     time_point start()
     {
         return std::chrono::high_resolution_clock::now();
@@ -59,7 +77,10 @@ class Bench
         m_file<<m_numThreads<<",";
         m_file<<m_numVerts<<",";
         m_file<<m_frame<<",";
-        m_file<<m_startup;
+        m_file<<m_startup<<",";
+        m_file<<m_framesInFlight<<",";
+        m_file<<m_perFrameRecord<<",";
+        m_file<<m_record;
         m_file<<"\n";
     }
 
@@ -68,13 +89,6 @@ class Bench
         m_file.close();
     }
 
-    private:
-    std::fstream m_file;
-    size_t m_numThreads=1;
-    size_t m_numVerts=0;
-    float m_frame=0.0f;
-    float m_startup=0.0f;
-
     float duration(time_point _time)
     {
         auto end = std::chrono::high_resolution_clock::now();
@@ -83,6 +97,16 @@ class Bench
                 end - _time).count();
         return duration;
     }
+
+    private:
+    std::fstream m_file;
+    uint32_t m_framesInFlight=1;
+    size_t m_numThreads=1;
+    size_t m_numVerts=0;
+    bool m_perFrameRecord=false;
+    float m_frame=0.0f;
+    float m_record=0.0f;
+    float m_startup=0.0f;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,40 @@
+// Measures the cost of dispatching jobs through the ThreadPool, without any
+// Vulkan work, so the per-job overhead of the pool can be tracked on its own.
+
+#include "threadpool.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+const size_t NUM_RUNS = 100;
+const std::vector<uint32_t> NUM_JOBS = {1, 16, 256, 4096};
+
+int main()
+{
+    std::ofstream file("dispatch.csv");
+    file<<"numThreads,numJobs,nsPerJob\n";
+
+    ThreadPool pool;
+    for (uint32_t t = 0; t <= 4; ++t)
+    {
+        pool.setThreadCount(t);
+        printf("Running threads: %u\n", t);
+        for (const auto &n : NUM_JOBS)
+        {
+            std::atomic<uint32_t> sum{0};
+            auto job = [&](uint32_t i) { sum.fetch_add(i, std::memory_order_relaxed); };
+            for (size_t r = 0; r < NUM_RUNS; ++r)
+            {
+                auto start = std::chrono::steady_clock::now();
+                pool.parallelFor(n, job);
+                auto end = std::chrono::steady_clock::now();
+                double ns = std::chrono::duration<double, std::nano>(end-start).count();
+                file<<t<<","<<n<<","<<ns/n<<"\n";
+            }
+        }
+    }
+    return 0;
+}
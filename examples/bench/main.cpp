@@ -1,11 +1,23 @@
 #include "bench.h"
+#include "memory.h"
 #include "multipass.h"
 #include "obj.h"
 #include "triangle.h"
 #include "simple_triangle.h"
+#include <sys/resource.h>
 
 const size_t NUM_SETUPS = 100;
 const size_t NUM_FRAMES = 100;
+const size_t NUM_RESIZES = 5000;
+// One frame in flight serialises the host and GPU, matching the old
+// behaviour of idling the queue after every present.
+const std::vector<uint32_t> FRAMES_IN_FLIGHT = {1, 2, 3};
+// Per-frame recording re-records every command buffer in draw(). Its cost is
+// timed inside draw() and recorded separately, since with several frames in
+// flight it overlaps GPU work and barely shows in the frame time.
+const std::vector<Device::RecordMode> RECORD_MODES = {
+    Device::RecordMode::STATIC, Device::RecordMode::PER_FRAME
+};
 
 template<typename T>
 void runBench(GLFWwindow *window, std::string fileName)
@@ -15,30 +27,74 @@ void runBench(GLFWwindow *window, std::string fileName)
 
     printf("\n\n\n** %s **\n", fileName.c_str());
     time_point startupTime, frameTime;
-    for (size_t t = 1; t <= 4; ++t)
+    for (const auto &m : RECORD_MODES)
     {
-        printf("Running threads: %zu\n", t);
-        bench.numThreads(t);
-        for (size_t i = 0; i<NUM_SETUPS; ++i)
+        const bool perFrameRecord = m==Device::RecordMode::PER_FRAME;
+        printf("Running per-frame record: %d\n", perFrameRecord);
+        bench.perFrameRecord(perFrameRecord);
+        for (const auto &f : FRAMES_IN_FLIGHT)
         {
-            printf("\tRunning setup: %zu\n", i);
-            startupTime = bench.start();
-            T tb(window,t);
-            bench.startupTime(startupTime);
-            bench.numVerts(tb.numVerts());
-            printf("\t\tRunning frames: ");
-            for (size_t j = 0; j<NUM_FRAMES; ++j)
+            printf("Running frames in flight: %u\n", f);
+            bench.framesInFlight(f);
+            for (size_t t = 1; t <= 4; ++t)
             {
-                printf("%zu ", j);
-                glfwPollEvents();
-                frameTime = bench.start();
-                tb.draw();
-                bench.frameTime(frameTime);
-                bench.record();
+                printf("Running threads: %zu\n", t);
+                bench.numThreads(t);
+                for (size_t i = 0; i<NUM_SETUPS; ++i)
+                {
+                    printf("\tRunning setup: %zu\n", i);
+                    startupTime = bench.start();
+                    T tb(window,t,f,m);
+                    bench.startupTime(startupTime);
+                    bench.numVerts(tb.numVerts());
+                    printf("\t\tRunning frames: ");
+                    for (size_t j = 0; j<NUM_FRAMES; ++j)
+                    {
+                        printf("%zu ", j);
+                        glfwPollEvents();
+                        frameTime = bench.start();
+                        tb.draw();
+                        bench.frameTime(frameTime);
+                        bench.recordTime(tb.recordTime());
+                        bench.record();
+                    }
+                    std::cout << "\n";
+                }
             }
-            std::cout << "\n";
         }
-    } 
+    }
+}
+
+// Resize repeatedly and record the peak resident set size, and the time of
+// the draw that handles each resize. Recording must reuse its command
+// buffers, so the peak should stay flat.
+template<typename T>
+void runSoak(GLFWwindow *window, std::string fileName)
+{
+    std::fstream file;
+    file.open(fileName, std::fstream::out);
+    file<<"resize,";
+    file<<"resizeTime,";
+    file<<"maxRSS\n";
+
+    printf("\n\n\n** %s **\n", fileName.c_str());
+    T tb(window,4,2,Device::RecordMode::STATIC);
+    Bench bench;
+    rusage usage;
+    for (size_t i = 0; i<NUM_RESIZES; ++i)
+    {
+        glfwPollEvents();
+        const time_point resizeTime = bench.start();
+        tb.resize();
+        tb.draw();
+        const float resizeMs = bench.duration(resizeTime);
+        getrusage(RUSAGE_SELF, &usage);
+        file<<i<<",";
+        file<<resizeMs<<",";
+        file<<usage.ru_maxrss;
+        file<<"\n";
+    }
+    file.close();
 }
 
 int main()
@@ -52,4 +108,9 @@ int main()
     runBench<MultipassBench>(window, "multipass.csv");
     runBench<ObjBench>(window, "obj.csv");
     runBench<SimpleTriangleBench>(window, "simple_triangle.csv");
+
+    runSoak<TriangleBench>(window, "triangle_soak.csv");
+    runSoak<MultipassBench>(window, "multipass_soak.csv");
+
+    runMemory(window, "memory.csv");
 }
\ No newline at end of file
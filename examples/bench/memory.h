@@ -0,0 +1,143 @@
+#ifndef EVK_EXAMPLES_BENCH_MEMORY_H_
+#define EVK_EXAMPLES_BENCH_MEMORY_H_
+
+#include "evulkan.h"
+#include "../util.h"
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+
+using namespace evk;
+
+// A synthetic mesh of 512 MiB of vertex data, rounded down to whole vertices
+// of sizeof(Vertex), which is 44 bytes.
+const size_t NUM_SYNTHETIC_VERTS = (size_t(512)<<20)/sizeof(Vertex);
+
+// Reads a field of /proc/self/status in kB: VmRSS is the resident set size,
+// and VmHWM is its peak since resetPeakRSS().
+size_t residentKB(const std::string &field)
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line))
+    {
+        if (line.compare(0, field.size()+1, field+":")==0)
+            return std::stoul(line.substr(field.size()+1));
+    }
+    return 0;
+}
+
+void resetPeakRSS()
+{
+    std::ofstream clearRefs("/proc/self/clear_refs");
+    clearRefs<<"5";
+}
+
+Vertex syntheticVertex(size_t i)
+{
+    Vertex v = {};
+    v.pos = {float(i%1024), float(i/1024%1024), float(i/(1024*1024))};
+    v.color = {1.0f, 1.0f, 1.0f};
+    return v;
+}
+
+std::vector<Vertex> syntheticVerts()
+{
+    std::vector<Vertex> vertices(NUM_SYNTHETIC_VERTS);
+    for (size_t i = 0; i < vertices.size(); ++i)
+        vertices[i]=syntheticVertex(i);
+    return vertices;
+}
+
+std::vector<Vertex> objVerts()
+{
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+    evk::loadOBJ("viking_room.obj", vertices, indices);
+    return vertices;
+}
+
+// Uploads a mesh with each StaticBuffer::Ownership and records the peak and
+// steady-state growth of the resident set size. RELEASE and CALLBACK should
+// hold nothing on the host once uploaded, and BORROW only the caller's copy.
+void runMemory(GLFWwindow *window, std::string fileName)
+{
+    std::fstream file;
+    file.open(fileName, std::fstream::out);
+    file<<"mesh,";
+    file<<"ownership,";
+    file<<"peakKB,";
+    file<<"steadyKB\n";
+
+    printf("\n\n\n** %s **\n", fileName.c_str());
+    Device device(4, deviceExtensions, 2, validationLayers);
+    WindowResize r;
+    createSurfaceGLFW(device, window, r);
+
+    auto record = [&](
+        const char *mesh, const char *ownership,
+        const std::function<void()> &upload)
+    {
+        printf("Running %s %s\n", mesh, ownership);
+        resetPeakRSS();
+        const size_t before = residentKB("VmRSS");
+        upload();
+        file<<mesh<<",";
+        file<<ownership<<",";
+        file<<residentKB("VmHWM")-before<<",";
+        file<<residentKB("VmRSS")-before<<"\n";
+    };
+
+    const std::vector<std::pair<const char*, std::vector<Vertex>(*)()>> meshes =
+    {
+        {"viking_room", objVerts},
+        {"synthetic", syntheticVerts}
+    };
+    for (const auto &mesh : meshes)
+    {
+        std::unique_ptr<StaticBuffer> buffer;
+        std::vector<Vertex> vertices;
+        record(mesh.first, "RELEASE", [&]()
+        {
+            vertices = mesh.second();
+            buffer.reset(new StaticBuffer(
+                device, vertices.data(), sizeof(Vertex), vertices.size(),
+                Buffer::Type::VERTEX
+            ));
+            std::vector<Vertex>().swap(vertices);
+        });
+        buffer.reset();
+
+        record(mesh.first, "BORROW", [&]()
+        {
+            vertices = mesh.second();
+            DataSpan span{vertices.data(), sizeof(Vertex), vertices.size()};
+            buffer.reset(new StaticBuffer(
+                device, span, Buffer::Type::VERTEX,
+                StaticBuffer::Ownership::BORROW
+            ));
+        });
+        buffer.reset();
+        std::vector<Vertex>().swap(vertices);
+    }
+
+    // The synthetic mesh is generated straight into staging memory.
+    std::unique_ptr<StaticBuffer> buffer;
+    record("synthetic", "CALLBACK", [&]()
+    {
+        auto fill = [](void *dst, size_t firstElement, size_t numElements)
+        {
+            auto *vertices = static_cast<Vertex*>(dst);
+            for (size_t i = 0; i < numElements; ++i)
+                vertices[i]=syntheticVertex(firstElement+i);
+        };
+        buffer.reset(new StaticBuffer(
+            device, fill, sizeof(Vertex), NUM_SYNTHETIC_VERTS,
+            Buffer::Type::VERTEX
+        ));
+    });
+    file.close();
+}
+
+#endif
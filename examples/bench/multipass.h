@@ -19,15 +19,27 @@ class MultipassBench
         glm::mat4 MV;
     };
 
-    MultipassBench(GLFWwindow *window, size_t numThreads)
+    ~MultipassBench()
+    {
+        device.wait();
+    }
+
+    MultipassBench(
+        GLFWwindow *window,
+        size_t numThreads,
+        uint32_t framesInFlight,
+        Device::RecordMode recordMode
+    )
     {
         const uint32_t swapchainSize = 2;
 
-        createGrid(NUM_CUBES*NUM_CUBES, vertices, indices);
+        createGrid(NUM_CUBES*NUM_CUBES, vertices, indices, drawItems);
 
         device = Device(
             numThreads, deviceExtensions, swapchainSize, validationLayers
         );
+        device.setMaxFramesInFlight(framesInFlight);
+        device.setRecordMode(recordMode);
 
         WindowResize r;
         createSurfaceGLFW(device, window, r);
@@ -90,7 +102,8 @@ class MultipassBench
         std::vector<Shader*> shaders0 = {&vertexShader0, &fragmentShader0};
 
         pipeline0 = Pipeline(
-            device, subpass0, descriptor0, vertexInput0, renderpass, shaders0
+            device, subpass0, descriptor0, vertexInput0, renderpass, shaders0,
+            Pipeline::Build::DEFERRED
         );
 
         vertexShader1 = Shader(device, "pass_1_vert.spv", Shader::Stage::VERTEX);
@@ -98,10 +111,13 @@ class MultipassBench
         std::vector<Shader*> shaders1 = {&vertexShader1, &fragmentShader1};
 
         pipeline1 = Pipeline(
-            device, subpass1, descriptor1, vertexInput1, renderpass, shaders1
+            device, subpass1, descriptor1, vertexInput1, renderpass, shaders1,
+            Pipeline::Build::DEFERRED
         );
         std::vector<Pipeline*> pipelines = {&pipeline0, &pipeline1};
+        device.buildPipelines(pipelines);
 
+        device.setDrawItems(drawItems);
         device.finalize(indexBuffer,vertexBuffer,pipelines);
     }
 
@@ -135,15 +151,26 @@ class MultipassBench
         counter++;
     }
 
+    void resize()
+    {
+        device.resizeRequired();
+    }
+
     size_t numVerts()
     {
         return vertices.size();
     }
 
+    float recordTime()
+    {
+        return device.recordTime();
+    }
+
     private:
     Device device;
     std::vector<Vertex> vertices;
     std::vector<uint32_t> indices;
+    std::vector<Device::DrawItem> drawItems;
     Attachment framebufferAttachment;
     Attachment depthAttachment;
     Attachment colorAttachment;
@@ -16,13 +16,25 @@ class ObjBench
         glm::mat4 proj;
     };
 
-    ObjBench(GLFWwindow *window, size_t numThreads)
+    ~ObjBench()
+    {
+        device.wait();
+    }
+
+    ObjBench(
+        GLFWwindow *window,
+        size_t numThreads,
+        uint32_t framesInFlight,
+        Device::RecordMode recordMode
+    )
     {
         const uint32_t swapchainSize = 2;
 
         device = Device(
             numThreads, deviceExtensions, swapchainSize, validationLayers
         );
+        device.setMaxFramesInFlight(framesInFlight);
+        device.setRecordMode(recordMode);
 
         WindowResize r;
         createSurfaceGLFW(device, window, r);
@@ -120,11 +132,21 @@ class ObjBench
         counter++;
     }
 
+    void resize()
+    {
+        device.resizeRequired();
+    }
+
     size_t numVerts()
     {
         return vertices.size();
     }
 
+    float recordTime()
+    {
+        return device.recordTime();
+    }
+
     private:
     Device device;
     std::vector<Vertex> vertices;
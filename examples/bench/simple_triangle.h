@@ -63,7 +63,9 @@ class SimpleTriangleBench {
         cleanup();
     };
 
-    SimpleTriangleBench(GLFWwindow *_window, size_t _)
+    SimpleTriangleBench(
+        GLFWwindow *_window, size_t, uint32_t, evk::Device::RecordMode
+    )
     {
         window=_window;
         initVulkan();
@@ -79,6 +81,12 @@ class SimpleTriangleBench {
         return 3;
     }
 
+    // Command buffers are only recorded at startup.
+    float recordTime()
+    {
+        return 0.0f;
+    }
+
 private:
     GLFWwindow* window;
 
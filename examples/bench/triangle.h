@@ -10,15 +10,25 @@ class TriangleBench
 {
     public:
     TriangleBench()=default;
-    ~TriangleBench()=default;
+    ~TriangleBench()
+    {
+        device.wait();
+    }
 
-    TriangleBench(GLFWwindow *window, size_t numThreads)
+    TriangleBench(
+        GLFWwindow *window,
+        size_t numThreads,
+        uint32_t framesInFlight,
+        Device::RecordMode recordMode
+    )
     {
         const uint32_t swapchainSize = 2;
 
         device = Device(
             numThreads, deviceExtensions, swapchainSize, validationLayers
         );
+        device.setMaxFramesInFlight(framesInFlight);
+        device.setRecordMode(recordMode);
 
         WindowResize r;
         createSurfaceGLFW(device,window,r);
@@ -70,11 +80,21 @@ class TriangleBench
         device.draw();
     }
 
+    void resize()
+    {
+        device.resizeRequired();
+    }
+
     size_t numVerts()
     {
         return vertices.size();
     }
 
+    float recordTime()
+    {
+        return device.recordTime();
+    }
+
     private:
     Device device;
     std::vector<Vertex> vertices;
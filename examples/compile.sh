@@ -9,3 +9,10 @@ do
     prefix="$(cut -d'.' -f1 <<<"$f")"
     $VULKAN_SDK/bin/glslc $f -o ${prefix}_frag.spv
 done
+
+for f in *.comp
+do
+    [ -e "$f" ] || continue
+    prefix="$(cut -d'.' -f1 <<<"$f")"
+    $VULKAN_SDK/bin/glslc $f -o ${prefix}_comp.spv
+done
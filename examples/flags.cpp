@@ -29,4 +29,6 @@ static bool ValidateNumThreads(const char* flagname, int value) {
 }
 DEFINE_int32(num_threads, 1, "Number of threads to use. Must be between 1 and 4 inclusive.");
 DEFINE_validator(num_threads, &ValidateNumThreads);
-DEFINE_bool(multipass, false, "Run the multipass version.");
\ No newline at end of file
+DEFINE_bool(multipass, false, "Run the multipass version.");
+DEFINE_bool(cull, false, "Cull cubes outside the view frustum on the GPU.");
+DEFINE_bool(instanced, false, "Draw one cube mesh instanced across the grid.");
\ No newline at end of file
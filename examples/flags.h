@@ -6,5 +6,7 @@
 DECLARE_int32(num_cubes);
 DECLARE_int32(num_threads);
 DECLARE_bool(multipass);
+DECLARE_bool(cull);
+DECLARE_bool(instanced);
 
 #endif
\ No newline at end of file
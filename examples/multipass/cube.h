@@ -44,7 +44,8 @@ struct Cube
 
     glm::vec3 center;
     std::vector<glm::vec3> vertices;
-    std::vector<uint32_t> indices;
+    // A cube has 8 vertices, so 16-bit indices always suffice.
+    std::vector<uint16_t> indices;
     glm::vec3 color={0,1,0};
 };
 
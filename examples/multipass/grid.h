@@ -49,7 +49,7 @@ void createGrid(
     for (auto cube : grid.cubes)
     {
         std::vector<glm::vec3> verts = cube.vertices;
-        std::vector<uint32_t> ind = cube.indices;
+        const auto &ind = cube.indices;
         for(size_t j = 0; j<verts.size(); ++j)
         {
             vertex.pos=verts[j];
@@ -65,4 +65,92 @@ void createGrid(
     }
 }
 
+void createGrid(
+    uint32_t numCubes,
+    std::vector<evk::Vertex> &vertices,
+    std::vector<uint32_t> &indices,
+    std::vector<evk::Device::DrawItem> &drawItems)
+{
+    const size_t firstCubeIndex = indices.size();
+    createGrid(numCubes, vertices, indices);
+
+    // Each cube is one draw item, so recording can be split by cube.
+    const uint32_t numGridCubes = pow(uint32_t(sqrt(numCubes)), 2);
+    const uint32_t numCubeIndices = (indices.size()-firstCubeIndex)/numGridCubes;
+    evk::Device::DrawItem drawItem;
+    drawItem.numIndices = numCubeIndices;
+    for (uint32_t i = 0; i < numGridCubes; ++i)
+    {
+        drawItem.firstIndex = firstCubeIndex+i*numCubeIndices;
+        drawItems.push_back(drawItem);
+    }
+}
+
+void createGridInstances(
+    uint32_t numCubes,
+    std::vector<evk::Vertex> &vertices,
+    std::vector<uint32_t> &indices,
+    std::vector<glm::mat4> &transforms)
+{
+    constexpr float GRID_SIZE = 2.0f;
+    numCubes = sqrt(numCubes);
+    float cubeSize = (GRID_SIZE/numCubes)*0.5;
+    Grid grid = Grid(GRID_SIZE, cubeSize, numCubes);
+
+    // One cube at the origin, moved to each grid cell by its transform.
+    Cube cube({0,0,0}, {1,1,1}, cubeSize);
+    evk::Vertex vertex;
+    for (const auto &v : cube.vertices)
+    {
+        vertex.pos=v;
+        vertex.color={1,0,1};
+        vertex.normal=-vertex.pos;
+        vertices.push_back(vertex);
+    }
+    indices.insert(indices.end(), cube.indices.begin(), cube.indices.end());
+    for (const auto &c : grid.cubes)
+    {
+        transforms.push_back(glm::translate(glm::mat4(1.0f), c.center));
+    }
+}
+
+void createGridBoundingSpheres(
+    uint32_t numCubes,
+    std::vector<evk::Device::BoundingSphere> &boundingSpheres)
+{
+    constexpr float GRID_SIZE = 2.0f;
+    numCubes = sqrt(numCubes);
+    float cubeSize = (GRID_SIZE/numCubes)*0.5;
+    Grid grid = Grid(GRID_SIZE, cubeSize, numCubes);
+    evk::Device::BoundingSphere boundingSphere;
+    // Half the diagonal of a cube.
+    boundingSphere.radius = cubeSize*0.5f*sqrt(3.0f);
+    for (auto cube : grid.cubes)
+    {
+        boundingSphere.center = cube.center;
+        boundingSpheres.push_back(boundingSphere);
+    }
+}
+
+// The planes of the view frustum of a model-view-projection matrix, in model
+// space, each as a normal and a distance. A point p is inside the frustum
+// when dot(plane.xyz,p)+plane.w >= 0 for every plane.
+struct Frustum
+{
+    Frustum()=default;
+    Frustum(const glm::mat4 &mvp)
+    {
+        glm::mat4 m = glm::transpose(mvp);
+        planes[0] = m[3]+m[0]; // Left.
+        planes[1] = m[3]-m[0]; // Right.
+        planes[2] = m[3]+m[1]; // Bottom.
+        planes[3] = m[3]-m[1]; // Top.
+        planes[4] = m[2];      // Near, with a depth range of 0 to 1.
+        planes[5] = m[3]-m[2]; // Far.
+        for (auto &plane : planes) plane /= glm::length(glm::vec3(plane));
+    }
+
+    glm::vec4 planes[6];
+};
+
 #endif
\ No newline at end of file
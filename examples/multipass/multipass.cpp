@@ -30,7 +30,16 @@ int main(int argc, char **argv)
 
     std::vector<Vertex> vertices;
     std::vector<uint32_t> indices;
-    createGrid(FLAGS_num_cubes, vertices, indices);
+    std::vector<Device::DrawItem> drawItems;
+    std::vector<glm::mat4> transforms;
+    if (FLAGS_instanced)
+    {
+        createGridInstances(FLAGS_num_cubes, vertices, indices, transforms);
+    }
+    else
+    {
+        createGrid(FLAGS_num_cubes, vertices, indices, drawItems);
+    }
 
     Device device(
         numThreads, deviceExtensions, swapchainSize, validationLayers
@@ -81,33 +90,79 @@ int main(int argc, char **argv)
     VertexInput vertexInput1(sizeof(Vertex));
     vertexInput1.setVertexAttributeVec3(0,offsetof(Vertex,pos));
 
-    StaticBuffer indexBuffer(
-        device, indices.data(), sizeof(indices[0]), indices.size(),
-        Buffer::Type::INDEX
-    );
+    // Per-instance transforms are read from binding 1.
+    if (FLAGS_instanced)
+    {
+        vertexInput0.setInstanceStride(sizeof(glm::mat4));
+        vertexInput0.setInstanceAttributeMat4(2,0);
+        vertexInput1.setInstanceStride(sizeof(glm::mat4));
+        vertexInput1.setInstanceAttributeMat4(1,0);
+    }
+
+    StaticBuffer indexBuffer(device, indices);
     StaticBuffer vertexBuffer(
         device, vertices.data(), sizeof(vertices[0]), vertices.size(),
         Buffer::Type::VERTEX
     );
+    const glm::mat4 identity(1.0f);
+    StaticBuffer instanceBuffer(
+        device,
+        FLAGS_instanced ? transforms.data() : &identity,
+        sizeof(glm::mat4),
+        FLAGS_instanced ? transforms.size() : 1,
+        Buffer::Type::INSTANCE
+    );
 
-    Shader vertexShader0(device, "pass_0_vert.spv", Shader::Stage::VERTEX);
+    Shader vertexShader0(
+        device,
+        FLAGS_instanced ? "pass_0_instanced_vert.spv" : "pass_0_vert.spv",
+        Shader::Stage::VERTEX
+    );
     Shader fragmentShader0(device, "pass_0_frag.spv", Shader::Stage::FRAGMENT);
     std::vector<Shader*> shaders0 = {&vertexShader0, &fragmentShader0};
 
     Pipeline pipeline0(
-        device, subpass0, descriptor0, vertexInput0, renderpass, shaders0
+        device, subpass0, descriptor0, vertexInput0, renderpass, shaders0,
+        Pipeline::Build::DEFERRED
     );
 
-    Shader vertexShader1(device, "pass_1_vert.spv", Shader::Stage::VERTEX);
+    Shader vertexShader1(
+        device,
+        FLAGS_instanced ? "pass_1_instanced_vert.spv" : "pass_1_vert.spv",
+        Shader::Stage::VERTEX
+    );
     Shader fragmentShader1(device, "pass_1_frag.spv", Shader::Stage::FRAGMENT);
     std::vector<Shader*> shaders1 = {&vertexShader1, &fragmentShader1};
 
     Pipeline pipeline1(
-        device, subpass1, descriptor1, vertexInput1, renderpass, shaders1
+        device, subpass1, descriptor1, vertexInput1, renderpass, shaders1,
+        Pipeline::Build::DEFERRED
     );
+    // Both passes compile at once, on the Device's threads.
     std::vector<Pipeline*> pipelines = {&pipeline0, &pipeline1};
+    device.buildPipelines(pipelines);
+
+    device.setDrawItems(drawItems);
+
+    // Cull the cubes against the view frustum on the GPU. Culling works on
+    // draw items, so it does not apply to the single instanced draw.
+    DynamicBuffer camera(device, sizeof(Frustum), Buffer::Type::UBO);
+    Shader cullShader(device, "cull_comp.spv", Shader::Stage::COMPUTE);
+    if (FLAGS_cull && !FLAGS_instanced)
+    {
+        std::vector<Device::BoundingSphere> boundingSpheres;
+        createGridBoundingSpheres(FLAGS_num_cubes, boundingSpheres);
+        device.setCulling(cullShader, camera, boundingSpheres);
+    }
 
-    device.finalize(indexBuffer,vertexBuffer,pipelines);
+    if (FLAGS_instanced)
+    {
+        device.finalize(indexBuffer,vertexBuffer,instanceBuffer,pipelines);
+    }
+    else
+    {
+        device.finalize(indexBuffer,vertexBuffer,pipelines);
+    }
 
     // Main loop.
     size_t counter=0;
@@ -136,11 +191,14 @@ int main(int argc, char **argv)
         uboUpdate.MVP_light = proj * view;
 
         ubo.update(&uboUpdate);
+        Frustum frustum(uboUpdate.MVP_model);
+        camera.update(&frustum);
 
         device.draw();
 
         counter++;
     }
+    device.wait();
 
     // Tidy up.
     glfwDestroyWindow(window);
@@ -82,9 +82,7 @@ int main(int argc, char **argv)
     vertexInput.setVertexAttributeVec3(1,offsetof(Vertex,color));
     vertexInput.setVertexAttributeVec2(2,offsetof(Vertex,texCoord));
 
-    StaticBuffer indexBuffer(
-        device, in.data(), sizeof(in[0]), in.size(), Buffer::Type::INDEX
-    );
+    StaticBuffer indexBuffer(device, in);
     StaticBuffer vertexBuffer(
         device, v.data(), sizeof(v[0]), v.size(), Buffer::Type::VERTEX
     );
@@ -127,4 +125,5 @@ int main(int argc, char **argv)
 
         counter++;
     }
+    device.wait();
 }
@@ -45,10 +45,7 @@ int main()
     vertexInput.setVertexAttributeVec3(0,offsetof(Vertex,pos));
     vertexInput.setVertexAttributeVec3(1,offsetof(Vertex,color));
 
-    StaticBuffer indexBuffer(
-        device, indices.data(), sizeof(indices[0]), indices.size(),
-        Buffer::Type::INDEX
-    );
+    StaticBuffer indexBuffer(device, indices);
     StaticBuffer vertexBuffer(
         device, vertices.data(), sizeof(vertices[0]), vertices.size(),
         Buffer::Type::VERTEX
@@ -69,4 +66,5 @@ int main()
         glfwPollEvents();
         device.draw();
     }
+    device.wait();
 }
\ No newline at end of file
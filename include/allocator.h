@@ -0,0 +1,193 @@
+#ifndef EVK_ALLOCATOR_H_
+#define EVK_ALLOCATOR_H_
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace internal
+{
+
+class Allocator;
+
+/**
+ * A range of VkDeviceMemory handed out by the Allocator. Resources are bound
+ * at offset within memory, which may be shared with other resources.
+ **/
+struct Allocation
+{
+    VkDeviceMemory memory=VK_NULL_HANDLE;
+    VkDeviceSize offset=0;
+    VkDeviceSize size=0;
+    // The start of the range on the host, if the memory is host-visible.
+    void *data=nullptr;
+    // The pool the range came from, or -1 for a dedicated allocation.
+    int32_t pool=-1;
+    Allocator *allocator=nullptr;
+
+    bool operator==(const Allocation &other) const noexcept
+    {
+        return memory==other.memory && offset==other.offset;
+    }
+    bool operator!=(const Allocation &other) const noexcept
+    {
+        return !(*this==other);
+    }
+};
+
+/**
+ * Usage of the device memory held by an Allocator. Fragmentation shows as
+ * many free ranges, or a largest free range much smaller than the free bytes.
+ **/
+struct MemoryStats
+{
+    // VkDeviceMemory objects held, counting blocks and dedicated allocations.
+    uint32_t numDeviceAllocations=0;
+    // Allocations handed out to resources.
+    uint32_t numAllocations=0;
+    // Bytes held in VkDeviceMemory objects.
+    VkDeviceSize bytesReserved=0;
+    // Bytes handed out to resources.
+    VkDeviceSize bytesUsed=0;
+    // Free ranges across all blocks.
+    uint32_t numFreeRanges=0;
+    VkDeviceSize largestFreeRange=0;
+};
+
+/**
+ * @class FreeList
+ * @brief Tracks the free ranges of a block of memory.
+ *
+ * Free ranges are kept sorted by offset. allocate() takes the first range
+ * that can hold the aligned request, and free() merges a range with its free
+ * neighbours, so the list stays as short as the fragmentation allows.
+ **/
+class FreeList
+{
+    public:
+    FreeList()=default;
+    explicit FreeList(VkDeviceSize size) noexcept;
+
+    /**
+     * Allocates a range from the list.
+     * @param[in] size the size of the range in bytes.
+     * @param[in] alignment the required alignment of the range's offset.
+     * @param[out] pOffset the offset of the range.
+     * @returns true if the range was allocated.
+     **/
+    bool allocate(
+        VkDeviceSize size,
+        VkDeviceSize alignment,
+        VkDeviceSize *pOffset
+    ) noexcept;
+    /**
+     * Returns a range allocated from the list.
+     * @param[in] offset the offset of the range.
+     * @param[in] size the size of the range.
+     **/
+    void free(VkDeviceSize offset, VkDeviceSize size) noexcept;
+
+    VkDeviceSize size() const noexcept { return m_size; }
+    VkDeviceSize used() const noexcept { return m_used; }
+    size_t numFreeRanges() const noexcept { return m_freeRanges.size(); }
+    VkDeviceSize largestFreeRange() const noexcept;
+
+    private:
+    // Offset to size.
+    std::map<VkDeviceSize, VkDeviceSize> m_freeRanges;
+    VkDeviceSize m_size=0;
+    VkDeviceSize m_used=0;
+};
+
+/**
+ * @class Allocator
+ * @brief Sub-allocates buffers and images from large blocks of device memory.
+ *
+ * Drivers limit the number of VkDeviceMemory objects, and allocating them is
+ * slow, so the Allocator reserves memory in blocks and places resources
+ * inside them. There is one pool of blocks for each memory type, and
+ * buffers and images use separate pools so that linear and optimal
+ * resources never share a page. Resources larger than half a block get a
+ * dedicated VkDeviceMemory. Host-visible blocks stay mapped for their whole
+ * lifetime.
+ *
+ * Each VkDevice has one Allocator, which createBuffer() and createImage()
+ * use. It is safe to allocate and free from several threads.
+ **/
+class Allocator
+{
+    public:
+    Allocator(VkDevice device, VkPhysicalDevice physicalDevice) noexcept;
+    Allocator(const Allocator&)=delete; // Class Allocator is not copyable.
+    Allocator& operator=(const Allocator&)=delete; // Class Allocator is not copyable.
+    ~Allocator() noexcept;
+
+    /**
+     * Gets the Allocator for a VkDevice, creating it on first use.
+     * @param[in] device the VkDevice that owns the memory.
+     * @param[in] physicalDevice the VkPhysicalDevice of the device.
+     * @returns the Allocator for the device.
+     **/
+    static Allocator& get(
+        VkDevice device,
+        VkPhysicalDevice physicalDevice
+    ) noexcept;
+    /**
+     * Frees all memory held for a VkDevice. Called before the device is
+     * destroyed, once all of its resources have been destroyed.
+     * @param[in] device the VkDevice whose Allocator is destroyed.
+     **/
+    static void destroy(VkDevice device) noexcept;
+
+    /**
+     * Allocates memory for a resource.
+     * @param[in] requirements the resource's memory requirements.
+     * @param[in] properties the desired properties of the memory.
+     * @param[in] image whether the resource is an image.
+     * @returns the allocated range.
+     **/
+    Allocation allocate(
+        const VkMemoryRequirements &requirements,
+        VkMemoryPropertyFlags properties,
+        bool image
+    ) noexcept;
+    /**
+     * Frees memory allocated by allocate().
+     * @param[in] allocation the range to free.
+     **/
+    void free(const Allocation &allocation) noexcept;
+
+    MemoryStats stats() const noexcept;
+
+    private:
+    struct Block
+    {
+        VkDeviceMemory memory=VK_NULL_HANDLE;
+        void *data=nullptr;
+        FreeList freeList;
+    };
+
+    VkDeviceMemory allocateMemory(
+        VkDeviceSize size,
+        uint32_t memoryType,
+        void **ppData
+    ) noexcept;
+    VkDeviceSize blockSize(uint32_t memoryType) const noexcept;
+    void freeMemory(VkDeviceMemory memory, void *data) noexcept;
+
+    VkDeviceSize m_dedicatedBytes=0;
+    VkDevice m_device=VK_NULL_HANDLE;
+    VkPhysicalDeviceMemoryProperties m_memoryProperties={};
+    mutable std::mutex m_mutex;
+    uint32_t m_numAllocations=0;
+    uint32_t m_numDedicated=0;
+    VkPhysicalDevice m_physicalDevice=VK_NULL_HANDLE;
+    // Two pools per memory type: buffers, then images.
+    std::vector<std::vector<Block>> m_pools;
+};
+
+} // namespace internal
+
+#endif
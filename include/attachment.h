@@ -16,7 +16,7 @@ namespace evk {
  * 
  * The Framebuffer Attachment is reserved at index 0. It is used to display
  * images on the screen. The fragment Shader in the final Subpass writes to
- * this Attachment.
+ * this Attachment. On a headless Device, it is an offscreen image instead.
  * 
  * @example
  * Attachment framebufferAttachment(device, 0, Attachment::Type::FRAMEBUFFER);
@@ -60,7 +60,7 @@ class Attachment
 
     private:
     void createFramebuffer() noexcept;
-    void setFramebufferAttachment() noexcept;
+    void setFramebufferAttachment(const Device &device) noexcept;
     void setColorAttachment(const Device &device) noexcept;
     void setDepthAttachment(const Device &device) noexcept;
     void recreate(Device &device) noexcept;
@@ -97,7 +97,7 @@ class Attachment
     VkDevice m_device;
     VkFormat m_format;
     VkImage m_image=VK_NULL_HANDLE;
-    VkDeviceMemory m_imageMemory=VK_NULL_HANDLE;
+    internal::Allocation m_imageMemory;
     VkImageView m_imageView=VK_NULL_HANDLE;
     uint32_t m_index;
     VkAttachmentReference m_inputReference;
@@ -115,6 +115,7 @@ class Attachment
     // Tests.
     FRIEND_TEST(AttachmentTest,ctor);
     FRIEND_TEST(AttachmentTest,move);
+    FRIEND_TEST(DeviceTest,headless);
     FRIEND_TEST(PassTest,constructDescriptions);
 };
 
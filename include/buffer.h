@@ -2,12 +2,33 @@
 #define EVK_BUFFER_H_
 
 #include "device.h"
+#include <functional>
 #include "util.h"
 #include <vector>
 #include <vulkan/vulkan.h>
 
 namespace evk {
 
+/**
+ * A view of host data that the caller owns: numElements elements of
+ * elementSize bytes each, starting at data.
+ **/
+struct DataSpan
+{
+    const void *data=nullptr;
+    VkDeviceSize elementSize=0;
+    size_t numElements=0;
+};
+
+/**
+ * A range of a Buffer, in bytes.
+ **/
+struct BufferRange
+{
+    VkDeviceSize offset=0;
+    VkDeviceSize size=0;
+};
+
 /**
  * @class Buffer
  * @brief A Buffer is used to make data available to the GPU.
@@ -18,19 +39,34 @@ namespace evk {
  * the GPU with faster setup speeds with slower access speeds.
  * 
  * For data that will be updated during the program, it is recommended to use a
- * DynamicBuffer. Otherwise, a StaticBuffer is optimal.
+ * DynamicBuffer. Otherwise, a StaticBuffer is optimal. Parts of a StaticBuffer
+ * can still be updated, for geometry that changes now and then or is streamed
+ * in, at the cost of staging and copying the changed bytes.
+ * 
+ * Neither Buffer keeps a copy of the user's data. A StaticBuffer reads it
+ * once, while uploading, unless its Ownership says otherwise, and a
+ * DynamicBuffer writes it straight to mapped memory.
+ * 
+ * A DynamicBuffer UBO or STORAGE buffer is a ring buffer with one region per
+ * swapchain image, so update() never writes a region the GPU may still be
+ * reading. It is bound as a dynamic uniform or storage buffer, and each frame
+ * reads the region of the image it renders to.
  * 
  * Common usages of the StaticBuffer include an index buffer, or vertex buffer.
  * A common usage of the DynamicBuffer includes a Uniform Buffer Object (UBO)
- * which is updated every frame.
+ * which is updated every frame. Per-object data that is too large for a UBO,
+ * such as the transforms of thousands of objects, belongs in a STORAGE
+ * buffer.
  * 
  * The index buffer and vertex buffer must be attached to the Device, using the
  * finalize() method. Other custom buffers must be attached to a Descriptor.
  * 
+ * An index buffer carries its index type, which follows from its element
+ * size of 2 or 4 bytes. A StaticBuffer created from 32-bit indices stores them
+ * as 16-bit indices whenever they fit.
+ * 
  * @example
- * StaticBuffer indexBuffer(
- *   device, indices.data(), sizeof(indices[0]), indices.size(), Buffer::INDEX
- * );
+ * StaticBuffer indexBuffer(device, indices);
  * StaticBuffer vertexBuffer(
  *   device, vertices.data(), sizeof(vertices[0]), vertices.size(),
  *   Buffer::VERTEX
@@ -44,7 +80,16 @@ namespace evk {
 class Buffer
 {
     public:
-    enum class Type{INDEX,VERTEX,UBO};
+    /**
+     * INDEX: indices into the vertex Buffer.
+     * VERTEX: per-vertex data.
+     * INSTANCE: per-instance data, such as a transform for each instance.
+     * UBO: a uniform buffer.
+     * STORAGE: a shader storage buffer (SSBO), for arrays too large for a UBO.
+     * INDIRECT: indirect draw arguments, which shaders may also write as a
+     * storage buffer.
+     **/
+    enum class Type{INDEX,VERTEX,INSTANCE,UBO,STORAGE,INDIRECT};
 
     Buffer()=default;
     Buffer(const Buffer&)=delete; // Class Buffer is not copyable.
@@ -58,6 +103,16 @@ class Buffer
 
     protected:
     VkBuffer buffer() const noexcept { return m_buffer; };
+    VkIndexType indexType() const noexcept { return m_indexType; };
+    /**
+     * Gets the offset of the region that a swapchain image reads.
+     * @param[in] imageIndex the index of the swapchain image.
+     * @returns the offset in bytes, which is 0 unless the Buffer is a ring.
+     **/
+    uint32_t dynamicOffset(uint32_t imageIndex) const noexcept
+    {
+        return (imageIndex%m_numRegions)*m_regionStride;
+    };
     size_t numElements() const noexcept { return m_numElements; };
     VkDeviceSize size() const noexcept { return m_bufferSize; }; 
 
@@ -68,25 +123,35 @@ class Buffer
         VkBuffer dstBuffer
     ) const noexcept;
     void reset() noexcept;
+    void setIndexType(const Type &type) noexcept;
     VkBufferUsageFlags typeToFlag(const Type &type) const noexcept;
 
     VkBuffer m_buffer=VK_NULL_HANDLE;
-    void *m_bufferData=nullptr;
-    VkDeviceMemory m_bufferMemory=VK_NULL_HANDLE;
+    internal::Allocation m_bufferMemory;
     VkDeviceSize m_bufferSize=0;
     VkDevice m_device=VK_NULL_HANDLE;
     VkDeviceSize m_elementSize=0;
+    // The index type, if the Buffer is an index buffer.
+    VkIndexType m_indexType=VK_INDEX_TYPE_UINT32;
     size_t m_numElements=0;
+    // Ring buffers have one region per swapchain image.
+    uint32_t m_numRegions=1;
     size_t m_numThreads=1;
+    Device *m_owner=nullptr;
     VkPhysicalDevice m_physicalDevice=VK_NULL_HANDLE;
     VkQueue m_queue=VK_NULL_HANDLE;
+    // The distance between regions, aligned for dynamic offsets.
+    VkDeviceSize m_regionStride=0;
 
     friend class Descriptor;
     friend class Device;
 
     // Tests.
     FRIEND_TEST(BufferTest,ctor);
+    FRIEND_TEST(BufferTest,indexType);
+    FRIEND_TEST(BufferTest,ownership);
     FRIEND_TEST(BufferTest,update);
+    FRIEND_TEST(DeviceTest,regions);
 };
 
 class DynamicBuffer : public Buffer
@@ -97,9 +162,10 @@ class DynamicBuffer : public Buffer
      * Creates a DynamicBuffer.
      * @param[in] device the device used to construct the Buffer.
      * @param[in] bufferSize the size of the Buffer in bytes.
+     * @param[in] type the Type of the Buffer.
      **/
     DynamicBuffer(
-        const Device &device,
+        Device &device,
         const VkDeviceSize &bufferSize,
         const Type &type
     ) noexcept;
@@ -119,18 +185,46 @@ class DynamicBuffer : public Buffer
         const Type &type
     ) noexcept;
     /**
-     * Updates a DynamicBuffer.
+     * Updates a DynamicBuffer. The data is written straight to mapped memory.
+     * For a UBO or STORAGE buffer, it is written to the region read by the
+     * next draw(). This acquires the swapchain image of that draw and waits
+     * until the GPU has finished with the region, so it may block, and if
+     * the swapchain is out of date it is recreated first. The other regions
+     * are copied from it as their images are acquired, so an update stays
+     * in effect until the next one and need not be repeated every frame.
+     * Other types have a single region, which must not be in use by the GPU.
      * @param[in] data a pointer to the data which will fill the Buffer.
      **/
     void update(const void *data) noexcept;
+
+    private:
+    void create(Device &device, const Type &type) noexcept;
 };
 
 class StaticBuffer : public Buffer
 {
     public:
+    /**
+     * How a StaticBuffer holds on to the data it was created from.
+     * RELEASE: the data is read once, while uploading, and nothing is kept.
+     * BORROW: the caller's data is kept by pointer, without a copy, and is
+     * read again by reupload(). It must outlive the StaticBuffer.
+     * CALLBACK: a Fill function writes the data into staging memory, and is
+     * called again by reupload().
+     **/
+    enum class Ownership{RELEASE,BORROW,CALLBACK};
+
+    /**
+     * Writes numElements elements, starting at firstElement, to dst. Upload
+     * threads call it at the same time for disjoint ranges.
+     **/
+    typedef std::function<
+        void(void *dst, size_t firstElement, size_t numElements)
+    > Fill;
+
     StaticBuffer()=default;
     /**
-     * Creates a StaticBuffer.
+     * Creates a StaticBuffer. The data is not kept once it is uploaded.
      * @param[in] device the device used to construct the Buffer.
      * @param[in] data a pointer to the data that will fill the Buffer.
      * @param[in] elementSize the size of each Buffer element in bytes.
@@ -144,24 +238,110 @@ class StaticBuffer : public Buffer
         const size_t numElements,
         const Type &type
     ) noexcept;
+    /**
+     * Creates a StaticBuffer from data owned by the caller.
+     * @param[in] device the device used to construct the Buffer.
+     * @param[in] data the data that will fill the Buffer.
+     * @param[in] type the Type of the Buffer.
+     * @param[in] ownership RELEASE or BORROW.
+     **/
+    StaticBuffer(
+        Device &device,
+        const DataSpan &data,
+        const Type &type,
+        const Ownership &ownership=Ownership::RELEASE
+    ) noexcept;
+    /**
+     * Creates an INDEX StaticBuffer. The indices are stored as 16-bit indices
+     * if every index fits, which halves the memory they take and the
+     * bandwidth of reading them, and as 32-bit indices otherwise.
+     * @param[in] device the device used to construct the Buffer.
+     * @param[in] indices the indices that will fill the Buffer.
+     * @param[in] ownership RELEASE or BORROW.
+     **/
+    StaticBuffer(
+        Device &device,
+        const std::vector<uint32_t> &indices,
+        const Ownership &ownership=Ownership::RELEASE
+    ) noexcept;
+    /**
+     * Creates a StaticBuffer whose data is written by a callback, so that the
+     * data never has to be held on the host in one piece.
+     * @param[in] device the device used to construct the Buffer.
+     * @param[in] fill the Fill function that writes the data.
+     * @param[in] elementSize the size of each Buffer element in bytes.
+     * @param[in] numElements the number of elements in the Buffer.
+     * @param[in] type the Type of the Buffer.
+     **/
+    StaticBuffer(
+        Device &device,
+        const Fill &fill,
+        const VkDeviceSize &elementSize,
+        const size_t numElements,
+        const Type &type
+    ) noexcept;
+
+    /**
+     * Uploads the data again, from the borrowed data or the Fill function,
+     * and waits for the upload to finish. The Buffer must not be in use by
+     * the GPU.
+     * @param[in] device the device used to construct the Buffer.
+     **/
+    void reupload(Device &device) noexcept;
+    /**
+     * Updates part of the Buffer. The data is staged now, and copied to the
+     * device before the draws of the next draw(), so the host may reuse it
+     * straight away. Frames already submitted still read the old data.
+     * @param[in] offset the offset of the range in bytes.
+     * @param[in] size the size of the range in bytes.
+     * @param[in] data a pointer to the size bytes that fill the range.
+     **/
+    void update(
+        VkDeviceSize offset,
+        VkDeviceSize size,
+        const void *data
+    ) noexcept;
+    /**
+     * Updates the dirty ranges of the Buffer, in the same way as update().
+     * Overlapping and adjacent ranges are merged, and only the ranges are
+     * staged and copied.
+     * @param[in] ranges the ranges to update, in bytes.
+     * @param[in] data the new contents of the whole Buffer, which is only
+     *  read within the ranges.
+     **/
+    void updateRanges(
+        const std::vector<BufferRange> &ranges,
+        const void *data
+    ) noexcept;
+
+    /**
+     * Gets the upload value of the Buffer's data. The data is copied to the
+     * device asynchronously, and is there once Device::uploadComplete()
+     * returns true for this value. Device::finalize() waits for it.
+     * @returns the upload value.
+     **/
+    uint64_t uploadValue() const noexcept { return m_uploadValue; };
 
     private:
-    void copyData(
-        VkDevice device,
-        VkPhysicalDevice physicalDevice,
-        VkCommandPool command_pool,
-        VkCommandBuffer &command_buffer,
-        VkBuffer device_buffer,
-        VkBuffer &staging_buffer,
-        VkDeviceMemory &staging_buffer_memory,
-        const size_t num_elements,
-        const VkDeviceSize element_size,
-        const size_t element_offset
-    ) const noexcept;
-    void finalize(
+    void create(
         Device &device,
+        const VkDeviceSize &elementSize,
+        const size_t numElements,
         const Type &type
     ) noexcept;
+    void recordUpdate(
+        const std::vector<BufferRange> &ranges,
+        const unsigned char *data,
+        VkDeviceSize dataOffset
+    ) noexcept;
+    void upload(Device &device, const Fill &fill) noexcept;
+
+    // Empty unless the Ownership is BORROW or CALLBACK.
+    Fill m_fill;
+    uint64_t m_uploadValue=0;
+
+    // Tests.
+    FRIEND_TEST(BufferTest,ownership);
 };
 
 } // namespace evk
@@ -17,7 +17,7 @@ namespace evk {
  * 
  * A Descriptor is used to describe a resource that will be used in either the 
  * vertex or fragment shader. Such resources include an InputAttachment, a 
- * TextureSampler and a UniformBuffer. Each of these has an associated
+ * TextureSampler, a UniformBuffer and a StorageBuffer. Each of these has an associated
  * binding, which represents the order in which they are accessed and
  * bound to the Shader. Each one also has a specified Stage which
  * represents the Shader::Stage at which the resource will be
@@ -26,6 +26,7 @@ namespace evk {
  * InputAttachment: an Attachment as an input to the Shader.
  * TextureSampler: used to sample a Texture object bound to the Shader.
  * UniformBuffer: a Uniform Buffer object bound to the Shader.
+ * StorageBuffer: a shader storage buffer (SSBO) bound to the Shader.
  * 
  * The Descriptor is then bound to a Pipeline.
  * 
@@ -84,7 +85,9 @@ class Descriptor
     ) noexcept;
 
     /**
-     * Adds a uniform buffer object (UBO) binding to the descriptor.
+     * Adds a uniform buffer object (UBO) binding to the descriptor. A
+     * DynamicBuffer UBO is bound as a dynamic uniform buffer, and each frame
+     * reads the region written for it.
      * @param[in] binding where the UBO will be bound.
      * @param[in] buffer the UBO to bind.
      * @param[in] shaderStage the stage to bind the UBO to.
@@ -94,15 +97,41 @@ class Descriptor
         const Buffer &buffer,
         const Shader::Stage shaderStage
     ) noexcept;
+
+    /**
+     * Adds a storage buffer binding to the descriptor, for a STORAGE or
+     * INDIRECT Buffer. A DynamicBuffer STORAGE buffer is bound as a dynamic
+     * storage buffer, and each frame reads the region written for it.
+     * @param[in] binding where the storage buffer will be bound.
+     * @param[in] buffer the storage buffer to bind.
+     * @param[in] shaderStage the stage to bind the storage buffer to.
+     **/
+    void addStorageBuffer(
+        const uint32_t binding,
+        const Buffer &buffer,
+        const Shader::Stage shaderStage
+    ) noexcept;
     
     private:
     enum class Type{
         INPUT_ATTACHMENT,
         TEXTURE_SAMPLER,
-        UNIFORM_BUFFER  
+        UNIFORM_BUFFER,
+        UNIFORM_BUFFER_DYNAMIC,
+        STORAGE_BUFFER,
+        STORAGE_BUFFER_DYNAMIC
+    };
+
+    // A ring Buffer bound with a dynamic offset.
+    struct DynamicBinding
+    {
+        uint32_t set;
+        uint32_t binding;
+        const Buffer *buffer;
     };
 
     VkDescriptorType descriptorType(Type type) const noexcept;
+    std::vector<uint32_t> dynamicOffsets(uint32_t imageIndex) const noexcept;
     std::vector<VkDescriptorSetLayout> setLayouts() const noexcept
     {
         return m_setLayouts;
@@ -112,6 +141,13 @@ class Descriptor
         return m_sets;
     };
 
+    void addBuffer(
+        Type type,
+        Type dynamicType,
+        uint32_t binding,
+        const Buffer &buffer,
+        Shader::Stage stage
+    ) noexcept;
     void addDescriptorSetBinding(
         Type type,
         uint32_t binding,
@@ -153,6 +189,8 @@ class Descriptor
     std::vector<Attachment*> m_attachments;
     std::vector<std::unique_ptr<VkDescriptorBufferInfo>> m_bufferInfo;
     VkDevice m_device=VK_NULL_HANDLE;
+    // Sorted by set and binding, the order of the dynamic offsets.
+    std::vector<DynamicBinding> m_dynamicBindings;
     std::vector<std::unique_ptr<VkDescriptorImageInfo>> m_inputAttachmentInfo;
     VkDescriptorPool m_pool=VK_NULL_HANDLE;
     std::vector<VkDescriptorPoolSize> m_poolSizes;
@@ -169,7 +207,9 @@ class Descriptor
 
     // Testing.
     FRIEND_TEST(DescriptorTest,ctor);
+    FRIEND_TEST(DescriptorTest,dynamicUniformBuffers);
     FRIEND_TEST(DescriptorTest,multipleUniformBuffers);
+    FRIEND_TEST(DescriptorTest,storageBuffers);
 };
 
 } // namespace evk
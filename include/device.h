@@ -1,7 +1,9 @@
 #ifndef EVK_DEVICE_H_
 #define EVK_DEVICE_H_
 
+#include <atomic>
 #include <functional>
+#include <mutex>
 #include "threadpool.h"
 #include "util.h"
 #include <vulkan/vulkan.h>
@@ -9,8 +11,10 @@
 namespace evk {
     
 class Buffer;
+class DynamicBuffer;
 class Pipeline;
 class Renderpass;
+class Shader;
 
 /**
  * @class Device
@@ -30,6 +34,12 @@ class Renderpass;
  *  including the VkFences and VkSemaphores, ensuring that host-device
  *  synchronization is properly set up.
  * Framebuffer: holds the VkFramebuffer required to blit images to the screen.
+ * Offscreen: replaces the Swapchain on a headless Device, which renders into
+ *  a ring of images without a window, such as in CI or on a render farm.
+ * 
+ * All frame state is owned by the Device, so separate Devices may draw
+ * concurrently from separate threads. A single Device serialises calls to
+ * draw(), and resizeRequired() may be called from any thread.
  * 
  * @example
  * Device device(
@@ -39,12 +49,59 @@ class Renderpass;
 class Device
 {
     public:
+    /**
+     * STATIC command buffers are recorded once, in finalize(), and again only
+     * when the window is resized. PER_FRAME command buffers are re-recorded on
+     * the thread pool during every draw(), into per-frame command pools that
+     * are reset wholesale, so changes to the scene take effect immediately.
+     **/
+    enum class RecordMode{STATIC,PER_FRAME};
+
+    /**
+     * A range of the index buffer that is drawn as one unit, such as a
+     * sub-mesh, an object or a meshlet. Many meshes may share the index and
+     * vertex buffers; vertexOffset is added to each index of the item. The
+     * item is drawn numInstances times, reading the instance Buffer from
+     * firstInstance.
+     * Recording threads are given whole draw items, balanced by their
+     * estimated cost, rather than arbitrary slices of the index buffer.
+     **/
+    struct DrawItem
+    {
+        uint32_t firstIndex=0;
+        uint32_t numIndices=0;
+        int32_t vertexOffset=0;
+        uint32_t firstInstance=0;
+        uint32_t numInstances=1;
+    };
+
+    /**
+     * A sphere bounding a draw item, used for culling on the GPU.
+     **/
+    struct BoundingSphere
+    {
+        glm::vec3 center={0,0,0};
+        float radius=0;
+    };
+
+    /**
+     * Receives the pixels of a frame once the GPU has finished it. The pixels
+     * are extent.height rows of 4-byte pixels in the format of the
+     * FRAMEBUFFER Attachment, tightly packed. They are read straight from
+     * mapped memory and are only valid during the call.
+     **/
+    using ReadbackFunc = std::function<
+        void(uint64_t frameValue, const void *pixels, VkExtent2D extent)
+    >;
+
     Device()=default;
     Device(const Device&)=delete; // Class Device is non-copyable.
     Device& operator=(const Device&)=delete; // Class Device is non-copyable.
+    // Buffers keep a pointer to their Device, so a Device cannot be moved
+    // once Buffers have been created from it.
     Device(Device&&) noexcept;
     Device& operator=(Device&&) noexcept;
-    ~Device()=default;
+    ~Device() noexcept;
 
     /**
      * Constructs a Device without validation layers.
@@ -98,21 +155,98 @@ class Device
         const std::vector<const char *> &windowExtensions
     ) noexcept;
 
+    /**
+     * Finishes Device setup without a window. Frames are drawn into a ring of
+     * swapchainSize offscreen images, and draw() neither presents nor waits
+     * for vsync. No surface or swapchain extensions are needed, so this runs
+     * on software drivers such as lavapipe. The FRAMEBUFFER Attachment is
+     * left in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL for readFrame().
+     * @param[in] width the image width in pixels.
+     * @param[in] height the image height in pixels.
+     **/
+    void createHeadless(uint32_t width, uint32_t height) noexcept;
+
+    /**
+     * Persists the pipeline cache shared by every Pipeline in a file. The
+     * cache is loaded from the file now, if it was written for this device
+     * and driver, and saved back to it when the Device is destroyed, so that
+     * later runs skip shader compilation. Call this after the surface is
+     * created and before Pipelines are, since earlier Pipelines are only
+     * merged into the saved cache.
+     * @param[in] fileName the cache file, which need not exist yet.
+     **/
+    void setPipelineCacheFile(const std::string &fileName) noexcept;
+
+    /**
+     * Compiles Pipelines created with Pipeline::Build::DEFERRED, spread
+     * across the Device's threads. They share the pipeline cache, so
+     * Pipelines with common shaders compile once. Pipelines that are already
+     * compiled are skipped, and finalize() calls this for any that remain.
+     * @param[in] pipelines the Pipelines to compile.
+     **/
+    void buildPipelines(const std::vector<Pipeline*> &pipelines) noexcept;
+
     /**
      * Finalize the device. This is the last function that is called before
-     * draw().
+     * draw(). It waits for all uploads to finish.
+     * @param[in] indexBuffer the index buffer.
+     * @param[in] vertexBuffer the vertex buffer.
+     * @param[in] pipelines the set of pipelines used for drawing.
+     **/
+    void finalize(
+        Buffer &indexBuffer,
+        Buffer &vertexBuffer,
+        std::vector<Pipeline*> &pipelines
+    ) noexcept;
+
+    /**
+     * Finalize the device for instanced drawing. The instance buffer is bound
+     * to the per-instance binding of each Pipeline's VertexInput. Without
+     * draw items, every instance in the buffer is drawn.
      * @param[in] indexBuffer the index buffer.
      * @param[in] vertexBuffer the vertex buffer.
+     * @param[in] instanceBuffer the INSTANCE buffer.
      * @param[in] pipelines the set of pipelines used for drawing.
      **/
     void finalize(
         Buffer &indexBuffer,
         Buffer &vertexBuffer,
+        Buffer &instanceBuffer,
         std::vector<Pipeline*> &pipelines
     ) noexcept;
 
     /**
-     * Draw.
+     * Finalize the device with vertex data split into streams. Each stream's
+     * Buffer is bound to the stream's binding in every Pipeline's
+     * VertexInput, and a Pipeline reads only the streams it uses.
+     * @param[in] indexBuffer the index buffer.
+     * @param[in] vertexStreams the vertex buffer of each stream, in order.
+     * @param[in] pipelines the set of pipelines used for drawing.
+     **/
+    void finalize(
+        Buffer &indexBuffer,
+        const std::vector<Buffer*> &vertexStreams,
+        std::vector<Pipeline*> &pipelines
+    ) noexcept;
+
+    /**
+     * Finalize the device for instanced drawing, with vertex data split
+     * into streams.
+     * @param[in] indexBuffer the index buffer.
+     * @param[in] vertexStreams the vertex buffer of each stream, in order.
+     * @param[in] instanceBuffer the INSTANCE buffer.
+     * @param[in] pipelines the set of pipelines used for drawing.
+     **/
+    void finalize(
+        Buffer &indexBuffer,
+        const std::vector<Buffer*> &vertexStreams,
+        Buffer &instanceBuffer,
+        std::vector<Pipeline*> &pipelines
+    ) noexcept;
+
+    /**
+     * Draw. Acquires the next swapchain image, submits its command buffer and
+     * presents it. Thread-safe with respect to other calls on this Device.
      **/
     void draw() noexcept;
 
@@ -121,6 +255,152 @@ class Device
      **/
     void resizeRequired() noexcept;
 
+    /**
+     * Gets the value of the last frame submitted by draw(). Frames are
+     * numbered from 1, so this is 0 before the first draw().
+     * @returns the frame value.
+     **/
+    uint64_t frameValue() const noexcept { return m_frameValue; };
+    /**
+     * Gets the time taken to record the command buffers of the last frame
+     * drawn with RecordMode::PER_FRAME, across all recording threads.
+     * @returns the time in milliseconds, or 0 if no frame has been recorded
+     *  by draw().
+     **/
+    float recordTime() const noexcept { return m_recordTime; };
+    /**
+     * Checks whether the GPU has finished a frame, without waiting.
+     * @param[in] value a frame value, from frameValue().
+     * @returns true if the frame, and every frame before it, has finished.
+     **/
+    bool frameComplete(uint64_t value) noexcept;
+    /**
+     * Waits until the GPU has finished a frame.
+     * @param[in] value a frame value, from frameValue().
+     **/
+    void waitForFrame(uint64_t value) noexcept;
+    /**
+     * Waits until the GPU has finished every frame and upload submitted so
+     * far. draw() does not wait for the frames it submits, so call this
+     * before destroying Buffers, Pipelines or other objects that the last
+     * frames may still be using.
+     **/
+    void wait() noexcept;
+    /**
+     * Copies the pixels of a frame drawn by a headless Device to the host,
+     * waiting for the frame to finish.
+     * @param[in] value a frame value, from frameValue().
+     * @param[out] pixels width*height rows of 4-byte B8G8R8A8_SRGB pixels,
+     *  tightly packed.
+     * @returns false if the Device is not headless, or the frame's image has
+     *  since been drawn over.
+     **/
+    bool readFrame(uint64_t value, void *pixels) noexcept;
+    /**
+     * Copies the FRAMEBUFFER Attachment of every frame into a ring of
+     * persistently mapped buffers, one for each frame in flight. The copy is
+     * submitted with the frame, and the callback is called once the frame's
+     * fence has been waited on: when its frame in flight is reused by draw()
+     * or a DynamicBuffer update, or by waitForFrame(). Drawing never waits
+     * for the host to read the pixels, other than through the callback
+     * itself, which must not call back into the Device. Must be called after
+     * the surface is created. An empty callback stops readback.
+     * @param[in] callback the function that receives each frame.
+     **/
+    void setReadback(const ReadbackFunc &callback) noexcept;
+
+    /**
+     * Sets the number of frames the host may record and submit before it
+     * waits on the GPU. This is independent of the swapchain size. A value of
+     * 1 serialises the host and the GPU; higher values let the host run
+     * further ahead at the cost of latency. The default is 2.
+     * @param[in] maxFramesInFlight the maximum number of frames in flight.
+     **/
+    void setMaxFramesInFlight(uint32_t maxFramesInFlight) noexcept;
+
+    /**
+     * Sets how command buffers are recorded. The default is STATIC.
+     * @param[in] recordMode the record mode.
+     **/
+    void setRecordMode(RecordMode recordMode) noexcept;
+
+    /**
+     * Sets the draw items recorded in every subpass. Without draw items, the
+     * whole index buffer is drawn as a single item, which is split across the
+     * recording threads. Each thread's items are batched into one
+     * vkCmdDrawIndexedIndirect when the device supports multiDrawIndirect,
+     * and drawIndirectFirstInstance if an item has a firstInstance.
+     * @param[in] drawItems the ranges of the index buffer to draw.
+     **/
+    void setDrawItems(const std::vector<DrawItem> &drawItems) noexcept;
+
+    /**
+     * Registers a sub-mesh inside the shared index and vertex buffers.
+     * @param[in] firstIndex the first index of the mesh in the index buffer.
+     * @param[in] numIndices the number of indices in the mesh.
+     * @param[in] vertexOffset the offset added to each index of the mesh.
+     * @returns the position of the mesh in the draw items.
+     **/
+    size_t addMesh(
+        uint32_t firstIndex,
+        uint32_t numIndices,
+        int32_t vertexOffset
+    ) noexcept;
+
+    /**
+     * Culls draw items on the GPU. Before the render pass, a compute shader
+     * reads each item's bounding sphere and the camera, and writes the
+     * item's VkDrawIndexedIndirectCommand, which the recorded command buffers
+     * draw with vkCmdDrawIndexedIndirect. The shader is run with 64 threads
+     * per workgroup and must use the following interface:
+     *   set 0, binding 0: the camera, as a uniform buffer.
+     *   set 0, binding 1: the bounding spheres, as vec4(center, radius).
+     *   set 0, binding 2: the draw commands, one per sphere, read-only.
+     *   set 0, binding 3: the culled draw commands. The shader copies each
+     *    command, setting instanceCount to 0 to cull it.
+     *   push constant: the number of draw commands, as a uint.
+     * All of a draw item's instances are culled together. Items with a
+     * firstInstance need a device with drawIndirectFirstInstance.
+     * Must be called before finalize().
+     * @param[in] computeShader the COMPUTE Shader which culls the draws.
+     * @param[in] camera the camera read by the shader, such as its frustum.
+     * @param[in] boundingSpheres one bounding sphere for each draw item.
+     **/
+    void setCulling(
+        const Shader &computeShader,
+        const DynamicBuffer &camera,
+        const std::vector<BoundingSphere> &boundingSpheres
+    ) noexcept;
+
+    /**
+     * Gets the usage of the device memory held for buffers, textures and
+     * attachments, which are sub-allocated from large blocks.
+     * @returns the current memory usage and fragmentation.
+     **/
+    internal::MemoryStats memoryStats() const noexcept;
+
+    /**
+     * Submits the uploads recorded by StaticBuffers and Textures since the
+     * last submission. Uploads are recorded into batches, which are also
+     * submitted once they hold enough data, and run on a transfer queue
+     * when the device has one, so the host can keep loading assets while
+     * earlier ones are copied.
+     * @returns the upload value, which completes once every upload recorded
+     *  so far has finished.
+     **/
+    uint64_t flushUploads() noexcept;
+    /**
+     * Checks whether uploads have finished, without waiting.
+     * @param[in] value an upload value, such as StaticBuffer::uploadValue().
+     * @returns true if every upload up to value has finished.
+     **/
+    bool uploadComplete(uint64_t value) const noexcept;
+    /**
+     * Submits and waits for uploads.
+     * @param[in] value an upload value, such as StaticBuffer::uploadValue().
+     **/
+    void waitForUploads(uint64_t value) noexcept;
+
     VkInstance instance() const noexcept { return m_device->m_instance; }
     VkSurfaceKHR& surface() const noexcept { return m_device->m_surface; }
 
@@ -137,33 +417,93 @@ class Device
         return m_device->m_graphicsQueue;
     };
     VkQueue presentQueue() const noexcept { return m_device->m_presentQueue; };
+    VkPipelineCache pipelineCache() const noexcept
+    {
+        return m_pipelineCache->m_cache;
+    };
     uint32_t numThreads() const noexcept { return m_numThreads; };
-    std::vector<std::unique_ptr<Thread>>& threads() noexcept
+    ThreadPool& threadPool() noexcept { return m_threadPool; };
+    // The queue families that share uploaded resources, or none if uploads
+    // run on the graphics queue.
+    std::vector<uint32_t> uploadQueueFamilies() const noexcept
     {
-        return m_threadPool.threads;
+        if (m_device->m_transferFamily==m_device->m_graphicsFamily) return {};
+        return {m_device->m_graphicsFamily, m_device->m_transferFamily};
     };
 
+    bool acquire() noexcept;
     void finishSetup(
         std::function<void()> windowFunc,
         const std::vector<const char*> &windowExtensions
     ) noexcept;
+    static std::vector<uint32_t> drawItemIndices(
+        const std::vector<DrawItem> &drawItems,
+        const std::vector<std::vector<DrawItem>> &parts
+    ) noexcept;
+    void partition() noexcept;
+    static std::vector<std::vector<DrawItem>> partitionDrawItems(
+        const std::vector<DrawItem> &drawItems,
+        size_t numParts
+    ) noexcept;
     void record() noexcept;
+    void recordFrame(size_t frame, uint32_t imageIndex) noexcept;
+    void recordCommandBuffers(
+        VkCommandBuffer primaryCommandBuffer,
+        const std::vector<VkCommandBuffer> &secondaryCommandBuffers,
+        uint32_t imageIndex,
+        VkCommandBufferUsageFlags usage
+    ) noexcept;
+    // Copies the latest region of each ring Buffer into the regions read by
+    // an image, once the image has been acquired.
+    void refreshRegions(uint32_t imageIndex) noexcept;
+    // Forgets the stale regions of a ring Buffer that is being destroyed.
+    void releaseRegions(VkBuffer buffer) noexcept;
     void reset() noexcept;
     void resizeWindow() noexcept;
-    void wait() noexcept { m_threadPool.wait(); };
+    // Waits for a frame while m_drawMutex is held.
+    void waitFrame(uint64_t value) noexcept;
+    /**
+     * Writes data to the region of a ring Buffer that the next draw() reads.
+     * This acquires the swapchain image of that draw, if it has not been
+     * acquired yet, and waits until the GPU has finished with the region.
+     * The Buffer's other regions are marked stale and refreshed from this
+     * one as their images are acquired. If there is no swapchain, or it had
+     * to be recreated, the device is idle and every region is written.
+     * @param[in] buffer the ring Buffer.
+     * @param[in] regions the Buffer's mapped memory.
+     * @param[in] numRegions the number of regions.
+     * @param[in] stride the distance between regions in bytes.
+     * @param[in] size the number of bytes to write.
+     * @param[in] data the data to write.
+     **/
+    void writeRegions(
+        VkBuffer buffer,
+        unsigned char *regions,
+        uint32_t numRegions,
+        VkDeviceSize stride,
+        VkDeviceSize size,
+        const void *data
+    ) noexcept;
 
-    // Swapchain.
-    VkExtent2D extent() const noexcept { return m_swapchain->m_extent; };
+    // Swapchain, or the Offscreen images of a headless Device.
+    bool headless() const noexcept { return m_offscreen!=nullptr; };
+    VkExtent2D extent() const noexcept
+    {
+        if (headless()) return m_offscreen->m_extent;
+        return m_swapchain->m_extent;
+    };
     VkSwapchainKHR swapchain() const noexcept
     {
         return m_swapchain->m_swapchain;
     };
     uint32_t swapchainSize() const noexcept
     {
+        if (headless()) return m_offscreen->m_images.size();
         return m_swapchain->m_images.size();
     };
     std::vector<VkImageView> swapchainImageViews() const noexcept
     {
+        if (headless()) return m_offscreen->m_imageViews;
         return m_swapchain->m_imageViews;
     };
 
@@ -176,12 +516,32 @@ class Device
     {
         return m_commands->m_primaryCommandBuffers;
     };
-    std::vector<VkCommandBuffer> secondaryCommandBuffers() const noexcept
+    std::vector<VkCommandBuffer>& secondaryCommandBuffers(
+        size_t imageIndex
+    ) const noexcept
     {
-        return m_commands->m_secondaryCommandBuffers;
+        return m_commands->m_secondaryCommandBuffers[imageIndex];
+    };
+    std::vector<VkCommandPool>& frameCommandPools(size_t frame) const noexcept
+    {
+        return m_commands->m_frameCommandPools[frame];
+    };
+    VkCommandBuffer framePrimaryCommandBuffer(size_t frame) const noexcept
+    {
+        return m_commands->m_framePrimaryCommandBuffers[frame];
+    };
+    std::vector<VkCommandBuffer>& frameSecondaryCommandBuffers(
+        size_t frame
+    ) const noexcept
+    {
+        return m_commands->m_frameSecondaryCommandBuffers[frame];
     };
 
     // Sync.
+    uint32_t maxFramesInFlight() const noexcept
+    {
+        return m_sync->m_fencesInFlight.size();
+    };
     std::vector<VkFence>& frameFences() const noexcept
     {
         return m_sync->m_fencesInFlight;
@@ -205,6 +565,10 @@ class Device
         return m_framebuffer->m_framebuffers;
     };
 
+    // Uploads.
+    class Uploader;
+    Uploader& uploader() const noexcept { return *m_uploader; };
+
     class _Device
     {
         public:
@@ -233,11 +597,19 @@ class Device
         VkFormat m_depthFormat;
         VkDevice m_device=VK_NULL_HANDLE;
         std::vector<const char *> m_deviceExtensions;
+        // Whether indirect draws may start at a non-zero instance.
+        bool m_drawIndirectFirstInstance=false;
+        uint32_t m_graphicsFamily=0;
         VkQueue m_graphicsQueue=VK_NULL_HANDLE;
         VkInstance m_instance=VK_NULL_HANDLE;
+        uint32_t m_maxDrawIndirectCount=1;
+        bool m_multiDrawIndirect=false;
         VkPhysicalDevice m_physicalDevice=VK_NULL_HANDLE;
         VkQueue m_presentQueue=VK_NULL_HANDLE;
         VkSurfaceKHR m_surface=VK_NULL_HANDLE;
+        // The queue used for uploads, which may be the graphics queue.
+        uint32_t m_transferFamily=0;
+        VkQueue m_transferQueue=VK_NULL_HANDLE;
         std::vector<const char*> m_validationLayers;
         std::vector<const char *> m_windowExtensions;
 
@@ -269,10 +641,6 @@ class Device
         void debugMessengerCreateInfo(
             VkDebugUtilsMessengerCreateInfoEXT& createInfo
         ) noexcept;
-        internal::QueueFamilyIndices getQueueFamilies(
-            VkPhysicalDevice device,
-            VkSurfaceKHR surface
-        ) noexcept;
     };
 
     class Swapchain
@@ -316,6 +684,8 @@ class Device
         VkFormat m_format;
         std::vector<VkImage> m_images;
         std::vector<VkImageView> m_imageViews;
+        // Images may also be copied from, if the surface allows it.
+        VkImageUsageFlags m_usage=0;
         VkSwapchainKHR m_swapchain=VK_NULL_HANDLE;
         uint32_t m_swapchainSize;
         VkSurfaceKHR m_surface = VK_NULL_HANDLE;
@@ -323,6 +693,83 @@ class Device
         VkExtent2D m_windowExtent;
     };
 
+    class Offscreen
+    {
+        public:
+        Offscreen()=default;
+        Offscreen(const Offscreen&)=delete; // Class Offscreen is non-copyable.
+        Offscreen& operator=(const Offscreen&)=delete; // Class Offscreen is non-copyable.
+        Offscreen(Offscreen&&) noexcept;
+        Offscreen& operator=(Offscreen&&) noexcept;
+        ~Offscreen() noexcept;
+
+        Offscreen(
+            const VkDevice &device,
+            const VkPhysicalDevice &physicalDevice,
+            VkExtent2D extent,
+            const uint32_t size
+        );
+
+        bool operator==(const Offscreen &other) const noexcept;
+        bool operator!=(const Offscreen &other) const noexcept;
+
+        // Takes the next image of the ring.
+        uint32_t acquire() noexcept;
+        void destroy() noexcept;
+        void recreate() noexcept;
+        void reset() noexcept;
+        void setup() noexcept;
+
+        VkDevice m_device=VK_NULL_HANDLE;
+        VkExtent2D m_extent={};
+        // The format of the FRAMEBUFFER Attachment.
+        VkFormat m_format=VK_FORMAT_B8G8R8A8_SRGB;
+        // The frame last drawn into each image, indexed by [image].
+        std::vector<uint64_t> m_frameValues;
+        std::vector<internal::Allocation> m_imageMemory;
+        std::vector<VkImage> m_images;
+        std::vector<VkImageView> m_imageViews;
+        uint32_t m_nextImage=0;
+        VkPhysicalDevice m_physicalDevice=VK_NULL_HANDLE;
+        uint32_t m_size=0;
+    };
+
+    class PipelineCache
+    {
+        public:
+        PipelineCache()=default;
+        PipelineCache(const PipelineCache&)=delete; // Class PipelineCache is non-copyable.
+        PipelineCache& operator=(const PipelineCache&)=delete; // Class PipelineCache is non-copyable.
+        PipelineCache(PipelineCache&&) noexcept;
+        PipelineCache& operator=(PipelineCache&&) noexcept;
+        ~PipelineCache() noexcept;
+
+        PipelineCache(
+            const VkDevice &device,
+            const VkPhysicalDevice &physicalDevice
+        );
+
+        bool operator==(const PipelineCache &other) const noexcept;
+        bool operator!=(const PipelineCache &other) const noexcept;
+
+        void create(const std::vector<char> &data) noexcept;
+        // Replaces the cache with the file's, keeping the current entries.
+        void load(const std::string &fileName) noexcept;
+        void reset() noexcept;
+        void save() const noexcept;
+        // Checks that cache data was written for the device and driver.
+        static bool validHeader(
+            const std::vector<char> &data,
+            const VkPhysicalDeviceProperties &properties
+        ) noexcept;
+
+        VkPipelineCache m_cache=VK_NULL_HANDLE;
+        VkDevice m_device=VK_NULL_HANDLE;
+        // The file the cache is saved to, if any.
+        std::string m_fileName;
+        VkPhysicalDevice m_physicalDevice=VK_NULL_HANDLE;
+    };
+
     class Commands
     {
         public:
@@ -344,12 +791,33 @@ class Device
         bool operator==(const Commands&) const noexcept;
         bool operator!=(const Commands&) const noexcept;
 
+        void allocateFrames(
+            uint32_t maxFramesInFlight,
+            size_t numSubpasses
+        ) noexcept;
+        void allocateSecondaries(size_t numSubpasses) noexcept;
+        void destroyFrames() noexcept;
+        void destroyIndirectCommands() noexcept;
+        void freeSecondaries() noexcept;
         void reset() noexcept;
+        void writeIndirectCommands(
+            const std::vector<VkDrawIndexedIndirectCommand> &commands
+        ) noexcept;
 
         std::vector<VkCommandPool> m_commandPools;
         VkDevice m_device=VK_NULL_HANDLE;
+        // Per-frame command pools, indexed by [frame][thread].
+        std::vector<std::vector<VkCommandPool>> m_frameCommandPools;
+        std::vector<VkCommandBuffer> m_framePrimaryCommandBuffers;
+        // Per-frame secondaries, indexed by [frame][subpass*numThreads+thread].
+        std::vector<std::vector<VkCommandBuffer>> m_frameSecondaryCommandBuffers;
+        VkBuffer m_indirectBuffer=VK_NULL_HANDLE;
+        internal::Allocation m_indirectBufferMemory;
+        VkPhysicalDevice m_physicalDevice=VK_NULL_HANDLE;
         std::vector<VkCommandBuffer> m_primaryCommandBuffers;
-        std::vector<VkCommandBuffer> m_secondaryCommandBuffers;
+        uint32_t m_queueFamilyIndex=0;
+        // Secondaries, indexed by [image][subpass*numThreads+thread].
+        std::vector<std::vector<VkCommandBuffer>> m_secondaryCommandBuffers;
     };
 
     class Sync
@@ -362,7 +830,11 @@ class Device
         Sync& operator=(Sync&&) noexcept;
         ~Sync() noexcept;
 
-        Sync(const VkDevice &device, const uint32_t &swapchainSize);
+        Sync(
+            const VkDevice &device,
+            const uint32_t &swapchainSize,
+            const uint32_t &maxFramesInFlight
+        );
 
         bool operator==(const Sync &other) const noexcept;
         bool operator!=(const Sync &other) const noexcept;
@@ -371,6 +843,8 @@ class Device
 
         VkDevice m_device=VK_NULL_HANDLE;
         std::vector<VkFence> m_fencesInFlight;
+        // The frame last submitted with each fence, indexed by [frame].
+        std::vector<uint64_t> m_frameValues;
         std::vector<VkSemaphore> m_imageAvailableSemaphores;
         std::vector<VkFence> m_imagesInFlight;
         std::vector<VkSemaphore> m_renderFinishedSemaphores;
@@ -403,20 +877,297 @@ class Device
         Renderpass *m_renderpass=nullptr;
         size_t m_swapchainSize;
     };
+
+    class Cull
+    {
+        public:
+        Cull()=default;
+        Cull(const Cull&)=delete; // Class Cull is non-copyable.
+        Cull& operator=(const Cull&)=delete; // Class Cull is non-copyable.
+        Cull(Cull&&) noexcept;
+        Cull& operator=(Cull&&) noexcept;
+        ~Cull() noexcept;
+
+        Cull(
+            const VkDevice &device,
+            const VkPhysicalDevice &physicalDevice,
+            const VkPipelineCache &pipelineCache,
+            const VkPipelineShaderStageCreateInfo &shaderStage,
+            const Buffer &camera,
+            const std::vector<BoundingSphere> &boundingSpheres
+        );
+
+        bool operator==(const Cull &other) const noexcept;
+        bool operator!=(const Cull &other) const noexcept;
+
+        void destroyBuffers() noexcept;
+        void record(
+            VkCommandBuffer commandBuffer,
+            uint32_t imageIndex
+        ) const noexcept;
+        void reset() noexcept;
+        void update(
+            const std::vector<uint32_t> &drawItemIndices,
+            VkBuffer indirectBuffer
+        ) noexcept;
+
+        VkBuffer m_boundingSphereBuffer=VK_NULL_HANDLE;
+        internal::Allocation m_boundingSphereBufferMemory;
+        std::vector<BoundingSphere> m_boundingSpheres;
+        const Buffer *m_camera=nullptr;
+        VkDescriptorPool m_descriptorPool=VK_NULL_HANDLE;
+        VkDescriptorSet m_descriptorSet=VK_NULL_HANDLE;
+        VkDescriptorSetLayout m_descriptorSetLayout=VK_NULL_HANDLE;
+        VkDevice m_device=VK_NULL_HANDLE;
+        VkBuffer m_drawCommandBuffer=VK_NULL_HANDLE;
+        internal::Allocation m_drawCommandBufferMemory;
+        VkPipelineLayout m_layout=VK_NULL_HANDLE;
+        uint32_t m_numDraws=0;
+        VkPhysicalDevice m_physicalDevice=VK_NULL_HANDLE;
+        VkPipeline m_pipeline=VK_NULL_HANDLE;
+    };
+
+    class Uploader
+    {
+        public:
+        // A range of a staging block that an upload copies from.
+        struct Staging
+        {
+            uint32_t block=0;
+            VkBuffer buffer=VK_NULL_HANDLE;
+            void *data=nullptr;
+            VkDeviceSize offset=0;
+            VkDeviceSize size=0;
+        };
+
+        Uploader()=default;
+        Uploader(const Uploader&)=delete; // Class Uploader is non-copyable.
+        Uploader& operator=(const Uploader&)=delete; // Class Uploader is non-copyable.
+        Uploader(Uploader&&) noexcept;
+        Uploader& operator=(Uploader&&) noexcept;
+        ~Uploader() noexcept;
+
+        Uploader(
+            const VkDevice &device,
+            const VkPhysicalDevice &physicalDevice,
+            const VkQueue &queue,
+            const uint32_t &queueFamilyIndex,
+            const uint32_t &graphicsFamily
+        );
+
+        bool operator==(const Uploader &other) const noexcept;
+        bool operator!=(const Uploader &other) const noexcept;
+
+        uint64_t completedValue() noexcept;
+        uint64_t flush() noexcept;
+        uint64_t record(
+            const std::function<void(VkCommandBuffer)> &commands,
+            const std::vector<Staging> &staging
+        ) noexcept;
+        /**
+         * Records the copies of pending updates, with barriers against the
+         * draws around them, into the frame's update command buffer. Uploads
+         * completed on a separate transfer family are made visible to the
+         * draws there too. The frame's previous submission must have
+         * finished.
+         * @param[in] frame the frame in flight.
+         * @returns the command buffer, or VK_NULL_HANDLE if nothing is pending.
+         **/
+        VkCommandBuffer recordUpdates(size_t frame) noexcept;
+        // Frees the staging of every recorded update. The device must be idle.
+        void releaseUpdates() noexcept;
+        void reset() noexcept;
+        Staging stage(VkDeviceSize size) noexcept;
+        void update(
+            VkBuffer buffer,
+            const std::vector<VkBufferCopy> &regions,
+            const Staging &staging
+        ) noexcept;
+        void wait(uint64_t value) noexcept;
+
+        // A set of uploads submitted together.
+        struct Batch
+        {
+            VkCommandBuffer commandBuffer=VK_NULL_HANDLE;
+            VkFence fence=VK_NULL_HANDLE;
+            std::vector<Staging> staging;
+            VkDeviceSize stagingSize=0;
+            uint64_t value=0;
+        };
+
+        // Copies into a buffer that is drawn from, made before the next frame.
+        struct Update
+        {
+            VkBuffer buffer=VK_NULL_HANDLE;
+            std::vector<VkBufferCopy> regions;
+        };
+
+        // A persistently mapped buffer that staging ranges are allocated
+        // from linearly. It is rewound once every range has been retired.
+        struct StagingBlock
+        {
+            VkBuffer buffer=VK_NULL_HANDLE;
+            VkDeviceSize head=0;
+            internal::Allocation memory;
+            uint32_t numPending=0;
+            VkDeviceSize size=0;
+        };
+
+        void beginBatch() noexcept;
+        uint32_t createBlock(VkDeviceSize size) noexcept;
+        void destroyBlocks() noexcept;
+        uint64_t flushLocked() noexcept;
+        void recycleBlock(uint32_t block) noexcept;
+        void release(Batch &batch) noexcept;
+        void releaseStaging(const std::vector<Staging> &staging) noexcept;
+        void retire(bool wait, uint64_t value) noexcept;
+
+        // Uploads up to this value are visible to the graphics queue.
+        uint64_t m_acquiredValue=0;
+        VkCommandPool m_commandPool=VK_NULL_HANDLE;
+        uint64_t m_completedValue=0;
+        // The block that stage() allocates from, or -1 before the first.
+        int32_t m_currentBlock=-1;
+        VkDevice m_device=VK_NULL_HANDLE;
+        // Rewound blocks that are not the current block.
+        std::vector<uint32_t> m_freeBlocks;
+        // Command buffers and fences of retired batches, for reuse.
+        std::vector<VkCommandBuffer> m_freeCommandBuffers;
+        std::vector<VkFence> m_freeFences;
+        // Staging of the updates recorded for each frame, indexed by [frame].
+        std::vector<std::vector<Staging>> m_frameUpdateStaging;
+        // Submitted batches, oldest first.
+        std::vector<Batch> m_inFlight;
+        std::mutex m_mutex;
+        // The batch being recorded, if its commandBuffer is not null.
+        Batch m_open;
+        // Updates waiting for the next frame, and their staging.
+        std::vector<Update> m_pendingUpdates;
+        std::vector<Staging> m_pendingUpdateStaging;
+        VkPhysicalDevice m_physicalDevice=VK_NULL_HANDLE;
+        VkQueue m_queue=VK_NULL_HANDLE;
+        // Whether uploads run on a queue family other than graphics.
+        bool m_separateFamily=false;
+        // Blocks destroyed after use leave an empty slot here.
+        std::vector<StagingBlock> m_stagingBlocks;
+        VkDeviceSize m_stagingAlignment=16;
+        uint64_t m_submittedValue=0;
+        // Update command buffers, indexed by [frame], from a graphics pool.
+        std::vector<VkCommandBuffer> m_updateCommandBuffers;
+        VkCommandPool m_updateCommandPool=VK_NULL_HANDLE;
+    };
+
+    class Readback
+    {
+        public:
+        Readback()=default;
+        Readback(const Readback&)=delete; // Class Readback is non-copyable.
+        Readback& operator=(const Readback&)=delete; // Class Readback is non-copyable.
+        Readback(Readback&&) noexcept;
+        Readback& operator=(Readback&&) noexcept;
+        ~Readback() noexcept;
+
+        Readback(
+            const VkDevice &device,
+            const VkPhysicalDevice &physicalDevice,
+            const uint32_t &graphicsFamily,
+            const uint32_t &maxFramesInFlight,
+            VkExtent2D extent,
+            const ReadbackFunc &callback
+        );
+
+        bool operator==(const Readback &other) const noexcept;
+        bool operator!=(const Readback &other) const noexcept;
+
+        // Calls back with the frame's pixels. Its fence must have signalled.
+        void deliver(size_t frame) noexcept;
+        // Calls back with every pending frame up to value, oldest first.
+        void deliverUpTo(uint64_t value) noexcept;
+        void destroy() noexcept;
+        // Delivers every pending frame. The device must be idle.
+        void recreate(uint32_t maxFramesInFlight, VkExtent2D extent) noexcept;
+        /**
+         * Records the copy of a frame's image into the frame's buffer.
+         * @param[in] frame the frame in flight.
+         * @param[in] image the image drawn by the frame.
+         * @param[in] layout the layout the render pass left the image in,
+         *  which it is returned to.
+         * @param[in] value the frame value.
+         * @returns the command buffer, to be submitted after the frame.
+         **/
+        VkCommandBuffer record(
+            size_t frame,
+            VkImage image,
+            VkImageLayout layout,
+            uint64_t value
+        ) noexcept;
+        void reset() noexcept;
+        void setup(uint32_t maxFramesInFlight, VkExtent2D extent) noexcept;
+
+        // Host-visible buffers, indexed by [frame].
+        std::vector<VkBuffer> m_buffers;
+        ReadbackFunc m_callback;
+        std::vector<VkCommandBuffer> m_commandBuffers;
+        VkCommandPool m_commandPool=VK_NULL_HANDLE;
+        VkDevice m_device=VK_NULL_HANDLE;
+        VkExtent2D m_extent={};
+        // The frame copied into each buffer and not yet delivered, or 0.
+        std::vector<uint64_t> m_frameValues;
+        std::vector<internal::Allocation> m_memory;
+        VkPhysicalDevice m_physicalDevice=VK_NULL_HANDLE;
+        VkDeviceSize m_size=0;
+    };
     
+    // The regions of a ring Buffer that have not seen its latest update.
+    struct StaleRegions
+    {
+        VkBuffer buffer=VK_NULL_HANDLE;
+        unsigned char *regions=nullptr;
+        VkDeviceSize stride=0;
+        VkDeviceSize size=0;
+        // The region written by the latest update.
+        uint32_t latest=0;
+        std::vector<bool> stale;
+    };
+
     std::unique_ptr<_Device> m_device=nullptr;
     std::unique_ptr<Commands> m_commands=nullptr;
+    std::unique_ptr<Cull> m_cull=nullptr;
+    size_t m_currentFrame=0;
+    std::vector<DrawItem> m_drawItems;
+    std::mutex m_drawMutex;
+    // Draw items for each recording thread, indexed by [thread].
+    std::vector<std::vector<DrawItem>> m_drawPartitions;
+    // The first indirect command of each recording thread's draw items.
+    std::vector<uint32_t> m_firstIndirectCommands;
     std::unique_ptr<Framebuffer> m_framebuffer=nullptr;
+    std::atomic<uint64_t> m_frameValue{0};
+    bool m_imageAcquired=false;
+    uint32_t m_imageIndex=0;
     Buffer *m_indexBuffer=nullptr;
+    Buffer *m_instanceBuffer=nullptr;
+    uint32_t m_maxFramesInFlight=2;
+    // The Buffers created from this Device that point back to it.
+    std::atomic<uint32_t> m_numBuffers{0};
     size_t m_numThreads=1;
+    std::unique_ptr<Offscreen> m_offscreen=nullptr;
+    std::unique_ptr<PipelineCache> m_pipelineCache=nullptr;
     std::vector<Pipeline*> m_pipelines;
-    bool m_resizeRequired=false;
+    std::unique_ptr<Readback> m_readback=nullptr;
+    RecordMode m_recordMode=RecordMode::STATIC;
+    // Milliseconds spent recording the last per-frame command buffers.
+    std::atomic<float> m_recordTime{0.0f};
+    std::atomic<bool> m_resizeRequired{false};
+    // Ring Buffers whose regions are behind their latest update.
+    std::vector<StaleRegions> m_staleRegions;
     std::unique_ptr<Swapchain> m_swapchain=nullptr;
     uint32_t m_swapchainSize=1;
     std::unique_ptr<Sync> m_sync=nullptr;
     ThreadPool m_threadPool;
+    std::unique_ptr<Uploader> m_uploader=nullptr;
     VkExtent2D m_windowExtent;
-    Buffer *m_vertexBuffer=nullptr;
+    // The vertex buffer of each stream.
+    std::vector<Buffer*> m_vertexStreams;
 
     friend class Attachment;
     friend class Buffer;
@@ -429,15 +1180,33 @@ class Device
     friend class Texture;
 
     // Tests.
+    FRIEND_TEST(AllocatorTest,allocate);
+    FRIEND_TEST(BufferTest,ctor);
     FRIEND_TEST(CommandTest,ctor);
+    FRIEND_TEST(CommandTest,frames);
+    FRIEND_TEST(CommandTest,indirectCommands);
     FRIEND_TEST(CommandTest,move);
+    FRIEND_TEST(DeviceTest,concurrent);
     FRIEND_TEST(DeviceTest,ctor);
+    FRIEND_TEST(DeviceTest,cull);
+    FRIEND_TEST(DeviceTest,draw);
+    FRIEND_TEST(DeviceTest,drawItemIndices);
+    FRIEND_TEST(DeviceTest,headless);
+    FRIEND_TEST(DeviceTest,partitionDrawItems);
+    FRIEND_TEST(DeviceTest,pipelineCache);
+    FRIEND_TEST(DeviceTest,readback);
+    FRIEND_TEST(DeviceTest,regions);
     FRIEND_TEST(FramebufferTest,ctor);
     FRIEND_TEST(PassTest,ctor);
     FRIEND_TEST(SwapchainTest,ctor);
     FRIEND_TEST(SwapchainTest,move);
     FRIEND_TEST(SyncTest,ctor);
+    FRIEND_TEST(SyncTest,maxFramesInFlight);
     FRIEND_TEST(SyncTest,move);
+    FRIEND_TEST(UploaderTest,batch);
+    FRIEND_TEST(UploaderTest,move);
+    FRIEND_TEST(UploaderTest,staging);
+    FRIEND_TEST(UploaderTest,updates);
     FRIEND_TEST(UtilTest,createImage);
     FRIEND_TEST(UtilTest,createImageView);
     FRIEND_TEST(UtilTest,createBuffer);
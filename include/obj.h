@@ -8,7 +8,9 @@
 namespace evk {
 
 /**
- * Loads and OBJ file into a vector of vertices and indices.
+ * Loads and OBJ file into a vector of vertices and indices. An index
+ * StaticBuffer created from the indices stores them as 16-bit indices when the
+ * OBJ has at most 65536 vertices.
  * @param[in] fileName the file where the OBJ is contained.
  * @param[out] vertices the vertices of the OBJ.
  * @param[out] indices the indices of the OBJ.
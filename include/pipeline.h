@@ -25,6 +25,10 @@ namespace evk {
  * 
  * The Pipeline is then passed into the finalize method of the Device.
  * 
+ * Compiling a Pipeline is slow, so Pipelines can instead be created with
+ * Build::DEFERRED and compiled together, in parallel, by
+ * Device::buildPipelines() or finalize().
+ * 
  * @example
  * Pipeline pipeline0(
  *  device, &subpass0, &descriptor0, vertexInput0, &renderpass, shaders0
@@ -45,6 +49,13 @@ class Pipeline
     Pipeline& operator=(Pipeline&&) noexcept;
     ~Pipeline() noexcept;
 
+    /**
+     * When the Pipeline is compiled.
+     * NOW compiles it in the constructor, on the calling thread.
+     * DEFERRED leaves it to Device::buildPipelines() or finalize().
+     **/
+    enum class Build {NOW, DEFERRED};
+
     /**
      * Creates a Pipeline with an attached descriptor.
      * @param[in] device the Device used to create the Pipeline.
@@ -53,6 +64,7 @@ class Pipeline
      * @param[in] vertexInput the vertexInput for this Pipeline.
      * @param[in] renderpass the Renderpass for this Pipeline.
      * @param[in] shaders the set of Shaders used in this Pipeline.
+     * @param[in] build when the Pipeline is compiled.
      **/
     Pipeline(
         Device &device,
@@ -60,7 +72,8 @@ class Pipeline
         Descriptor &descriptor,
         const VertexInput &vertexInput,
         Renderpass &renderpass,
-        const std::vector<Shader*> &shaders
+        const std::vector<Shader*> &shaders,
+        Build build=Build::NOW
     ) noexcept;
 
     /**
@@ -70,13 +83,15 @@ class Pipeline
      * @param[in] vertexInput the vertexInput for this Pipeline.
      * @param[in] renderpass the Renderpass for this Pipeline.
      * @param[in] shaders the set of Shaders used in this Pipeline.
+     * @param[in] build when the Pipeline is compiled.
      **/
     Pipeline(
         Device &device,
         Subpass &subpass,
         const VertexInput &vertexInput,
         Renderpass &renderpass,
-        const std::vector<Shader*> &shaders
+        const std::vector<Shader*> &shaders,
+        Build build=Build::NOW
     ) noexcept;
 
     bool operator==(const Pipeline&) const noexcept;
@@ -88,6 +103,8 @@ class Pipeline
     VkPipeline pipeline() const noexcept { return m_pipeline; };
     Renderpass* const renderpass() const noexcept { return m_renderpass; };
 
+    // Asserts that the device can read each vertex attribute's format.
+    void checkVertexFormats() const noexcept;
     void createSetLayout(
         const std::vector<VkDescriptorSetLayout> &setLayouts
     ) noexcept;
@@ -107,7 +124,9 @@ class Pipeline
     friend class Device;
 
     // Tests.
+    FRIEND_TEST(DeviceTest,headless);
     FRIEND_TEST(PipelineTest,ctor);
+    FRIEND_TEST(PipelineTest,deferred);
 };
 
 } // end namespace evk
@@ -17,7 +17,8 @@ namespace evk {
  * filenames.
  * 
  * One of both the VERTEX and FRAGMENT shader must be provided to a Pipeline,
- * where it is bound and executed.
+ * where it is bound and executed. A COMPUTE shader may be given to
+ * Device::setCulling() to cull draws on the GPU.
  * 
  * @example
  * Shader vertexShader(device, "shader_vert.spv", Shader::Stage::VERTEX);
@@ -35,8 +36,9 @@ class Shader
      * The stage at which the Shader runs.
      * VERTEX: A vertex Shader.
      * FRAGMENT: A fragments Shader.
+     * COMPUTE: A compute Shader, used for culling draws on the GPU.
      **/
-    enum class Stage{VERTEX,FRAGMENT};
+    enum class Stage{VERTEX,FRAGMENT,COMPUTE};
 
     Shader()=default;
     Shader(const Shader&)=delete; // Class Shader is non-copyable.
@@ -76,6 +78,7 @@ class Shader
     VkShaderModule m_module=VK_NULL_HANDLE;
 
     friend class Descriptor;
+    friend class Device;
     friend class Pipeline;
 
     // Tests.
@@ -43,22 +43,29 @@ class Texture
     bool operator==(const Texture&) const noexcept;
     bool operator!=(const Texture&) const noexcept;
 
+    /**
+     * Gets the upload value of the Texture's image. The image is copied to
+     * the device asynchronously, and is there once Device::uploadComplete()
+     * returns true for this value. Device::finalize() waits for it.
+     * @returns the upload value.
+     **/
+    uint64_t uploadValue() const noexcept { return m_uploadValue; };
+
     private:
     enum class Transition {INITIAL,SHADER};
 
-    void copyBufferToImage(
-        const Device &device,
-        VkCommandPool commandPool,
+    static void copyBufferToImage(
+        VkCommandBuffer commandBuffer,
         VkBuffer buffer,
+        VkDeviceSize bufferOffset,
         VkImage image,
         VkExtent2D extent
     ) noexcept;
-    void transitionImageLayout(
-        const Device &device,
-        VkCommandPool commandPool,
+    static void transitionImageLayout(
+        VkCommandBuffer commandBuffer,
         VkImage image,
-        VkFormat format,
-        Transition transition
+        Transition transition,
+        bool graphicsQueue
     ) noexcept;
     void reset() noexcept;
 
@@ -69,7 +76,8 @@ class Texture
     VkImage m_image=VK_NULL_HANDLE;
     VkSampler m_imageSampler=VK_NULL_HANDLE;
     VkImageView m_imageView=VK_NULL_HANDLE;
-    VkDeviceMemory m_memory=VK_NULL_HANDLE;
+    internal::Allocation m_memory;
+    uint64_t m_uploadValue=0;
 
     friend class Descriptor;
 
@@ -1,7 +1,8 @@
 /// @brief ThreadPool
 /// Modified from :-
-/// Sascha Willems (2017). Basic C++11 based thread pool with per-thread job queues [online]. [Accessed 2020]. 
+/// Sascha Willems (2017). Basic C++11 based thread pool with per-thread job queues [online]. [Accessed 2020].
 /// Available from: "https://github.com/SaschaWillems/Vulkan".
+/// Extended with per-worker job rings, work stealing and counter-based waits.
 
 /*
 * Basic C++11 based thread pool with per-thread job queues
@@ -14,12 +15,13 @@
 #ifndef THREADPOOL
 #define THREADPOOL
 
+#include <atomic>
 #include <vector>
 #include <thread>
-#include <queue>
 #include <mutex>
 #include <condition_variable>
-#include <functional>
+#include <cstring>
+#include <type_traits>
 
 // make_unique is not available in C++11
 // Taken from Herb Sutter's blog (https://herbsutter.com/gotw/_102/)
@@ -29,99 +31,375 @@ std::unique_ptr<T> make_unique(Args&& ...args)
 	return std::unique_ptr<T>(new T(std::forward<Args>(args)...));
 }
 
-class Thread
+// Counts the unfinished jobs of a batch. ThreadPool::wait(counter) returns
+// once every job added against the counter has run.
+class JobCounter
 {
+public:
+	uint32_t count() const
+	{
+		return remaining.load();
+	}
+
 private:
-	bool destroying = false;
-	std::thread worker;
-	std::queue<std::function<void()>> jobQueue;
-	std::mutex queueMutex;
-	std::condition_variable condition;
+	std::atomic<uint32_t> remaining{0};
+
+	friend class ThreadPool;
+};
 
-	// Loop through all remaining jobs
-	void queueLoop()
+// A fixed-size job. The callable is stored inline, so creating, queueing and
+// running a job never allocates. Callables must be trivially copyable and fit
+// in STORAGE_SIZE bytes; capture large state by reference.
+class Job
+{
+public:
+	static const size_t STORAGE_SIZE = 40;
+
+	Job() = default;
+
+	template<typename F>
+	Job(const F &function, uint32_t index, JobCounter *counter)
 	{
+		static_assert(sizeof(F) <= STORAGE_SIZE, "job is too large to store inline");
+		static_assert(alignof(F) <= alignof(void*), "job is over-aligned");
+		static_assert(std::is_trivially_copyable<F>::value, "job must be trivially copyable");
+		std::memcpy(storage, &function, sizeof(F));
+		invoke = [](const void *f, uint32_t i) { (*static_cast<const F*>(f))(i); };
+		this->index = index;
+		this->counter = counter;
+	}
+
+	void operator()() const
+	{
+		invoke(storage, index);
+	}
+
+private:
+	alignas(void*) unsigned char storage[STORAGE_SIZE];
+	void (*invoke)(const void*, uint32_t) = nullptr;
+	uint32_t index = 0;
+	JobCounter *counter = nullptr;
+
+	friend class ThreadPool;
+};
+
+// A bounded multi-producer, multi-consumer ring of job slots. Each push and
+// pop is a single compare-and-swap on the ring's head or tail; a slot's
+// sequence number hands the job from producer to consumer.
+class JobRing
+{
+public:
+	static const uint32_t CAPACITY = 1024;
+
+	JobRing()
+	{
+		for (uint32_t i = 0; i < CAPACITY; i++) slots[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	bool push(const Job &job)
+	{
+		uint32_t pos = tail.load(std::memory_order_relaxed);
 		while (true)
 		{
-			std::function<void()> job;
+			Slot &slot = slots[pos % CAPACITY];
+			const uint32_t sequence = slot.sequence.load(std::memory_order_acquire);
+			const int32_t diff = static_cast<int32_t>(sequence - pos);
+			if (diff == 0)
 			{
-				std::unique_lock<std::mutex> lock(queueMutex);
-				condition.wait(lock, [this] { return !jobQueue.empty() || destroying; });
-				if (destroying)
+				if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
 				{
-					break;
+					slot.job = job;
+					slot.sequence.store(pos + 1, std::memory_order_release);
+					return true;
 				}
-				job = jobQueue.front();
 			}
+			else if (diff < 0)
+			{
+				return false; // Full.
+			}
+			else
+			{
+				pos = tail.load(std::memory_order_relaxed);
+			}
+		}
+	}
 
-			job();
-
+	bool pop(Job &job)
+	{
+		uint32_t pos = head.load(std::memory_order_relaxed);
+		while (true)
+		{
+			Slot &slot = slots[pos % CAPACITY];
+			const uint32_t sequence = slot.sequence.load(std::memory_order_acquire);
+			const int32_t diff = static_cast<int32_t>(sequence - (pos + 1));
+			if (diff == 0)
+			{
+				if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					job = slot.job;
+					slot.sequence.store(pos + CAPACITY, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0)
+			{
+				return false; // Empty.
+			}
+			else
 			{
-				std::lock_guard<std::mutex> lock(queueMutex);
-				jobQueue.pop();
-				condition.notify_one();
+				pos = head.load(std::memory_order_relaxed);
 			}
 		}
 	}
 
+private:
+	struct Slot
+	{
+		std::atomic<uint32_t> sequence;
+		Job job;
+	};
+
+	// Head and tail are padded onto their own cache lines. Padding is used
+	// rather than alignas, since C++14 new ignores extended alignment.
+	static const size_t CACHE_LINE_SIZE = 64;
+
+	Slot slots[CAPACITY];
+	char headPadding[CACHE_LINE_SIZE];
+	std::atomic<uint32_t> head{0};
+	char tailPadding[CACHE_LINE_SIZE - sizeof(std::atomic<uint32_t>)];
+	std::atomic<uint32_t> tail{0};
+};
+
+// A worker owns a ring of jobs. It takes jobs from its own ring and, when
+// that is empty, steals from the other workers' rings.
+class Thread
+{
+private:
+	std::thread worker;
+	JobRing jobQueue;
+
+	friend class ThreadPool;
+};
+
+class ThreadPool
+{
 public:
-	Thread()
+	ThreadPool()
+	{
+		shared = make_unique<Shared>();
+	}
+
+	ThreadPool(ThreadPool&&) = default;
+	ThreadPool& operator=(ThreadPool &&other)
 	{
-		worker = std::thread(&Thread::queueLoop, this);
+		if (this == &other) return *this;
+		setThreadCount(0);
+		shared = std::move(other.shared);
+		other.shared = make_unique<Shared>();
+		return *this;
 	}
 
-	~Thread()
+	~ThreadPool()
 	{
-		if (worker.joinable())
+		if (shared) setThreadCount(0);
+	}
+
+	// Sets the number of threads to be allocted in this pool
+	void setThreadCount(uint32_t count)
+	{
+		wait();
+		{
+			std::lock_guard<std::mutex> lock(shared->mutex);
+			shared->destroying = true;
+			shared->condition.notify_all();
+		}
+		for (auto &thread : shared->threads) thread->worker.join();
+		shared->threads.clear();
+		shared->destroying = false;
+
+		for (uint32_t i = 0; i < count; i++)
 		{
-			wait();
-			queueMutex.lock();
-			destroying = true;
-			condition.notify_one();
-			queueMutex.unlock();
-			worker.join();
+			shared->threads.push_back(make_unique<Thread>());
+		}
+		for (uint32_t i = 0; i < count; i++)
+		{
+			shared->threads[i]->worker =
+				std::thread(&ThreadPool::workerLoop, shared.get(), i);
 		}
 	}
 
-	// Add a new job to the thread's queue
-	void addJob(std::function<void()> function)
+	uint32_t threadCount() const
 	{
-		std::lock_guard<std::mutex> lock(queueMutex);
-		jobQueue.push(std::move(function));
-		condition.notify_one();
+		return shared->threads.size();
 	}
 
-	// Wait until all work items have been finished
-	void wait()
+	// Add a single job, which is called with index 0. The callable is copied
+	// into the job.
+	template<typename F>
+	void addJob(const F &function, JobCounter &counter)
 	{
-		std::unique_lock<std::mutex> lock(queueMutex);
-		condition.wait(lock, [this]() { return jobQueue.empty(); });
+		auto call = [function](uint32_t) { function(); };
+		counter.remaining++;
+		shared->running++;
+		submit(Job(call, 0, &counter));
+		wake(1);
 	}
-};
 
-class ThreadPool
-{
-public:
-	std::vector<std::unique_ptr<Thread>> threads;
+	// Add function(i) for every i in [begin, end) as one batch. The jobs
+	// refer to the function, which must outlive the batch. They are dealt
+	// round-robin to the workers' rings, and idle workers steal them.
+	template<typename F>
+	void addJobs(uint32_t begin, uint32_t end, const F &function, JobCounter &counter)
+	{
+		if (begin >= end) return;
+		const F *f = &function;
+		auto call = [f](uint32_t i) { (*f)(i); };
+		counter.remaining += end - begin;
+		shared->running += end - begin;
+		for (uint32_t i = begin; i < end; i++) submit(Job(call, i, &counter));
+		wake(end - begin);
+	}
 
-	// Sets the number of threads to be allocted in this pool
-	void setThreadCount(uint32_t count)
+	// Wait until every job added against the counter has finished. The
+	// calling thread runs queued jobs while it waits.
+	void wait(JobCounter &counter)
 	{
-		threads.clear();
-		for (auto i = 0; i < count; i++)
+		Job job;
+		while (counter.count() > 0 && takeJob(*shared, 0, job))
+		{
+			runJob(*shared, job);
+		}
+		if (counter.count() == 0) return;
+
+		shared->waiting++;
 		{
-			threads.push_back(make_unique<Thread>());
+			std::unique_lock<std::mutex> lock(shared->mutex);
+			shared->finished.wait(lock, [&counter]() { return counter.count() == 0; });
 		}
+		shared->waiting--;
 	}
 
 	// Wait until all threads have finished their work items
 	void wait()
 	{
-		for (auto &thread : threads)
+		if (shared->running == 0) return;
+		shared->waiting++;
+		{
+			std::unique_lock<std::mutex> lock(shared->mutex);
+			shared->finished.wait(lock, [this]() { return shared->running == 0; });
+		}
+		shared->waiting--;
+	}
+
+	// Run function(i) for every i in [0, count) and return once all are done.
+	template<typename F>
+	void parallelFor(uint32_t count, const F &function)
+	{
+		JobCounter counter;
+		addJobs(0, count, function, counter);
+		wait(counter);
+	}
+
+private:
+	// State shared with the workers. It lives on the heap so that moving the
+	// pool does not invalidate the workers' pointer to it.
+	struct Shared
+	{
+		std::vector<std::unique_ptr<Thread>> threads;
+		std::mutex mutex;
+		std::condition_variable condition;
+		std::condition_variable finished;
+		// Jobs that are queued but not yet taken.
+		std::atomic<uint32_t> pending{0};
+		// Jobs that are queued or running.
+		std::atomic<uint32_t> running{0};
+		// Threads blocked on the condition variables. Jobs and completions
+		// only take the mutex to wake them.
+		std::atomic<uint32_t> sleeping{0};
+		std::atomic<uint32_t> waiting{0};
+		std::atomic<uint32_t> nextThread{0};
+		bool destroying = false;
+	};
+
+	std::unique_ptr<Shared> shared;
+
+	void submit(const Job &job)
+	{
+		auto &threads = shared->threads;
+		const uint32_t numThreads = threads.size();
+		shared->pending++;
+		for (uint32_t n = 0; n < numThreads; n++)
+		{
+			const uint32_t t = shared->nextThread++ % numThreads;
+			if (threads[t]->jobQueue.push(job)) return;
+		}
+		// Without workers, or with every ring full, run it here.
+		shared->pending--;
+		runJob(*shared, job);
+	}
+
+	void wake(uint32_t count)
+	{
+		if (shared->sleeping == 0) return;
+		std::lock_guard<std::mutex> lock(shared->mutex);
+		if (count == 1) shared->condition.notify_one();
+		else shared->condition.notify_all();
+	}
+
+	// Take a job from the given worker's ring, or steal one from another.
+	static bool takeJob(Shared &shared, uint32_t index, Job &job)
+	{
+		auto &threads = shared.threads;
+		const uint32_t numThreads = threads.size();
+		for (uint32_t n = 0; n < numThreads; n++)
 		{
-			thread->wait();
+			if (threads[(index + n) % numThreads]->jobQueue.pop(job))
+			{
+				shared.pending--;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static void runJob(Shared &shared, const Job &job)
+	{
+		job();
+		const bool batchDone = --job.counter->remaining == 0;
+		const bool allDone = --shared.running == 0;
+		if ((batchDone || allDone) && shared.waiting > 0)
+		{
+			std::lock_guard<std::mutex> lock(shared.mutex);
+			shared.finished.notify_all();
+		}
+	}
+
+	static void workerLoop(Shared *shared, uint32_t index)
+	{
+		while (true)
+		{
+			Job job;
+			if (takeJob(*shared, index, job))
+			{
+				runJob(*shared, job);
+				continue;
+			}
+
+			shared->sleeping++;
+			bool exit;
+			{
+				std::unique_lock<std::mutex> lock(shared->mutex);
+				shared->condition.wait(lock, [shared]() { return shared->pending > 0 || shared->destroying; });
+				// destroying is written under the mutex, so it is read here too.
+				exit = shared->destroying && shared->pending == 0;
+			}
+			shared->sleeping--;
+			if (exit)
+			{
+				break;
+			}
 		}
 	}
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -1,6 +1,7 @@
 #ifndef EVK_UTIL_H_
 #define EVK_UTIL_H_
 
+#include "allocator.h"
 #include <cassert>
 #include <fstream>
 #include <iostream>
@@ -17,7 +18,7 @@ namespace internal
 {
 
 /**
- * Creates a VkImage and binds it to VkDeviceMemory.
+ * Creates a VkImage and binds it to memory from the device's Allocator.
  * @param[in] device the VkDevice to use for image creation.
  * @param[in] physicalDevice the VkPhysicalDevice to use for image creation.
  * @param[in] extent the width and height of the image.
@@ -27,7 +28,9 @@ namespace internal
  * @param[in] properties where in memory the image should be allocated.
  * @param[out] pImage a pointer to the allocated image.
  * @param[out] pImageMemory a pointer to the allocated memory, to which the
- *  image is bound.
+ *  image is bound. Free it with freeMemory().
+ * @param[in] queueFamilies the queue families that share the image, if more
+ *  than one uses it.
  **/
 void createImage(
     const VkDevice &device,
@@ -38,7 +41,8 @@ void createImage(
     const VkImageUsageFlags &usage,
     const VkMemoryPropertyFlags &properties,
     VkImage *pImage,
-    VkDeviceMemory *pImageMemory
+    Allocation *pImageMemory,
+    const std::vector<uint32_t> &queueFamilies={}
 ) noexcept;
 
 /**
@@ -65,6 +69,9 @@ struct QueueFamilyIndices
 {
     int graphicsFamily=-1;
     int presentFamily=-1;
+    // A family for copies that has no graphics support, or -1 if there is
+    // none. Such families are usually separate DMA engines.
+    int transferFamily=-1;
 
     bool isComplete() noexcept
     {
@@ -83,14 +90,18 @@ struct SwapChainSupportDetails
 };
 
 /**
- * Creates a VkBuffer and binds it to a VkBufferMemory.
+ * Creates a VkBuffer and binds it to memory from the device's Allocator.
  * @param[in] device the VkDevice to use for allocation.
  * @param[in] physicalDevice the VkPhysicalDevice to use for allocation.
  * @param[in] size the size of the buffer in bytes.
  * @param[in] usage how the buffer will be used.
  * @param[in] properties the desired properties of the VkDeviceMemory.
  * @param[out] pBuffer a pointer to the allocated VkBuffer.
- * @param[out] pBufferMemory a pointer to the allocated VkDeviceMemory.
+ * @param[out] pBufferMemory a pointer to the allocated memory, to which the
+ *  buffer is bound. Host-visible memory is already mapped at its data
+ *  pointer. Free it with freeMemory().
+ * @param[in] queueFamilies the queue families that share the buffer, if more
+ *  than one uses it.
  **/
 void createBuffer(
     VkDevice device,
@@ -99,9 +110,17 @@ void createBuffer(
     VkBufferUsageFlags usage,
     VkMemoryPropertyFlags properties,
     VkBuffer *pBuffer,
-    VkDeviceMemory *pBufferMemory
+    Allocation *pBufferMemory,
+    const std::vector<uint32_t> &queueFamilies={}
 ) noexcept;
 
+/**
+ * Frees memory from createBuffer() or createImage(), once the resource bound
+ * to it has been destroyed.
+ * @param[in] allocation the memory to free.
+ **/
+void freeMemory(const Allocation &allocation) noexcept;
+
 /**
  * Finds the index of a suitable memory type, matching desired properties.
  * @param[in] physicalDevice the VkPhysicalDevice to query.
@@ -142,9 +161,11 @@ void endSingleTimeCommands(
 ) noexcept;
 
 /**
- * Finds the VkQueue families which support a surface.
+ * Finds the VkQueue families which support a surface, and a transfer-only
+ * family if the device has one.
  * @param[in] device the VkPhysicalDevice used to search for queue families.
- * @param[in] surface the VkSurfaceKHR for which to query support.
+ * @param[in] surface the VkSurfaceKHR for which to query support, or
+ *  VK_NULL_HANDLE for a headless device, which has no present family.
  * @returns the indices of the queue families which support this surface.
  **/
 QueueFamilyIndices findQueueFamilies(
@@ -30,10 +30,66 @@ namespace evk {
  * layout(location = 0) in vec3 inPosition;
  * layout(location = 1) in vec3 inColor;
  * layout(location = 2) in vec2 inTexCoord;
+ * 
+ * Per-instance attributes are read from a second binding, which is filled by
+ * the instance Buffer passed to Device::finalize().
+ * 
+ * @example
+ * vertexInput.setInstanceStride(sizeof(glm::mat4));
+ * vertexInput.setInstanceAttributeMat4(3,0);
+ * 
+ * // Vertex shader
+ * layout(location = 3) in mat4 inModel;
+ * 
+ * Vertex data may be split into streams, each in its own Buffer, so that a
+ * pass which only needs positions, such as a depth pass, only fetches those.
+ * Stream 0 is the vertex binding above. The Buffers of all streams are
+ * passed to Device::finalize().
+ * 
+ * @example
+ * VertexInput depthInput(sizeof(glm::vec3)); // Positions in stream 0.
+ * depthInput.setVertexAttributeVec3(0,0);
+ * 
+ * VertexInput colorInput(sizeof(glm::vec3));
+ * colorInput.setVertexAttributeVec3(0,0);
+ * colorInput.setStreamStride(1,sizeof(Attributes)); // The rest in stream 1.
+ * colorInput.setStreamAttribute(1,1,offsetof(Attributes,normal),
+ *   VertexInput::Format::SNORM8_4);
+ * 
+ * Attributes may also be stored in packed Formats, which the vertex shader
+ * still reads as floats. A VertexLayout lays them out and packs Vertices.
+ * 
+ * @example
+ * vertexInput.setVertexAttribute(1,12,VertexInput::Format::SNORM8_4);
  **/
 class VertexInput
 {
     public:
+    /**
+     * The format of an attribute, which the shader reads as floats.
+     * VEC2, VEC3, VEC4: 32-bit floats.
+     * HALF2, HALF4: 16-bit floats.
+     * UNORM16_2: two 16-bit values in [0,1], such as texture coordinates.
+     * SNORM8_4, UNORM8_4: four 8-bit values in [-1,1] or [0,1], such as
+     * normals or colors.
+     * SNORM_10_10_10_2, UNORM_10_10_10_2: three 10-bit values and a 2-bit
+     * value in one 32-bit word, such as normals. Vertex buffer support for
+     * these is optional in Vulkan, though widespread, and a Pipeline asserts
+     * that the device has it.
+     **/
+    enum class Format{
+        VEC2,
+        VEC3,
+        VEC4,
+        HALF2,
+        HALF4,
+        UNORM16_2,
+        SNORM8_4,
+        UNORM8_4,
+        SNORM_10_10_10_2,
+        UNORM_10_10_10_2
+    };
+
     VertexInput()=default;
     
     /**
@@ -59,6 +115,98 @@ class VertexInput
      **/
     void setVertexAttributeVec3(uint32_t location, uint32_t offset) noexcept;
 
+    /**
+     * Sets the Vertex attribute at a specified location.
+     * @param[in] location the location of the attribute.
+     * @param[in] offset the offset within the Vertex structure.
+     * @param[in] format the Format of the attribute.
+     **/
+    void setVertexAttribute(
+        uint32_t location,
+        uint32_t offset,
+        Format format
+    ) noexcept;
+
+    /**
+     * Adds a vertex stream, read from its own Buffer.
+     * @param[in] stream the index of the stream, from 1. Stream 0 is given
+     *  by the constructor.
+     * @param[in] stride the stride of each vertex element in the stream.
+     **/
+    void setStreamStride(uint32_t stream, uint32_t stride) noexcept;
+
+    /**
+     * Sets the attribute at a specified location to be read from a stream.
+     * @param[in] stream the index of the stream.
+     * @param[in] location the location of the attribute.
+     * @param[in] offset the offset within the stream's element.
+     * @param[in] format the Format of the attribute.
+     **/
+    void setStreamAttribute(
+        uint32_t stream,
+        uint32_t location,
+        uint32_t offset,
+        Format format
+    ) noexcept;
+
+    /**
+     * Gets the binding that a vertex stream is read from. Binding 1 is the
+     * per-instance binding, so stream s>0 is at binding s+1.
+     * @param[in] stream the index of the stream.
+     * @returns the binding.
+     **/
+    static uint32_t streamBinding(uint32_t stream) noexcept
+    {
+        return stream==0 ? 0 : stream+1;
+    };
+
+    /**
+     * Adds a per-instance binding, which advances once per instance.
+     * @param[in] stride the stride of each instance element.
+     **/
+    void setInstanceStride(uint32_t stride) noexcept;
+
+    /**
+     * Sets the instance attribute at a specified location for a 3-part vector.
+     * @param[in] location the location of the attribute.
+     * @param[in] offset the offset within the instance structure.
+     **/
+    void setInstanceAttributeVec3(uint32_t location, uint32_t offset) noexcept;
+
+    /**
+     * Sets the instance attribute at a specified location for a 4-part vector.
+     * @param[in] location the location of the attribute.
+     * @param[in] offset the offset within the instance structure.
+     **/
+    void setInstanceAttributeVec4(uint32_t location, uint32_t offset) noexcept;
+
+    /**
+     * Sets the instance attribute for a 4x4 matrix. A matrix takes four
+     * locations, one for each column, starting at the specified location.
+     * @param[in] location the location of the first column.
+     * @param[in] offset the offset within the instance structure.
+     **/
+    void setInstanceAttributeMat4(uint32_t location, uint32_t offset) noexcept;
+
+    /**
+     * Sets the instance attribute at a specified location.
+     * @param[in] location the location of the attribute.
+     * @param[in] offset the offset within the instance structure.
+     * @param[in] format the Format of the attribute.
+     **/
+    void setInstanceAttribute(
+        uint32_t location,
+        uint32_t offset,
+        Format format
+    ) noexcept;
+
+    /**
+     * Gets the size of an attribute in bytes.
+     * @param[in] format the Format of the attribute.
+     * @returns the size in bytes.
+     **/
+    static uint32_t formatSize(Format format) noexcept;
+
     private:
     using AttributeDescriptions =
         std::vector<VkVertexInputAttributeDescription>;
@@ -76,7 +224,17 @@ class VertexInput
     {
         return m_bindingDescription;
     };
+    std::vector<VkVertexInputBindingDescription> bindingDescriptions()
+        const noexcept;
 
+    static VkFormat vkFormat(Format format) noexcept;
+
+    void setAttribute(
+        uint32_t binding,
+        uint32_t location,
+        uint32_t offset,
+        Format format
+    ) noexcept;
     void setAttributeDescription(
         uint32_t location,
         VkVertexInputAttributeDescription desc
@@ -85,11 +243,103 @@ class VertexInput
     
     AttributeDescriptions m_attributeDescriptions;
     VkVertexInputBindingDescription m_bindingDescription;
+    // Stride 0 means there is no per-instance binding.
+    VkVertexInputBindingDescription m_instanceBindingDescription={};
+    // Bindings of streams from 1, indexed by [stream-1]. Stride 0 means the
+    // stream is not read.
+    std::vector<VkVertexInputBindingDescription> m_streamBindingDescriptions;
 
     friend class Pipeline;
 
     // Tests.
     FRIEND_TEST(VertexInputTest,ctor);
+    FRIEND_TEST(VertexInputTest,formats);
+    FRIEND_TEST(VertexInputTest,instance);
+    FRIEND_TEST(VertexInputTest,layout);
+    FRIEND_TEST(VertexInputTest,streams);
+};
+
+struct Vertex;
+
+/**
+ * @class VertexLayout
+ * @brief A VertexLayout stores the attributes of a Vertex in packed Formats.
+ * 
+ * A Vertex holds every attribute as 32-bit floats, which is 44 bytes. A
+ * VertexLayout keeps only the attributes that are added to it, in the Formats
+ * given, so a mesh can take 16 to 20 bytes per vertex. Attributes are placed
+ * in the order they are added, which is also the order of their locations.
+ * 
+ * @example
+ * VertexLayout layout;
+ * layout.add(VertexLayout::Attribute::POSITION, VertexInput::Format::VEC3);
+ * layout.add(
+ *   VertexLayout::Attribute::NORMAL, VertexInput::Format::SNORM8_4
+ * );
+ * layout.add(VertexLayout::Attribute::TEX_COORD, VertexInput::Format::HALF2);
+ * VertexInput vertexInput = layout.vertexInput(); // A stride of 20 bytes.
+ * 
+ * // Vertices are packed straight into staging memory.
+ * auto fill = [&](void *dst, size_t firstElement, size_t numElements)
+ * {
+ *   layout.pack(&vertices[firstElement], numElements, dst);
+ * };
+ * StaticBuffer vertexBuffer(
+ *   device, fill, layout.stride(), vertices.size(), Buffer::Type::VERTEX
+ * );
+ **/
+class VertexLayout
+{
+    public:
+    // The attributes of a Vertex.
+    enum class Attribute{POSITION,COLOR,TEX_COORD,NORMAL};
+
+    VertexLayout()=default;
+
+    bool operator==(const VertexLayout&) const noexcept;
+    bool operator!=(const VertexLayout&) const noexcept;
+
+    /**
+     * Adds an attribute at the next location, after the attributes already
+     * added.
+     * @param[in] attribute the Attribute of the Vertex to store.
+     * @param[in] format the Format to store it in.
+     **/
+    void add(Attribute attribute, VertexInput::Format format) noexcept;
+
+    /**
+     * Packs vertices into the layout.
+     * @param[in] vertices the vertices to pack.
+     * @param[in] numVertices the number of vertices.
+     * @param[out] dst memory for numVertices*stride() bytes.
+     **/
+    void pack(
+        const Vertex *vertices,
+        size_t numVertices,
+        void *dst
+    ) const noexcept;
+
+    uint32_t stride() const noexcept { return m_stride; };
+
+    /**
+     * Creates the VertexInput that reads the layout.
+     * @returns the VertexInput.
+     **/
+    VertexInput vertexInput() const noexcept;
+
+    private:
+    struct Element
+    {
+        Attribute attribute;
+        VertexInput::Format format;
+        uint32_t offset;
+    };
+
+    std::vector<Element> m_elements;
+    uint32_t m_stride=0;
+
+    // Tests.
+    FRIEND_TEST(VertexInputTest,layout);
 };
 
 } // namespace evk
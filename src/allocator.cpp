@@ -0,0 +1,277 @@
+#include "allocator.h"
+
+#include "evk_assert.h"
+#include <iterator>
+#include "util.h"
+
+namespace internal
+{
+
+namespace
+{
+
+// Blocks are at most this large, and smaller on small heaps.
+const VkDeviceSize MAX_BLOCK_SIZE=64*1024*1024;
+
+std::mutex registryMutex;
+std::map<VkDevice, std::unique_ptr<Allocator>> registry;
+
+VkDeviceSize alignUp(VkDeviceSize offset, VkDeviceSize alignment) noexcept
+{
+    if (alignment<=1) return offset;
+    return (offset+alignment-1)/alignment*alignment;
+}
+
+} // namespace
+
+FreeList::FreeList(VkDeviceSize size) noexcept
+{
+    m_freeRanges[0]=size;
+    m_size=size;
+}
+
+bool FreeList::allocate(
+    VkDeviceSize size,
+    VkDeviceSize alignment,
+    VkDeviceSize *pOffset
+) noexcept
+{
+    for (auto it=m_freeRanges.begin(); it!=m_freeRanges.end(); ++it)
+    {
+        const VkDeviceSize rangeOffset=it->first;
+        const VkDeviceSize rangeEnd=it->first+it->second;
+        const VkDeviceSize offset=alignUp(rangeOffset, alignment);
+        if (offset+size>rangeEnd) continue;
+
+        // Keep the padding before the range and the space after it free.
+        m_freeRanges.erase(it);
+        if (offset>rangeOffset) m_freeRanges[rangeOffset]=offset-rangeOffset;
+        if (offset+size<rangeEnd) m_freeRanges[offset+size]=rangeEnd-offset-size;
+        m_used+=size;
+        *pOffset=offset;
+        return true;
+    }
+    return false;
+}
+
+void FreeList::free(VkDeviceSize offset, VkDeviceSize size) noexcept
+{
+    m_used-=size;
+    auto next=m_freeRanges.lower_bound(offset);
+    if (next!=m_freeRanges.end() && offset+size==next->first)
+    {
+        size+=next->second;
+        next=m_freeRanges.erase(next);
+    }
+    if (next!=m_freeRanges.begin())
+    {
+        auto prev=std::prev(next);
+        if (prev->first+prev->second==offset)
+        {
+            prev->second+=size;
+            return;
+        }
+    }
+    m_freeRanges[offset]=size;
+}
+
+VkDeviceSize FreeList::largestFreeRange() const noexcept
+{
+    VkDeviceSize largest=0;
+    for (const auto &range : m_freeRanges)
+        if (range.second>largest) largest=range.second;
+    return largest;
+}
+
+Allocator::Allocator(
+    VkDevice device,
+    VkPhysicalDevice physicalDevice
+) noexcept
+{
+    m_device=device;
+    m_physicalDevice=physicalDevice;
+    vkGetPhysicalDeviceMemoryProperties(m_physicalDevice, &m_memoryProperties);
+    m_pools.resize(2*m_memoryProperties.memoryTypeCount);
+}
+
+Allocator::~Allocator() noexcept
+{
+    EVK_EXPECT_TRUE(
+        m_numAllocations==0, "device memory freed while still in use\n"
+    );
+    for (auto &pool : m_pools)
+        for (auto &block : pool) freeMemory(block.memory, block.data);
+}
+
+Allocator& Allocator::get(
+    VkDevice device,
+    VkPhysicalDevice physicalDevice
+) noexcept
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    auto &allocator = registry[device];
+    if (allocator==nullptr)
+        allocator.reset(new Allocator(device, physicalDevice));
+    return *allocator;
+}
+
+void Allocator::destroy(VkDevice device) noexcept
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    registry.erase(device);
+}
+
+Allocation Allocator::allocate(
+    const VkMemoryRequirements &requirements,
+    VkMemoryPropertyFlags properties,
+    bool image
+) noexcept
+{
+    const uint32_t memoryType = findMemoryType(
+        m_physicalDevice, requirements.memoryTypeBits, properties
+    );
+    const VkDeviceSize size=blockSize(memoryType);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_numAllocations;
+
+    Allocation allocation;
+    allocation.allocator=this;
+    allocation.size=requirements.size;
+
+    // Large resources would waste most of a block.
+    if (requirements.size>size/2)
+    {
+        allocation.memory=allocateMemory(
+            requirements.size, memoryType, &allocation.data
+        );
+        ++m_numDedicated;
+        m_dedicatedBytes+=requirements.size;
+        return allocation;
+    }
+
+    allocation.pool=2*memoryType+(image ? 1 : 0);
+    auto &pool = m_pools[allocation.pool];
+    for (auto &block : pool)
+    {
+        if (block.freeList.allocate(
+            requirements.size, requirements.alignment, &allocation.offset))
+        {
+            allocation.memory=block.memory;
+            if (block.data!=nullptr)
+                allocation.data=static_cast<char*>(block.data)+allocation.offset;
+            return allocation;
+        }
+    }
+
+    Block block;
+    block.memory=allocateMemory(size, memoryType, &block.data);
+    block.freeList=FreeList(size);
+    block.freeList.allocate(
+        requirements.size, requirements.alignment, &allocation.offset
+    );
+    allocation.memory=block.memory;
+    if (block.data!=nullptr)
+        allocation.data=static_cast<char*>(block.data)+allocation.offset;
+    pool.push_back(std::move(block));
+    return allocation;
+}
+
+void Allocator::free(const Allocation &allocation) noexcept
+{
+    if (allocation.memory==VK_NULL_HANDLE) return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    --m_numAllocations;
+
+    if (allocation.pool<0)
+    {
+        freeMemory(allocation.memory, allocation.data);
+        --m_numDedicated;
+        m_dedicatedBytes-=allocation.size;
+        return;
+    }
+
+    auto &pool = m_pools[allocation.pool];
+    for (auto it=pool.begin(); it!=pool.end(); ++it)
+    {
+        if (it->memory!=allocation.memory) continue;
+        it->freeList.free(allocation.offset, allocation.size);
+        // Keep one empty block per pool, so that creating and destroying a
+        // single resource does not allocate device memory each time.
+        if (it->freeList.used()==0 && pool.size()>1)
+        {
+            freeMemory(it->memory, it->data);
+            pool.erase(it);
+        }
+        return;
+    }
+    EVK_ABORT("freed memory that was not allocated\n");
+}
+
+MemoryStats Allocator::stats() const noexcept
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    MemoryStats stats;
+    stats.numAllocations=m_numAllocations;
+    stats.numDeviceAllocations=m_numDedicated;
+    stats.bytesReserved=m_dedicatedBytes;
+    stats.bytesUsed=m_dedicatedBytes;
+    for (const auto &pool : m_pools)
+    {
+        for (const auto &block : pool)
+        {
+            const FreeList &freeList = block.freeList;
+            ++stats.numDeviceAllocations;
+            stats.bytesReserved+=freeList.size();
+            stats.bytesUsed+=freeList.used();
+            stats.numFreeRanges+=freeList.numFreeRanges();
+            if (freeList.largestFreeRange()>stats.largestFreeRange)
+                stats.largestFreeRange=freeList.largestFreeRange();
+        }
+    }
+    return stats;
+}
+
+VkDeviceMemory Allocator::allocateMemory(
+    VkDeviceSize size,
+    uint32_t memoryType,
+    void **ppData
+) noexcept
+{
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryType;
+
+    VkDeviceMemory memory;
+    auto result = vkAllocateMemory(m_device, &allocInfo, nullptr, &memory);
+    EVK_ASSERT(result, "failed to allocate device memory\n");
+
+    // Host-visible memory is mapped once, for the lifetime of the memory.
+    *ppData=nullptr;
+    const VkMemoryPropertyFlags flags =
+        m_memoryProperties.memoryTypes[memoryType].propertyFlags;
+    if (flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+    {
+        result = vkMapMemory(m_device, memory, 0, VK_WHOLE_SIZE, 0, ppData);
+        EVK_ASSERT(result, "failed to map device memory\n");
+    }
+    return memory;
+}
+
+VkDeviceSize Allocator::blockSize(uint32_t memoryType) const noexcept
+{
+    const uint32_t heap = m_memoryProperties.memoryTypes[memoryType].heapIndex;
+    const VkDeviceSize heapSize = m_memoryProperties.memoryHeaps[heap].size;
+    if (heapSize/8<MAX_BLOCK_SIZE) return heapSize/8;
+    return MAX_BLOCK_SIZE;
+}
+
+void Allocator::freeMemory(VkDeviceMemory memory, void *data) noexcept
+{
+    if (data!=nullptr) vkUnmapMemory(m_device, memory);
+    vkFreeMemory(m_device, memory, nullptr);
+}
+
+} // namespace internal
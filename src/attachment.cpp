@@ -39,7 +39,7 @@ void Attachment::reset() noexcept
     m_device=VK_NULL_HANDLE;
     m_format={};
     m_image=VK_NULL_HANDLE;
-    m_imageMemory=VK_NULL_HANDLE;
+    m_imageMemory={};
     m_imageView=VK_NULL_HANDLE;
     m_index=0;
     m_inputReference={};
@@ -66,7 +66,7 @@ Attachment::Attachment(
     switch(type)
     {
         case Type::FRAMEBUFFER:
-            setFramebufferAttachment();
+            setFramebufferAttachment(device);
             break;
         case Type::COLOR:
             setColorAttachment(device);
@@ -93,7 +93,7 @@ bool Attachment::operator!=(const Attachment &other) const noexcept
     return !(*this==other);
 }
 
-void Attachment::setFramebufferAttachment() noexcept
+void Attachment::setFramebufferAttachment(const Device &device) noexcept
 {
     m_description.flags = 0;
     m_description.format = VK_FORMAT_B8G8R8A8_SRGB;
@@ -104,6 +104,9 @@ void Attachment::setFramebufferAttachment() noexcept
     m_description.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     m_description.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
     m_description.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    // Offscreen images are copied to the host rather than presented.
+    if (device.headless())
+        m_description.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
 
     m_clearValue.color = {0.0f,0.0f,0.0f,1.0f};
 }
@@ -177,8 +180,7 @@ void Attachment::recreate(Device &device) noexcept
             vkDestroyImageView(m_device, m_imageView, nullptr);
         if (m_image != VK_NULL_HANDLE)
             vkDestroyImage(m_device, m_image, nullptr); 
-        if (m_imageMemory != VK_NULL_HANDLE)
-            vkFreeMemory(m_device, m_imageMemory, nullptr);
+        internal::freeMemory(m_imageMemory);
         internal::createImage(
             device.device(), device.physicalDevice(), device.extent(),
             m_format, m_tiling, m_usage, m_properties,
@@ -198,8 +200,7 @@ Attachment::~Attachment() noexcept
         vkDestroyImageView(m_device, m_imageView, nullptr);
     if (m_image != VK_NULL_HANDLE)
         vkDestroyImage(m_device, m_image, nullptr);
-    if (m_imageMemory != VK_NULL_HANDLE)
-        vkFreeMemory(m_device, m_imageMemory, nullptr);
+    internal::freeMemory(m_imageMemory);
 }
 
 } // namespace evk
\ No newline at end of file
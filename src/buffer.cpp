@@ -1,9 +1,28 @@
 #include "buffer.h"
 
 #include "evk_assert.h"
+#include <algorithm>
+#include <limits>
 
 namespace evk {
 
+namespace {
+// Updates at least this large are staged by the thread pool.
+const VkDeviceSize PARALLEL_UPDATE_SIZE = 1024*1024;
+
+StaticBuffer::Fill copyFill(const void *data, VkDeviceSize elementSize)
+{
+    const auto *bytes = static_cast<const unsigned char*>(data);
+    return [bytes, elementSize](
+        void *dst, size_t firstElement, size_t numElements)
+    {
+        memcpy(
+            dst, bytes+firstElement*elementSize, numElements*elementSize
+        );
+    };
+}
+} // namespace
+
 Buffer::Buffer(Buffer &&other) noexcept
 {
     *this=std::move(other);
@@ -11,26 +30,31 @@ Buffer::Buffer(Buffer &&other) noexcept
 
 Buffer::~Buffer() noexcept
 {
-    if (m_bufferData!=nullptr) free(m_bufferData);
+    if (m_owner!=nullptr && m_numRegions>1) m_owner->releaseRegions(m_buffer);
+    if (m_owner!=nullptr) m_owner->m_numBuffers--;
     if (m_buffer!=VK_NULL_HANDLE)
         vkDestroyBuffer(m_device, m_buffer, nullptr);
-    if (m_bufferMemory!=VK_NULL_HANDLE)
-        vkFreeMemory(m_device, m_bufferMemory, nullptr);
+    internal::freeMemory(m_bufferMemory);
 }
 
 Buffer& Buffer::operator=(Buffer &&other) noexcept
 {
     if (*this==other) return *this;
+    if (m_owner!=nullptr && m_numRegions>1) m_owner->releaseRegions(m_buffer);
+    if (m_owner!=nullptr) m_owner->m_numBuffers--;
     m_buffer=other.m_buffer;
-    m_bufferData=other.m_bufferData;
     m_bufferMemory=other.m_bufferMemory;
     m_bufferSize=other.m_bufferSize;
     m_device=other.m_device;
     m_elementSize=other.m_elementSize;
+    m_indexType=other.m_indexType;
     m_physicalDevice=other.m_physicalDevice;
     m_numElements=other.m_numElements;
+    m_numRegions=other.m_numRegions;
     m_numThreads=other.m_numThreads;
+    m_owner=other.m_owner;
     m_queue=other.m_queue;
+    m_regionStride=other.m_regionStride;
     other.reset();
     return *this;
 }
@@ -38,15 +62,18 @@ Buffer& Buffer::operator=(Buffer &&other) noexcept
 void Buffer::reset() noexcept
 {
     m_buffer=VK_NULL_HANDLE;
-    m_bufferData=nullptr;
-    m_bufferMemory=VK_NULL_HANDLE;
+    m_bufferMemory={};
     m_bufferSize=0;
     m_device=VK_NULL_HANDLE;
     m_elementSize=0;
+    m_indexType=VK_INDEX_TYPE_UINT32;
     m_numElements=0;
+    m_numRegions=1;
     m_numThreads=1;
+    m_owner=nullptr;
     m_physicalDevice=VK_NULL_HANDLE;
     m_queue=VK_NULL_HANDLE;
+    m_regionStride=0;
 }
 
 bool Buffer::operator==(const Buffer &other) const noexcept
@@ -60,6 +87,8 @@ bool Buffer::operator==(const Buffer &other) const noexcept
     if (m_queue!=other.m_queue) return false;
     if (m_numThreads!=other.m_numThreads) return false;
     if (m_elementSize!=other.m_elementSize) return false;
+    if (m_numRegions!=other.m_numRegions) return false;
+    if (m_indexType!=other.m_indexType) return false;
     return true;
 }
 
@@ -68,16 +97,31 @@ bool Buffer::operator!=(const Buffer &other) const noexcept
     return !(*this==other);
 }
 
+void Buffer::setIndexType(const Type &type) noexcept
+{
+    if (type!=Type::INDEX || m_elementSize==0) return;
+    EVK_ASSERT_TRUE(
+        m_elementSize==2 || m_elementSize==4, "indices must be 2 or 4 bytes\n"
+    );
+    m_indexType = m_elementSize==2 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+}
+
 VkBufferUsageFlags Buffer::typeToFlag(const Type &type) const noexcept
 {
     switch(type)
     {
         case Type::VERTEX:
+        case Type::INSTANCE:
             return VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
         case Type::INDEX:
             return VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
         case Type::UBO:
             return VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+        case Type::STORAGE:
+            return VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+        case Type::INDIRECT:
+            return VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
     }
 }
 
@@ -87,176 +131,303 @@ StaticBuffer::StaticBuffer(
     const VkDeviceSize &elementSize,
     const size_t numElements,
     const Type &type
+) noexcept : StaticBuffer(
+    device, DataSpan{data, elementSize, numElements}, type
+)
+{
+}
+
+StaticBuffer::StaticBuffer(
+    Device &device,
+    const DataSpan &data,
+    const Type &type,
+    const Ownership &ownership
 ) noexcept
 {
-    m_elementSize=elementSize;
-    m_numElements=numElements;
+    EVK_ASSERT_TRUE(
+        ownership!=Ownership::CALLBACK, "CALLBACK ownership needs a Fill\n"
+    );
 
-    m_bufferSize = m_numElements * m_elementSize;
-    m_bufferData = malloc(m_bufferSize);
-    memcpy(m_bufferData,data,m_bufferSize);
+    const Fill fill = copyFill(data.data, data.elementSize);
+    create(device, data.elementSize, data.numElements, type);
+    upload(device, fill);
+    if (ownership==Ownership::BORROW) m_fill=fill;
+}
 
-    m_device = device.device();
-    m_numThreads = device.numThreads();
-    m_physicalDevice = device.physicalDevice();
-    m_queue = device.graphicsQueue();
+StaticBuffer::StaticBuffer(
+    Device &device,
+    const std::vector<uint32_t> &indices,
+    const Ownership &ownership
+) noexcept
+{
+    EVK_ASSERT_TRUE(
+        ownership!=Ownership::CALLBACK, "CALLBACK ownership needs a Fill\n"
+    );
+
+    const uint32_t maxIndex = indices.empty() ?
+        0 : *std::max_element(indices.begin(), indices.end());
+    const uint32_t *src = indices.data();
+    Fill fill;
+    VkDeviceSize elementSize = sizeof(uint16_t);
+    if (maxIndex<=std::numeric_limits<uint16_t>::max())
+    {
+        // Indices are narrowed as they are written to staging memory.
+        fill = [src](void *dst, size_t firstElement, size_t numElements)
+        {
+            auto *indices16 = static_cast<uint16_t*>(dst);
+            for (size_t i = 0; i < numElements; ++i)
+                indices16[i] = static_cast<uint16_t>(src[firstElement+i]);
+        };
+    }
+    else
+    {
+        elementSize = sizeof(uint32_t);
+        fill = copyFill(src, elementSize);
+    }
 
-    finalize(device, type);
+    create(device, elementSize, indices.size(), Type::INDEX);
+    upload(device, fill);
+    if (ownership==Ownership::BORROW) m_fill=fill;
 }
 
-void StaticBuffer::finalize(
+StaticBuffer::StaticBuffer(
     Device &device,
+    const Fill &fill,
+    const VkDeviceSize &elementSize,
+    const size_t numElements,
     const Type &type
 ) noexcept
 {
-    const std::vector<VkCommandPool> &commandPools = device.commandPools();
+    create(device, elementSize, numElements, type);
+    upload(device, fill);
+    m_fill=fill;
+}
 
-    size_t numThreadsLocal = m_numThreads;
-    if (m_numElements<numThreadsLocal) numThreadsLocal = m_numElements;
+void StaticBuffer::reupload(Device &device) noexcept
+{
+    EVK_ASSERT_TRUE(
+        m_fill!=nullptr, "the StaticBuffer did not keep its data\n"
+    );
+    upload(device, m_fill);
+    device.waitForUploads(m_uploadValue);
+}
 
-    const int num_elements_each = m_numElements/numThreadsLocal;
-    m_bufferSize = m_elementSize*m_numElements;
+void StaticBuffer::create(
+    Device &device,
+    const VkDeviceSize &elementSize,
+    const size_t numElements,
+    const Type &type
+) noexcept
+{
+    m_elementSize=elementSize;
+    m_numElements=numElements;
+    m_bufferSize = m_numElements * m_elementSize;
+    setIndexType(type);
 
-    std::vector<VkCommandBuffer> commandBuffers(numThreadsLocal);
-    std::vector<VkBuffer> buffers(numThreadsLocal);
-    std::vector<VkDeviceMemory> bufferMemory(numThreadsLocal);
+    m_device = device.device();
+    m_numThreads = device.numThreads();
+    m_owner = &device;
+    m_owner->m_numBuffers++;
+    m_physicalDevice = device.physicalDevice();
+    m_queue = device.graphicsQueue();
 
     VkBufferUsageFlags usageFlags = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
     usageFlags |= typeToFlag(type);
 
-    // Create the device-local buffer.
+    // Create the device-local buffer, shared with the transfer queue.
     internal::createBuffer(
         m_device, m_physicalDevice, m_bufferSize, usageFlags,
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-        &m_buffer, &m_bufferMemory
+        &m_buffer, &m_bufferMemory, device.uploadQueueFamilies()
     );
+}
 
-    auto setupCopyFunction = [&](int thread)
-    {
-        int element_offset = num_elements_each*thread;
+void StaticBuffer::upload(Device &device, const Fill &fill) noexcept
+{
+    Device::Uploader &uploader = device.uploader();
+
+    size_t numThreadsLocal = m_numThreads;
+    if (m_numElements<numThreadsLocal) numThreadsLocal = m_numElements;
 
-        int num_elements=num_elements_each;
-        if (thread==(numThreadsLocal-1)) 
-            num_elements = m_numElements-(thread*num_elements_each);
+    const size_t num_elements_each = m_numElements/numThreadsLocal;
 
-        auto &staging_buffer = buffers[thread];
-        auto &staging_buffer_memory = bufferMemory[thread];
+    std::vector<size_t> elementOffsets(numThreadsLocal);
+    std::vector<size_t> numElements(numThreadsLocal, num_elements_each);
+    for (size_t thread = 0; thread<numThreadsLocal; ++thread)
+        elementOffsets[thread] = num_elements_each*thread;
+    numElements.back() = m_numElements-elementOffsets.back();
 
-        copyData(
-            m_device, m_physicalDevice, commandPools[thread],
-            commandBuffers[thread], m_buffer, staging_buffer,
-            staging_buffer_memory, num_elements, m_elementSize,
-            element_offset
+    // Each thread fills its own range of staging memory.
+    std::vector<Device::Uploader::Staging> staging(numThreadsLocal);
+    auto fillFunction = [&](int thread)
+    {
+        const VkDeviceSize size = numElements[thread]*m_elementSize;
+        EVK_ASSERT_TRUE(size>0, "buffer size is 0\n");
+        staging[thread] = uploader.stage(size);
+        fill(
+            staging[thread].data, elementOffsets[thread],
+            numElements[thread]
         );
     };
+    device.threadPool().parallelFor(numThreadsLocal, fillFunction);
 
-    int counter = 0;
-    for (auto &t: device.threads())
+    // Copy the staging ranges to the device-local buffer, in the next batch
+    // of uploads.
+    auto copyCommands = [&](VkCommandBuffer commandBuffer)
     {
-        if (counter < numThreadsLocal)
-            t->addJob(std::bind(setupCopyFunction,counter++));
-    }
-    device.wait();
-
-    VkSubmitInfo submitInfo = {};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = commandBuffers.size();
-    submitInfo.pCommandBuffers = commandBuffers.data();
+        for (size_t thread = 0; thread<numThreadsLocal; ++thread)
+        {
+            VkBufferCopy copyRegion = {};
+            copyRegion.size = numElements[thread]*m_elementSize;
+            copyRegion.srcOffset = staging[thread].offset;
+            copyRegion.dstOffset = elementOffsets[thread]*m_elementSize;
+            vkCmdCopyBuffer(
+                commandBuffer, staging[thread].buffer, m_buffer, 1,
+                &copyRegion
+            );
+        }
+    };
+    m_uploadValue = uploader.record(copyCommands, staging);
+}
 
-    vkQueueSubmit(m_queue, 1, &submitInfo, VK_NULL_HANDLE);
-    vkQueueWaitIdle(m_queue);
+void StaticBuffer::update(
+    VkDeviceSize offset,
+    VkDeviceSize size,
+    const void *data
+) noexcept
+{
+    if (size==0) return;
+    recordUpdate(
+        {BufferRange{offset, size}}, static_cast<const unsigned char*>(data),
+        offset
+    );
+}
 
-    for (size_t i = 0; i<numThreadsLocal; ++i)
+void StaticBuffer::updateRanges(
+    const std::vector<BufferRange> &ranges,
+    const void *data
+) noexcept
+{
+    std::vector<BufferRange> sorted;
+    for (const auto &range : ranges)
+        if (range.size>0) sorted.push_back(range);
+    if (sorted.empty()) return;
+    std::sort(sorted.begin(), sorted.end(),
+        [](const BufferRange &a, const BufferRange &b)
+        {
+            return a.offset<b.offset;
+        });
+
+    // Merge ranges that overlap or touch, so each byte is copied once.
+    std::vector<BufferRange> merged = {sorted[0]};
+    for (size_t i = 1; i < sorted.size(); ++i)
     {
-        vkFreeCommandBuffers(m_device, commandPools[i], 1, &commandBuffers[i]);
-        vkDestroyBuffer(m_device, buffers[i], nullptr);
-        vkFreeMemory(m_device, bufferMemory[i], nullptr);
+        auto &last = merged.back();
+        const VkDeviceSize end = sorted[i].offset+sorted[i].size;
+        if (sorted[i].offset>last.offset+last.size)
+            merged.push_back(sorted[i]);
+        else if (end>last.offset+last.size)
+            last.size=end-last.offset;
     }
+    recordUpdate(merged, static_cast<const unsigned char*>(data), 0);
 }
 
-void StaticBuffer::copyData(
-    VkDevice device,
-    VkPhysicalDevice physicalDevice,
-    VkCommandPool command_pool,
-    VkCommandBuffer &command_buffer,
-    VkBuffer device_buffer,
-    VkBuffer &staging_buffer,
-    VkDeviceMemory &staging_buffer_memory,
-    const size_t num_elements,
-    const VkDeviceSize element_size,
-    const size_t element_offset
-) const noexcept
+void StaticBuffer::recordUpdate(
+    const std::vector<BufferRange> &ranges,
+    const unsigned char *data,
+    VkDeviceSize dataOffset
+) noexcept
 {
-    const size_t buffer_offset = element_offset*element_size;
-    const size_t buffer_size = num_elements*element_size;
-
-    EVK_ASSERT_TRUE(buffer_size>0, "buffer size is 0\n");
-
-    // Use a host visible buffer as a staging buffer.
-    internal::createBuffer(
-        device, physicalDevice, buffer_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        &staging_buffer, &staging_buffer_memory
-    );
-
-    const unsigned char* bytePtr = reinterpret_cast<const unsigned char*>(m_bufferData);
-    auto offset = element_offset*element_size;
-
-    // Copy vertex data to the staging buffer by mapping the buffer memory into CPU
-    // accessible memory.
-    void *mappedData;
-    vkMapMemory(device, staging_buffer_memory, 0, buffer_size, 0, &mappedData);
-    memcpy(mappedData, bytePtr+offset, buffer_size); // Offset vertices.
-    vkUnmapMemory(device, staging_buffer_memory);
-
-    // Copy the vertex data from the staging buffer to the device-local buffer.
-    VkCommandBufferAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.commandPool = command_pool;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandBufferCount = 1;
-    vkAllocateCommandBuffers(device, &allocInfo, &command_buffer);
-
-    VkCommandBufferBeginInfo beginInfo = {};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    // The ranges are packed into one staging allocation.
+    VkDeviceSize stagingSize=0;
+    std::vector<VkBufferCopy> regions(ranges.size());
+    for (size_t i = 0; i < ranges.size(); ++i)
+    {
+        EVK_ASSERT_TRUE(
+            ranges[i].offset+ranges[i].size<=m_bufferSize,
+            "update range is out of bounds\n"
+        );
+        regions[i].srcOffset=stagingSize;
+        regions[i].dstOffset=ranges[i].offset;
+        regions[i].size=ranges[i].size;
+        stagingSize+=ranges[i].size;
+    }
 
-    vkBeginCommandBuffer(command_buffer, &beginInfo);
+    // The copy must not race the initial upload, which may be on another
+    // queue.
+    if (!m_owner->uploadComplete(m_uploadValue))
+        m_owner->waitForUploads(m_uploadValue);
 
-    VkBufferCopy copyRegion = {};
-    copyRegion.size = buffer_size;
-    copyRegion.dstOffset = buffer_offset;
-    vkCmdCopyBuffer(command_buffer, staging_buffer, device_buffer, 1, &copyRegion);
+    Device::Uploader &uploader = m_owner->uploader();
+    const auto staging = uploader.stage(stagingSize);
+    auto *dst = static_cast<unsigned char*>(staging.data);
+    auto copyRange = [&](int i)
+    {
+        memcpy(
+            dst+regions[i].srcOffset, data+(regions[i].dstOffset-dataOffset),
+            regions[i].size
+        );
+    };
+    if (ranges.size()>1 && stagingSize>=PARALLEL_UPDATE_SIZE)
+        m_owner->threadPool().parallelFor(ranges.size(), copyRange);
+    else
+        for (size_t i = 0; i < ranges.size(); ++i) copyRange(i);
 
-    vkEndCommandBuffer(command_buffer);
+    for (auto &region : regions) region.srcOffset+=staging.offset;
+    uploader.update(m_buffer, regions, staging);
 }
 
 DynamicBuffer::DynamicBuffer(
-    const Device &device,
+    Device &device,
     const VkDeviceSize &bufferSize,
     const Type &type
 ) noexcept
 {
-    m_device = device.device();
     m_bufferSize=bufferSize;
     m_numElements=1;
+    create(device, type);
+}
+
+void DynamicBuffer::create(Device &device, const Type &type) noexcept
+{
+    m_device = device.device();
+    m_owner = &device;
+    m_owner->m_numBuffers++;
+    m_physicalDevice = device.physicalDevice();
+    m_queue = device.graphicsQueue();
+
+    // Only uniform and storage buffers are bound with dynamic offsets.
+    m_regionStride = m_bufferSize;
+    if (type==Type::UBO || type==Type::STORAGE)
+    {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(m_physicalDevice, &properties);
+        const VkDeviceSize alignment = type==Type::UBO ?
+            properties.limits.minUniformBufferOffsetAlignment :
+            properties.limits.minStorageBufferOffsetAlignment;
+        m_numRegions = device.m_swapchainSize;
+        m_regionStride = (m_bufferSize+alignment-1)/alignment*alignment;
+    }
 
     internal::createBuffer(
-        m_device, device.physicalDevice(), bufferSize, typeToFlag(type),
+        m_device, m_physicalDevice, m_regionStride*m_numRegions,
+        typeToFlag(type),
         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
         &m_buffer, &m_bufferMemory);
 }
 
 void DynamicBuffer::update(const void *srcBuffer) noexcept
 {
-    if (m_bufferData!=nullptr) free(m_bufferData);
-    m_bufferData = malloc(m_bufferSize);
-    memcpy(m_bufferData,srcBuffer,m_bufferSize);
-
-    void* dstBuffer;
-    vkMapMemory(m_device, m_bufferMemory, 0, m_bufferSize, 0, &dstBuffer);
-    memcpy(dstBuffer, srcBuffer, m_bufferSize);
-    vkUnmapMemory(m_device, m_bufferMemory);
+    auto *regions = static_cast<unsigned char*>(m_bufferMemory.data);
+    if (m_numRegions==1)
+    {
+        memcpy(regions, srcBuffer, m_bufferSize);
+        return;
+    }
+    m_owner->writeRegions(
+        m_buffer, regions, m_numRegions, m_regionStride, m_bufferSize,
+        srcBuffer
+    );
 }
 
 DynamicBuffer::DynamicBuffer(
@@ -267,24 +438,16 @@ DynamicBuffer::DynamicBuffer(
     const Type &type
 ) noexcept
 {
-    m_device = device.device();
-    m_physicalDevice=device.physicalDevice();
-    m_queue=device.graphicsQueue();
-    
     m_bufferSize=elementSize*numElements;
+    m_elementSize=elementSize;
     m_numElements=numElements;
-    m_bufferData = malloc(m_bufferSize);
-    
-    memcpy(m_bufferData,data,m_bufferSize);
-
-    VkBufferUsageFlags usageFlags = typeToFlag(type);
-
-    internal::createBuffer(
-        m_device, device.physicalDevice(), m_bufferSize, usageFlags,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        &m_buffer, &m_bufferMemory);
+    setIndexType(type);
+    create(device, type);
 
-    update(data);
+    // The Buffer is not bound yet, so every region is written.
+    auto *regions = static_cast<unsigned char*>(m_bufferMemory.data);
+    for (uint32_t i = 0; i < m_numRegions; ++i)
+        memcpy(regions+dynamicOffset(i), data, m_bufferSize);
 }
 
 void Buffer::copyBuffer(
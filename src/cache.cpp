@@ -0,0 +1,158 @@
+#include "device.h"
+
+#include "evk_assert.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace evk {
+
+namespace {
+// The header of VK_PIPELINE_CACHE_HEADER_VERSION_ONE: its length, version,
+// vendor ID and device ID, followed by the pipeline cache UUID.
+const size_t HEADER_SIZE = 4*sizeof(uint32_t)+VK_UUID_SIZE;
+
+uint32_t readUint32(const std::vector<char> &data, size_t offset) noexcept
+{
+    uint32_t value;
+    memcpy(&value, data.data()+offset, sizeof(value));
+    return value;
+}
+} // namespace
+
+Device::PipelineCache::PipelineCache(
+    const VkDevice &device,
+    const VkPhysicalDevice &physicalDevice
+)
+{
+    m_device = device;
+    m_physicalDevice = physicalDevice;
+    create({});
+}
+
+void Device::PipelineCache::create(const std::vector<char> &data) noexcept
+{
+    VkPipelineCacheCreateInfo createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    createInfo.initialDataSize = data.size();
+    createInfo.pInitialData = data.empty() ? nullptr : data.data();
+    auto result = vkCreatePipelineCache(
+        m_device, &createInfo, nullptr, &m_cache
+    );
+    EVK_ASSERT(result, "failed to create pipeline cache\n");
+}
+
+void Device::PipelineCache::load(const std::string &fileName) noexcept
+{
+    m_fileName = fileName;
+
+    std::vector<char> data;
+    std::ifstream file(fileName, std::ios::ate | std::ios::binary);
+    if (file.is_open())
+    {
+        data.resize(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        file.read(data.data(), data.size());
+    }
+
+    // A cache written by another device or driver is ignored, rather than
+    // left to the driver to reject.
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(m_physicalDevice, &properties);
+    if (!validHeader(data, properties)) data.clear();
+
+    // Pipelines already built keep their entries.
+    const VkPipelineCache oldCache = m_cache;
+    create(data);
+    vkMergePipelineCaches(m_device, m_cache, 1, &oldCache);
+    vkDestroyPipelineCache(m_device, oldCache, nullptr);
+}
+
+void Device::PipelineCache::save() const noexcept
+{
+    if (m_fileName.empty()) return;
+    size_t size = 0;
+    vkGetPipelineCacheData(m_device, m_cache, &size, nullptr);
+    std::vector<char> data(size);
+    auto result = vkGetPipelineCacheData(
+        m_device, m_cache, &size, data.data()
+    );
+    if (result!=VK_SUCCESS) return;
+
+    // The file is replaced whole, so a failed write leaves the old cache.
+    const std::string tempName = m_fileName+".tmp";
+    std::ofstream file(tempName, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) return;
+    file.write(data.data(), size);
+    file.close();
+    if (file.fail()) return;
+    std::rename(tempName.c_str(), m_fileName.c_str());
+}
+
+bool Device::PipelineCache::validHeader(
+    const std::vector<char> &data,
+    const VkPhysicalDeviceProperties &properties
+) noexcept
+{
+    if (data.size()<HEADER_SIZE) return false;
+    if (readUint32(data, 0)<HEADER_SIZE) return false;
+    if (readUint32(data, 4)!=VK_PIPELINE_CACHE_HEADER_VERSION_ONE)
+        return false;
+    if (readUint32(data, 8)!=properties.vendorID) return false;
+    if (readUint32(data, 12)!=properties.deviceID) return false;
+    return memcmp(
+        data.data()+16, properties.pipelineCacheUUID, VK_UUID_SIZE
+    )==0;
+}
+
+Device::PipelineCache::PipelineCache(PipelineCache &&other) noexcept
+{
+    *this=std::move(other);
+}
+
+Device::PipelineCache& Device::PipelineCache::operator=(
+    PipelineCache &&other
+) noexcept
+{
+    if (*this==other) return *this;
+    m_cache=other.m_cache;
+    m_device=other.m_device;
+    m_fileName=other.m_fileName;
+    m_physicalDevice=other.m_physicalDevice;
+    other.reset();
+    return *this;
+}
+
+void Device::PipelineCache::reset() noexcept
+{
+    m_cache=VK_NULL_HANDLE;
+    m_device=VK_NULL_HANDLE;
+    m_fileName.clear();
+    m_physicalDevice=VK_NULL_HANDLE;
+}
+
+bool Device::PipelineCache::operator==(
+    const PipelineCache &other
+) const noexcept
+{
+    if (m_cache!=other.m_cache) return false;
+    if (m_device!=other.m_device) return false;
+    if (m_fileName!=other.m_fileName) return false;
+    return true;
+}
+
+bool Device::PipelineCache::operator!=(
+    const PipelineCache &other
+) const noexcept
+{
+    return !(*this==other);
+}
+
+Device::PipelineCache::~PipelineCache() noexcept
+{
+    if (m_cache==VK_NULL_HANDLE) return;
+    save();
+    vkDestroyPipelineCache(m_device, m_cache, nullptr);
+}
+
+} // namespace evk
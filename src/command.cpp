@@ -13,15 +13,17 @@ Device::Commands::Commands(
 )
 {
     m_device = device;
+    m_physicalDevice = physicalDevice;
+    auto queueFamilyIndices = internal::findQueueFamilies(
+        physicalDevice, surface
+    );
+    m_queueFamilyIndex = queueFamilyIndices.graphicsFamily;
     m_commandPools.resize(numThreads);
     for (auto &commandPool : m_commandPools)
     {
-        auto queueFamilyIndices = internal::findQueueFamilies(
-            physicalDevice, surface
-        );
         VkCommandPoolCreateInfo poolInfo = {};
         poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-        poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily;
+        poolInfo.queueFamilyIndex = m_queueFamilyIndex;
         poolInfo.flags=VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
         auto result = vkCreateCommandPool(
             m_device, &poolInfo, nullptr, &commandPool
@@ -37,8 +39,163 @@ Device::Commands::Commands(
     allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
     for (auto &cb : m_primaryCommandBuffers)
         vkAllocateCommandBuffers(m_device, &allocInfo, &cb);
+}
+
+void Device::Commands::allocateSecondaries(size_t numSubpasses) noexcept
+{
+    const size_t numThreads = m_commandPools.size();
+    const size_t numBuffers = numSubpasses*numThreads;
+
+    // The pools allow individual resets, so existing buffers are re-recorded
+    // in place and only reallocated when the number of subpasses changes.
+    if (!m_secondaryCommandBuffers.empty() &&
+        m_secondaryCommandBuffers[0].size()==numBuffers)
+        return;
+    freeSecondaries();
+
+    m_secondaryCommandBuffers.resize(
+        m_primaryCommandBuffers.size(),
+        std::vector<VkCommandBuffer>(numBuffers)
+    );
+
+    VkCommandBufferAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+    allocInfo.commandBufferCount = 1;
+    for (auto &secondaryCommandBuffers : m_secondaryCommandBuffers)
+    {
+        for (size_t pass = 0; pass < numSubpasses; ++pass)
+        {
+            for (size_t thread = 0; thread < numThreads; ++thread)
+            {
+                allocInfo.commandPool = m_commandPools[thread];
+                auto result = vkAllocateCommandBuffers(
+                    m_device, &allocInfo,
+                    &secondaryCommandBuffers[pass*numThreads+thread]
+                );
+                EVK_ASSERT(result, "failed to allocate command buffers");
+            }
+        }
+    }
+}
+
+void Device::Commands::freeSecondaries() noexcept
+{
+    const size_t numThreads = m_commandPools.size();
+    for (auto &secondaryCommandBuffers : m_secondaryCommandBuffers)
+    {
+        for (size_t i = 0; i < secondaryCommandBuffers.size(); ++i)
+        {
+            vkFreeCommandBuffers(
+                m_device, m_commandPools[i%numThreads], 1,
+                &secondaryCommandBuffers[i]
+            );
+        }
+    }
+    m_secondaryCommandBuffers.resize(0);
+}
+
+void Device::Commands::allocateFrames(
+    uint32_t maxFramesInFlight,
+    size_t numSubpasses
+) noexcept
+{
+    destroyFrames();
+
+    const size_t numThreads = m_commandPools.size();
+    m_frameCommandPools.resize(
+        maxFramesInFlight, std::vector<VkCommandPool>(numThreads)
+    );
+    m_framePrimaryCommandBuffers.resize(maxFramesInFlight);
+    m_frameSecondaryCommandBuffers.resize(
+        maxFramesInFlight,
+        std::vector<VkCommandBuffer>(numSubpasses*numThreads)
+    );
+
+    // The pools are reset as a whole each frame, so individual command
+    // buffers never need to be reset.
+    VkCommandPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.queueFamilyIndex = m_queueFamilyIndex;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+    VkCommandBufferAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+
+    VkResult result;
+    for (size_t frame = 0; frame < maxFramesInFlight; ++frame)
+    {
+        auto &commandPools = m_frameCommandPools[frame];
+        auto &secondaryCommandBuffers = m_frameSecondaryCommandBuffers[frame];
+        for (size_t thread = 0; thread < numThreads; ++thread)
+        {
+            result = vkCreateCommandPool(
+                m_device, &poolInfo, nullptr, &commandPools[thread]
+            );
+            EVK_ASSERT(result, "failed to create frame command pool.");
+
+            allocInfo.commandPool = commandPools[thread];
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            allocInfo.commandBufferCount = 1;
+            for (size_t pass = 0; pass < numSubpasses; ++pass)
+            {
+                result = vkAllocateCommandBuffers(
+                    m_device, &allocInfo,
+                    &secondaryCommandBuffers[pass*numThreads+thread]
+                );
+                EVK_ASSERT(result, "failed to allocate command buffers");
+            }
+        }
+
+        // The primary is only recorded while no worker is using pool 0.
+        allocInfo.commandPool = commandPools[0];
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+        result = vkAllocateCommandBuffers(
+            m_device, &allocInfo, &m_framePrimaryCommandBuffers[frame]
+        );
+        EVK_ASSERT(result, "failed to allocate command buffers");
+    }
+}
 
-    m_secondaryCommandBuffers.resize(numThreads);
+void Device::Commands::destroyFrames() noexcept
+{
+    // Destroying a pool frees every command buffer allocated from it.
+    for (auto &commandPools : m_frameCommandPools)
+        for (auto &commandPool : commandPools)
+            vkDestroyCommandPool(m_device, commandPool, nullptr);
+    m_frameCommandPools.resize(0);
+    m_framePrimaryCommandBuffers.resize(0);
+    m_frameSecondaryCommandBuffers.resize(0);
+}
+
+void Device::Commands::writeIndirectCommands(
+    const std::vector<VkDrawIndexedIndirectCommand> &commands
+) noexcept
+{
+    destroyIndirectCommands();
+    if (commands.empty()) return;
+
+    // The commands only change with the draw items, so host-visible memory
+    // is read directly by the GPU rather than staged. Culling reads them
+    // as a storage buffer.
+    const VkDeviceSize size = commands.size()*sizeof(commands[0]);
+    internal::createBuffer(
+        m_device, m_physicalDevice, size,
+        VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT|VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        &m_indirectBuffer, &m_indirectBufferMemory
+    );
+    memcpy(m_indirectBufferMemory.data, commands.data(), size);
+}
+
+void Device::Commands::destroyIndirectCommands() noexcept
+{
+    if (m_indirectBuffer!=VK_NULL_HANDLE)
+        vkDestroyBuffer(m_device, m_indirectBuffer, nullptr);
+    internal::freeMemory(m_indirectBufferMemory);
+    m_indirectBuffer=VK_NULL_HANDLE;
+    m_indirectBufferMemory={};
 }
 
 Device::Commands::Commands(Commands &&other) noexcept
@@ -51,7 +208,14 @@ Device::Commands& Device::Commands::operator=(Commands &&other) noexcept
     if (*this==other) return *this;
     m_commandPools = other.m_commandPools;
     m_device = other.m_device;
+    m_frameCommandPools = other.m_frameCommandPools;
+    m_framePrimaryCommandBuffers = other.m_framePrimaryCommandBuffers;
+    m_frameSecondaryCommandBuffers = other.m_frameSecondaryCommandBuffers;
+    m_indirectBuffer = other.m_indirectBuffer;
+    m_indirectBufferMemory = other.m_indirectBufferMemory;
+    m_physicalDevice = other.m_physicalDevice;
     m_primaryCommandBuffers = other.m_primaryCommandBuffers;
+    m_queueFamilyIndex = other.m_queueFamilyIndex;
     m_secondaryCommandBuffers = other.m_secondaryCommandBuffers;
     other.reset();
     return *this;
@@ -61,7 +225,14 @@ void Device::Commands::reset() noexcept
 {
     m_commandPools.resize(0);
     m_device=VK_NULL_HANDLE;
+    m_frameCommandPools.resize(0);
+    m_framePrimaryCommandBuffers.resize(0);
+    m_frameSecondaryCommandBuffers.resize(0);
+    m_indirectBuffer=VK_NULL_HANDLE;
+    m_indirectBufferMemory={};
+    m_physicalDevice=VK_NULL_HANDLE;
     m_primaryCommandBuffers.resize(0);
+    m_queueFamilyIndex=0;
     m_secondaryCommandBuffers.resize(0);  
 }
 
@@ -72,14 +243,18 @@ bool Device::Commands::operator==(const Commands &other) const noexcept
             other.m_commandPools.begin()
         )) return false;
     if (m_device!=other.m_device) return false;
+    if (m_frameCommandPools!=other.m_frameCommandPools) return false;
+    if (m_framePrimaryCommandBuffers!=other.m_framePrimaryCommandBuffers)
+        return false;
+    if (m_frameSecondaryCommandBuffers!=other.m_frameSecondaryCommandBuffers)
+        return false;
+    if (m_indirectBuffer!=other.m_indirectBuffer) return false;
     if (!std::equal(
             m_primaryCommandBuffers.begin(), m_primaryCommandBuffers.end(),
             other.m_primaryCommandBuffers.begin()
         )) return false;
-    if (!std::equal(
-            m_secondaryCommandBuffers.begin(), m_secondaryCommandBuffers.end(),
-            other.m_secondaryCommandBuffers.begin()
-        )) return false;
+    if (m_secondaryCommandBuffers!=other.m_secondaryCommandBuffers)
+        return false;
     return true;
 }
 
@@ -90,11 +265,16 @@ bool Device::Commands::operator!=(const Commands &other) const noexcept
 
 Device::Commands::~Commands() noexcept
 {
-    for (int i = 0; i < m_commandPools.size(); ++i)
-    {
-        vkFreeCommandBuffers(m_device, m_commandPools[i], 1, &m_secondaryCommandBuffers[i]);
-        vkDestroyCommandPool(m_device, m_commandPools[i], nullptr);
-    }
+    destroyFrames();
+    destroyIndirectCommands();
+    freeSecondaries();
+    if (!m_primaryCommandBuffers.empty())
+        vkFreeCommandBuffers(
+            m_device, m_commandPools[0], m_primaryCommandBuffers.size(),
+            m_primaryCommandBuffers.data()
+        );
+    for (auto &commandPool : m_commandPools)
+        vkDestroyCommandPool(m_device, commandPool, nullptr);
 }
 
 } // namespace evk
\ No newline at end of file
@@ -0,0 +1,308 @@
+#include "device.h"
+
+#include "buffer.h"
+#include "evk_assert.h"
+
+namespace evk {
+
+namespace {
+// Must match the local_size_x of the culling shader.
+const uint32_t WORKGROUP_SIZE = 64;
+} // namespace
+
+Device::Cull::Cull(
+    const VkDevice &device,
+    const VkPhysicalDevice &physicalDevice,
+    const VkPipelineCache &pipelineCache,
+    const VkPipelineShaderStageCreateInfo &shaderStage,
+    const Buffer &camera,
+    const std::vector<BoundingSphere> &boundingSpheres
+)
+{
+    m_boundingSpheres = boundingSpheres;
+    m_camera = &camera;
+    m_device = device;
+    m_physicalDevice = physicalDevice;
+
+    std::vector<VkDescriptorSetLayoutBinding> bindings(4);
+    for (uint32_t i = 0; i < bindings.size(); ++i)
+    {
+        bindings[i].binding = i;
+        bindings[i].descriptorCount = 1;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+    // The camera may be a ring buffer, so its region is chosen when recording.
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = bindings.size();
+    layoutInfo.pBindings = bindings.data();
+    auto result = vkCreateDescriptorSetLayout(
+        m_device, &layoutInfo, nullptr, &m_descriptorSetLayout
+    );
+    EVK_ASSERT(result, "failed to create culling descriptor set layout");
+
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(uint32_t);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &m_descriptorSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+    result = vkCreatePipelineLayout(
+        m_device, &pipelineLayoutInfo, nullptr, &m_layout
+    );
+    EVK_ASSERT(result, "failed to create culling pipeline layout");
+
+    VkComputePipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage = shaderStage;
+    pipelineInfo.layout = m_layout;
+    result = vkCreateComputePipelines(
+        m_device, pipelineCache, 1, &pipelineInfo, nullptr, &m_pipeline
+    );
+    EVK_ASSERT(result, "failed to create culling pipeline");
+
+    std::vector<VkDescriptorPoolSize> poolSizes(2);
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    poolSizes[0].descriptorCount = 1;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[1].descriptorCount = 3;
+
+    VkDescriptorPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = poolSizes.size();
+    poolInfo.pPoolSizes = poolSizes.data();
+    poolInfo.maxSets = 1;
+    result = vkCreateDescriptorPool(
+        m_device, &poolInfo, nullptr, &m_descriptorPool
+    );
+    EVK_ASSERT(result, "failed to create culling descriptor pool");
+
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = m_descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &m_descriptorSetLayout;
+    result = vkAllocateDescriptorSets(m_device, &allocInfo, &m_descriptorSet);
+    EVK_ASSERT(result, "failed to allocate culling descriptor set");
+}
+
+void Device::Cull::update(
+    const std::vector<uint32_t> &drawItemIndices,
+    VkBuffer indirectBuffer
+) noexcept
+{
+    destroyBuffers();
+    m_numDraws = drawItemIndices.size();
+    if (m_numDraws==0) return;
+
+    // Lay the spheres out in the order of the indirect commands. A draw item
+    // split across threads has one command, and one sphere, per piece.
+    std::vector<BoundingSphere> boundingSpheres(m_numDraws);
+    for (size_t i = 0; i < m_numDraws; ++i)
+    {
+        EVK_ASSERT_TRUE(
+            drawItemIndices[i]<m_boundingSpheres.size(),
+            "there must be a bounding sphere for each draw item"
+        );
+        boundingSpheres[i] = m_boundingSpheres[drawItemIndices[i]];
+    }
+
+    const VkDeviceSize size = m_numDraws*sizeof(BoundingSphere);
+    internal::createBuffer(
+        m_device, m_physicalDevice, size,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        &m_boundingSphereBuffer, &m_boundingSphereBufferMemory
+    );
+    memcpy(m_boundingSphereBufferMemory.data, boundingSpheres.data(), size);
+
+    // The culled commands are written and read by the GPU, and may be
+    // copied out to inspect the culling.
+    internal::createBuffer(
+        m_device, m_physicalDevice,
+        m_numDraws*sizeof(VkDrawIndexedIndirectCommand),
+        VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT|VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+            |VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        &m_drawCommandBuffer, &m_drawCommandBufferMemory
+    );
+
+    std::vector<VkDescriptorBufferInfo> bufferInfos(4);
+    bufferInfos[0].buffer = m_camera->buffer();
+    bufferInfos[0].offset = 0;
+    bufferInfos[0].range = m_camera->size();
+    bufferInfos[1].buffer = m_boundingSphereBuffer;
+    bufferInfos[1].offset = 0;
+    bufferInfos[1].range = VK_WHOLE_SIZE;
+    bufferInfos[2].buffer = indirectBuffer;
+    bufferInfos[2].offset = 0;
+    bufferInfos[2].range = VK_WHOLE_SIZE;
+    bufferInfos[3].buffer = m_drawCommandBuffer;
+    bufferInfos[3].offset = 0;
+    bufferInfos[3].range = VK_WHOLE_SIZE;
+
+    std::vector<VkWriteDescriptorSet> writes(4);
+    for (uint32_t i = 0; i < writes.size(); ++i)
+    {
+        writes[i] = {};
+        writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[i].dstSet = m_descriptorSet;
+        writes[i].dstBinding = i;
+        writes[i].dstArrayElement = 0;
+        writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writes[i].descriptorCount = 1;
+        writes[i].pBufferInfo = &bufferInfos[i];
+    }
+    writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    vkUpdateDescriptorSets(
+        m_device, writes.size(), writes.data(), 0, nullptr
+    );
+}
+
+void Device::Cull::record(
+    VkCommandBuffer commandBuffer,
+    uint32_t imageIndex
+) const noexcept
+{
+    if (m_numDraws==0) return;
+
+    // The draws of the previous frame must have read the commands before
+    // they are overwritten.
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = m_drawCommandBuffer;
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+    vkCmdPipelineBarrier(
+        commandBuffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1, &barrier,
+        0, nullptr
+    );
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline);
+    const uint32_t cameraOffset = m_camera->dynamicOffset(imageIndex);
+    vkCmdBindDescriptorSets(
+        commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_layout, 0, 1,
+        &m_descriptorSet, 1, &cameraOffset
+    );
+    vkCmdPushConstants(
+        commandBuffer, m_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+        sizeof(m_numDraws), &m_numDraws
+    );
+    vkCmdDispatch(
+        commandBuffer, (m_numDraws+WORKGROUP_SIZE-1)/WORKGROUP_SIZE, 1, 1
+    );
+
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    vkCmdPipelineBarrier(
+        commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 0, nullptr, 1, &barrier,
+        0, nullptr
+    );
+}
+
+void Device::Cull::destroyBuffers() noexcept
+{
+    if (m_boundingSphereBuffer!=VK_NULL_HANDLE)
+        vkDestroyBuffer(m_device, m_boundingSphereBuffer, nullptr);
+    internal::freeMemory(m_boundingSphereBufferMemory);
+    if (m_drawCommandBuffer!=VK_NULL_HANDLE)
+        vkDestroyBuffer(m_device, m_drawCommandBuffer, nullptr);
+    internal::freeMemory(m_drawCommandBufferMemory);
+    m_boundingSphereBuffer=VK_NULL_HANDLE;
+    m_boundingSphereBufferMemory={};
+    m_drawCommandBuffer=VK_NULL_HANDLE;
+    m_drawCommandBufferMemory={};
+}
+
+Device::Cull::Cull(Cull &&other) noexcept
+{
+    *this=std::move(other);
+}
+
+Device::Cull& Device::Cull::operator=(Cull &&other) noexcept
+{
+    if (*this==other) return *this;
+    m_boundingSphereBuffer = other.m_boundingSphereBuffer;
+    m_boundingSphereBufferMemory = other.m_boundingSphereBufferMemory;
+    m_boundingSpheres = other.m_boundingSpheres;
+    m_camera = other.m_camera;
+    m_descriptorPool = other.m_descriptorPool;
+    m_descriptorSet = other.m_descriptorSet;
+    m_descriptorSetLayout = other.m_descriptorSetLayout;
+    m_device = other.m_device;
+    m_drawCommandBuffer = other.m_drawCommandBuffer;
+    m_drawCommandBufferMemory = other.m_drawCommandBufferMemory;
+    m_layout = other.m_layout;
+    m_numDraws = other.m_numDraws;
+    m_physicalDevice = other.m_physicalDevice;
+    m_pipeline = other.m_pipeline;
+    other.reset();
+    return *this;
+}
+
+void Device::Cull::reset() noexcept
+{
+    m_boundingSphereBuffer=VK_NULL_HANDLE;
+    m_boundingSphereBufferMemory={};
+    m_boundingSpheres.resize(0);
+    m_camera=nullptr;
+    m_descriptorPool=VK_NULL_HANDLE;
+    m_descriptorSet=VK_NULL_HANDLE;
+    m_descriptorSetLayout=VK_NULL_HANDLE;
+    m_device=VK_NULL_HANDLE;
+    m_drawCommandBuffer=VK_NULL_HANDLE;
+    m_drawCommandBufferMemory={};
+    m_layout=VK_NULL_HANDLE;
+    m_numDraws=0;
+    m_physicalDevice=VK_NULL_HANDLE;
+    m_pipeline=VK_NULL_HANDLE;
+}
+
+bool Device::Cull::operator==(const Cull &other) const noexcept
+{
+    if (m_boundingSphereBuffer!=other.m_boundingSphereBuffer) return false;
+    if (m_camera!=other.m_camera) return false;
+    if (m_descriptorPool!=other.m_descriptorPool) return false;
+    if (m_descriptorSet!=other.m_descriptorSet) return false;
+    if (m_device!=other.m_device) return false;
+    if (m_drawCommandBuffer!=other.m_drawCommandBuffer) return false;
+    if (m_layout!=other.m_layout) return false;
+    if (m_numDraws!=other.m_numDraws) return false;
+    if (m_pipeline!=other.m_pipeline) return false;
+    return true;
+}
+
+bool Device::Cull::operator!=(const Cull &other) const noexcept
+{
+    return !(*this==other);
+}
+
+Device::Cull::~Cull() noexcept
+{
+    destroyBuffers();
+    if (m_pipeline!=VK_NULL_HANDLE)
+        vkDestroyPipeline(m_device, m_pipeline, nullptr);
+    if (m_layout!=VK_NULL_HANDLE)
+        vkDestroyPipelineLayout(m_device, m_layout, nullptr);
+    // Destroying the pool frees the descriptor set.
+    if (m_descriptorPool!=VK_NULL_HANDLE)
+        vkDestroyDescriptorPool(m_device, m_descriptorPool, nullptr);
+    if (m_descriptorSetLayout!=VK_NULL_HANDLE)
+        vkDestroyDescriptorSetLayout(m_device, m_descriptorSetLayout, nullptr);
+}
+
+} // namespace evk
@@ -1,5 +1,6 @@
 #include "descriptor.h"
 
+#include <algorithm>
 #include "evk_assert.h"
 
 namespace evk {
@@ -15,6 +16,7 @@ Descriptor& Descriptor::operator=(Descriptor &&other) noexcept
     m_attachments=other.m_attachments;
     m_bufferInfo=std::move(other.m_bufferInfo);
     m_device=other.m_device;
+    m_dynamicBindings=other.m_dynamicBindings;
     m_inputAttachmentInfo=std::move(other.m_inputAttachmentInfo);
     m_pool=other.m_pool;
     m_poolSizes=other.m_poolSizes;
@@ -34,6 +36,7 @@ void Descriptor::reset() noexcept
     m_attachments.resize(0);
     m_bufferInfo.resize(0);
     m_device=VK_NULL_HANDLE;
+    m_dynamicBindings.resize(0);
     m_inputAttachmentInfo.resize(0);
     m_pool=VK_NULL_HANDLE;
     m_poolSizes.resize(0);
@@ -56,10 +59,13 @@ Descriptor::Descriptor(
     m_writeSetVertex = std::vector<VkWriteDescriptorSet>();
     m_writeSetFragment = std::vector<VkWriteDescriptorSet>();
 
-    m_poolSizes.resize(3);
+    m_poolSizes.resize(6);
     initializePoolSize(Type::INPUT_ATTACHMENT);
     initializePoolSize(Type::TEXTURE_SAMPLER);
     initializePoolSize(Type::UNIFORM_BUFFER);
+    initializePoolSize(Type::UNIFORM_BUFFER_DYNAMIC);
+    initializePoolSize(Type::STORAGE_BUFFER);
+    initializePoolSize(Type::STORAGE_BUFFER_DYNAMIC);
 }
 
 void Descriptor::initializePoolSize(Type type) noexcept
@@ -202,13 +208,70 @@ void Descriptor::addUniformBuffer(
     const Buffer &buffer,
     const Shader::Stage stage) noexcept
 {
-    addDescriptorSetBinding(
-        Type::UNIFORM_BUFFER, binding, stage
+    addBuffer(
+        Type::UNIFORM_BUFFER, Type::UNIFORM_BUFFER_DYNAMIC, binding, buffer,
+        stage
     );
+}
+
+void Descriptor::addStorageBuffer(
+    const uint32_t binding,
+    const Buffer &buffer,
+    const Shader::Stage stage) noexcept
+{
+    addBuffer(
+        Type::STORAGE_BUFFER, Type::STORAGE_BUFFER_DYNAMIC, binding, buffer,
+        stage
+    );
+}
+
+void Descriptor::addBuffer(
+    Type type,
+    Type dynamicType,
+    uint32_t binding,
+    const Buffer &buffer,
+    Shader::Stage stage) noexcept
+{
+    if (buffer.m_numRegions==1)
+    {
+        addDescriptorSetBinding(type, binding, stage);
+        addWriteSetBuffer(
+            buffer.buffer(), buffer.size(), binding, descriptorType(type),
+            stage
+        );
+        return;
+    }
+
+    addDescriptorSetBinding(dynamicType, binding, stage);
     addWriteSetBuffer(
-        buffer.buffer(), buffer.size(), binding,
-        VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, stage
+        buffer.buffer(), buffer.size(), binding, descriptorType(dynamicType),
+        stage
     );
+
+    // Vertex bindings are in set 0 and fragment bindings in set 1.
+    DynamicBinding dynamicBinding;
+    dynamicBinding.set = stage==Shader::Stage::VERTEX ? 0 : 1;
+    dynamicBinding.binding = binding;
+    dynamicBinding.buffer = &buffer;
+    m_dynamicBindings.push_back(dynamicBinding);
+    std::sort(
+        m_dynamicBindings.begin(), m_dynamicBindings.end(),
+        [](const DynamicBinding &a, const DynamicBinding &b)
+        {
+            if (a.set!=b.set) return a.set<b.set;
+            return a.binding<b.binding;
+        }
+    );
+}
+
+std::vector<uint32_t> Descriptor::dynamicOffsets(
+    uint32_t imageIndex
+) const noexcept
+{
+    std::vector<uint32_t> offsets;
+    for (const auto &b : m_dynamicBindings)
+        offsets.push_back(b.buffer->dynamicOffset(imageIndex));
+    return offsets;
 }
 
 void Descriptor::addInputAttachment(
@@ -260,6 +323,12 @@ VkDescriptorType Descriptor::descriptorType(Type type) const noexcept
             return VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
         case Type::UNIFORM_BUFFER:
             return VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        case Type::UNIFORM_BUFFER_DYNAMIC:
+            return VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+        case Type::STORAGE_BUFFER:
+            return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        case Type::STORAGE_BUFFER_DYNAMIC:
+            return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
     }
 }
 
@@ -375,6 +444,11 @@ void Descriptor::addWriteSet(
                 m_writeSetVertex.resize(binding+1);
             m_writeSetVertex[binding]=writeSet;
             break;
+        case Shader::Stage::COMPUTE:
+            // Descriptors are bound to graphics Pipelines. The culling pass
+            // owns the compute descriptors.
+            EVK_ABORT("COMPUTE bindings are not supported by Descriptor.\n");
+            break;
     }
 }
 
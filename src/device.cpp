@@ -1,6 +1,9 @@
 #include "device.h"
 
+#include "buffer.h"
 #include "evk_assert.h"
+#include "pipeline.h"
+#include "shader.h"
 #include <set>
 
 namespace evk {
@@ -43,15 +46,31 @@ void Device::finishSetup(
 ) noexcept
 {
     m_device->finishSetup(windowFunc, windowExtensions);
-    m_swapchain=std::make_unique<Swapchain>(
-        m_device->m_device, m_device->m_physicalDevice, m_device->m_surface,
-        m_windowExtent, m_swapchainSize
+    m_pipelineCache=std::make_unique<PipelineCache>(
+        m_device->m_device, m_device->m_physicalDevice
+    );
+    if (m_device->m_surface!=VK_NULL_HANDLE)
+        m_swapchain=std::make_unique<Swapchain>(
+            m_device->m_device, m_device->m_physicalDevice,
+            m_device->m_surface, m_windowExtent, m_swapchainSize
+        );
+    else
+        m_offscreen=std::make_unique<Offscreen>(
+            m_device->m_device, m_device->m_physicalDevice, m_windowExtent,
+            m_swapchainSize
+        );
+    m_sync=std::make_unique<Sync>(
+        m_device->m_device, m_swapchainSize, m_maxFramesInFlight
     );
-    m_sync=std::make_unique<Sync>(m_device->m_device, m_swapchainSize);
     m_commands=std::make_unique<Commands>(m_device->m_device,
         m_device->m_physicalDevice, m_device->m_surface, m_swapchainSize,
         m_numThreads
     );
+    m_uploader=std::make_unique<Uploader>(
+        m_device->m_device, m_device->m_physicalDevice,
+        m_device->m_transferQueue, m_device->m_transferFamily,
+        m_device->m_graphicsFamily
+    );
 }
 
 void Device::createSurface(
@@ -65,6 +84,34 @@ void Device::createSurface(
     finishSetup(surfaceFunc, windowExtensions);
 }
 
+void Device::createHeadless(uint32_t width, uint32_t height) noexcept
+{
+    m_windowExtent = {width,height};
+    finishSetup([](){}, {});
+}
+
+void Device::setPipelineCacheFile(const std::string &fileName) noexcept
+{
+    EVK_ASSERT_TRUE(
+        m_pipelineCache!=nullptr,
+        "the pipeline cache file must be set after the surface is created"
+    );
+    m_pipelineCache->load(fileName);
+}
+
+void Device::buildPipelines(const std::vector<Pipeline*> &pipelines) noexcept
+{
+    std::vector<Pipeline*> deferred;
+    for (auto *p : pipelines)
+        if (p->m_pipeline==VK_NULL_HANDLE) deferred.push_back(p);
+
+    // Each Pipeline writes only its own handle, and the driver synchronises
+    // the shared cache.
+    m_threadPool.parallelFor(
+        deferred.size(), [&](int i){ deferred[i]->setup(); }
+    );
+}
+
 bool Device::operator==(const Device& other) const noexcept
 {
     if ((m_commands!=nullptr) && (other.m_commands!=nullptr))
@@ -73,6 +120,11 @@ bool Device::operator==(const Device& other) const noexcept
     if ((m_commands==nullptr) != (other.m_commands==nullptr))
         return false;
 
+    if ((m_cull!=nullptr) && (other.m_cull!=nullptr))
+        if (*m_cull.get() != *other.m_cull.get()) return false;
+
+    if ((m_cull==nullptr) != (other.m_cull==nullptr)) return false;
+
     if ((m_device!=nullptr) && (other.m_device!=nullptr))
         if (*m_device.get() != *other.m_device.get()) return false;
 
@@ -84,8 +136,29 @@ bool Device::operator==(const Device& other) const noexcept
     if ((m_framebuffer==nullptr) != (other.m_framebuffer==nullptr))
         return false;
     
+    if (m_maxFramesInFlight != other.m_maxFramesInFlight) return false;
+
     if (m_numThreads != other.m_numThreads) return false;
 
+    if ((m_offscreen!=nullptr) && (other.m_offscreen!=nullptr))
+        if (*m_offscreen.get() != *other.m_offscreen.get()) return false;
+
+    if ((m_offscreen==nullptr) != (other.m_offscreen==nullptr)) return false;
+
+    if ((m_pipelineCache!=nullptr) && (other.m_pipelineCache!=nullptr))
+        if (*m_pipelineCache.get() != *other.m_pipelineCache.get())
+            return false;
+
+    if ((m_pipelineCache==nullptr) != (other.m_pipelineCache==nullptr))
+        return false;
+
+    if ((m_readback!=nullptr) && (other.m_readback!=nullptr))
+        if (*m_readback.get() != *other.m_readback.get()) return false;
+
+    if ((m_readback==nullptr) != (other.m_readback==nullptr)) return false;
+
+    if (m_recordMode != other.m_recordMode) return false;
+
     if ((m_swapchain!=nullptr) && (other.m_swapchain!=nullptr))
         if (*m_swapchain.get() != *other.m_swapchain.get()) return false;
 
@@ -98,6 +171,11 @@ bool Device::operator==(const Device& other) const noexcept
 
     if ((m_sync==nullptr) != (other.m_sync==nullptr)) return false;
 
+    if ((m_uploader!=nullptr) && (other.m_uploader!=nullptr))
+        if (*m_uploader.get() != *other.m_uploader.get()) return false;
+
+    if ((m_uploader==nullptr) != (other.m_uploader==nullptr)) return false;
+
     return true;
 }
 
@@ -114,36 +192,82 @@ Device::Device(Device&& other) noexcept
 Device& Device::operator=(Device&& other) noexcept
 {
     if (*this == other) return *this;
+    EVK_ASSERT_TRUE(
+        other.m_numBuffers==0,
+        "a Device cannot be moved once Buffers have been created from it"
+    );
     m_device = std::move(other.m_device);
     m_commands = std::move(other.m_commands);
+    m_cull = std::move(other.m_cull);
+    m_currentFrame=other.m_currentFrame;
+    m_drawItems=other.m_drawItems;
+    m_drawPartitions=other.m_drawPartitions;
+    m_firstIndirectCommands=other.m_firstIndirectCommands;
     m_framebuffer = std::move(other.m_framebuffer);
+    m_frameValue=other.m_frameValue.load();
+    m_imageAcquired=other.m_imageAcquired;
+    m_imageIndex=other.m_imageIndex;
     m_indexBuffer=other.m_indexBuffer;
+    m_instanceBuffer=other.m_instanceBuffer;
+    m_maxFramesInFlight=other.m_maxFramesInFlight;
     m_numThreads = other.m_numThreads;
+    m_offscreen = std::move(other.m_offscreen);
+    m_pipelineCache = std::move(other.m_pipelineCache);
     m_pipelines=other.m_pipelines;
-    m_resizeRequired=other.m_resizeRequired;
+    m_readback = std::move(other.m_readback);
+    m_recordMode=other.m_recordMode;
+    m_recordTime=other.m_recordTime.load();
+    m_resizeRequired=other.m_resizeRequired.load();
+    m_staleRegions=other.m_staleRegions;
     m_swapchain = std::move(other.m_swapchain);
     m_swapchainSize=other.m_swapchainSize;
     m_sync = std::move(other.m_sync);
     m_threadPool = std::move(other.m_threadPool);
+    m_uploader = std::move(other.m_uploader);
     m_windowExtent=other.m_windowExtent;
-    m_vertexBuffer=other.m_vertexBuffer;
+    m_vertexStreams=other.m_vertexStreams;
     other.reset();
     return *this;
 }
 
+Device::~Device() noexcept
+{
+    // Frames may still be in flight, so wait before the swapchain, sync
+    // objects and command buffers they use are destroyed.
+    wait();
+}
+
 void Device::reset() noexcept
 {
     m_device=nullptr;
     m_commands=nullptr;
+    m_cull=nullptr;
+    m_currentFrame=0;
+    m_drawItems.resize(0);
+    m_drawPartitions.resize(0);
+    m_firstIndirectCommands.resize(0);
     m_framebuffer=nullptr;
+    m_frameValue=0;
+    m_imageAcquired=false;
+    m_imageIndex=0;
     m_indexBuffer=nullptr;
+    m_instanceBuffer=nullptr;
+    m_maxFramesInFlight=2;
     m_numThreads=1;
+    m_offscreen=nullptr;
+    m_pipelineCache=nullptr;
     m_pipelines.resize(0);
+    m_readback=nullptr;
+    m_recordMode=RecordMode::STATIC;
+    m_recordTime=0.0f;
+    m_resizeRequired=false;
+    m_staleRegions.resize(0);
     m_swapchain = nullptr;
     m_swapchainSize=0;
     m_sync = nullptr;
+    m_uploader = nullptr;
     m_windowExtent={};
-    m_vertexBuffer=nullptr;
+    m_vertexStreams.resize(0);
 }
 
 void Device::resizeRequired() noexcept
@@ -151,6 +275,150 @@ void Device::resizeRequired() noexcept
     m_resizeRequired=true;
 }
 
+void Device::setMaxFramesInFlight(uint32_t maxFramesInFlight) noexcept
+{
+    EVK_ASSERT_TRUE(
+        maxFramesInFlight>0, "max frames in flight must be at least 1"
+    );
+    std::lock_guard<std::mutex> lock(m_drawMutex);
+    EVK_ASSERT_TRUE(
+        !m_imageAcquired, "frames in flight cannot change while an image is acquired"
+    );
+    m_maxFramesInFlight=maxFramesInFlight;
+
+    // The sync objects are created when the surface is. If that has already
+    // happened, rebuild them once the GPU has finished with the old ones.
+    if (m_sync==nullptr) return;
+    vkDeviceWaitIdle(device());
+    m_uploader->releaseUpdates();
+    m_sync=std::make_unique<Sync>(
+        device(), m_swapchainSize, m_maxFramesInFlight
+    );
+    m_currentFrame=0;
+    if (m_readback!=nullptr)
+        m_readback->recreate(m_maxFramesInFlight, extent());
+
+    if (m_recordMode==RecordMode::PER_FRAME && !m_pipelines.empty())
+    {
+        const auto &subpasses = m_pipelines[0]->renderpass()->subpasses();
+        m_commands->allocateFrames(m_maxFramesInFlight, subpasses.size());
+    }
+}
+
+void Device::setReadback(const ReadbackFunc &callback) noexcept
+{
+    std::lock_guard<std::mutex> lock(m_drawMutex);
+    EVK_ASSERT_TRUE(
+        m_sync!=nullptr, "readback must be set after the surface is created"
+    );
+    // Frames already copied go to the previous callback.
+    if (m_readback!=nullptr)
+    {
+        vkDeviceWaitIdle(device());
+        m_readback->deliverUpTo(UINT64_MAX);
+        m_readback=nullptr;
+    }
+    if (!callback) return;
+    EVK_ASSERT_TRUE(
+        headless() || (m_swapchain->m_usage & VK_IMAGE_USAGE_TRANSFER_SRC_BIT),
+        "swapchain images cannot be copied from on this surface"
+    );
+    m_readback=std::make_unique<Readback>(
+        device(), physicalDevice(), m_device->m_graphicsFamily,
+        maxFramesInFlight(), extent(), callback
+    );
+}
+
+void Device::setRecordMode(RecordMode recordMode) noexcept
+{
+    std::lock_guard<std::mutex> lock(m_drawMutex);
+    if (recordMode==m_recordMode) return;
+    m_recordMode=recordMode;
+
+    // Nothing has been recorded before finalize().
+    if (m_pipelines.empty()) return;
+    vkDeviceWaitIdle(device());
+    const auto &subpasses = m_pipelines[0]->renderpass()->subpasses();
+    if (m_recordMode==RecordMode::PER_FRAME)
+    {
+        m_commands->freeSecondaries();
+        m_commands->allocateFrames(maxFramesInFlight(), subpasses.size());
+    }
+    else
+    {
+        m_commands->destroyFrames();
+        m_commands->allocateSecondaries(subpasses.size());
+        record();
+    }
+}
+
+void Device::setDrawItems(const std::vector<DrawItem> &drawItems) noexcept
+{
+    std::lock_guard<std::mutex> lock(m_drawMutex);
+    m_drawItems=drawItems;
+
+    // Before finalize() the partition is made there. Afterwards the indirect
+    // commands may still be in use by the GPU.
+    if (m_pipelines.empty()) return;
+    vkDeviceWaitIdle(device());
+    partition();
+    if (m_recordMode==RecordMode::STATIC) record();
+}
+
+size_t Device::addMesh(
+    uint32_t firstIndex,
+    uint32_t numIndices,
+    int32_t vertexOffset
+) noexcept
+{
+    std::lock_guard<std::mutex> lock(m_drawMutex);
+    EVK_ASSERT_TRUE(
+        m_pipelines.empty(), "meshes must be added before finalize()"
+    );
+    DrawItem drawItem;
+    drawItem.firstIndex=firstIndex;
+    drawItem.numIndices=numIndices;
+    drawItem.vertexOffset=vertexOffset;
+    m_drawItems.push_back(drawItem);
+    return m_drawItems.size()-1;
+}
+
+void Device::setCulling(
+    const Shader &computeShader,
+    const DynamicBuffer &camera,
+    const std::vector<BoundingSphere> &boundingSpheres
+) noexcept
+{
+    std::lock_guard<std::mutex> lock(m_drawMutex);
+    EVK_ASSERT_TRUE(
+        m_pipelines.empty(), "culling must be set before finalize()"
+    );
+    m_cull=std::make_unique<Cull>(
+        device(), physicalDevice(), pipelineCache(),
+        computeShader.createInfo(), camera, boundingSpheres
+    );
+}
+
+internal::MemoryStats Device::memoryStats() const noexcept
+{
+    return internal::Allocator::get(device(), physicalDevice()).stats();
+}
+
+uint64_t Device::flushUploads() noexcept
+{
+    return m_uploader->flush();
+}
+
+bool Device::uploadComplete(uint64_t value) const noexcept
+{
+    return m_uploader->completedValue()>=value;
+}
+
+void Device::waitForUploads(uint64_t value) noexcept
+{
+    m_uploader->wait(value);
+}
+
 Device::_Device::_Device(
     const std::vector<const char*> &validationLayers,
     const std::vector<const char *> &deviceExtensions
@@ -185,12 +453,18 @@ Device::_Device& Device::_Device::operator=(_Device&& other) noexcept
     m_depthFormat=other.m_depthFormat;
     m_device=other.m_device;
     m_deviceExtensions=other.m_deviceExtensions;
+    m_drawIndirectFirstInstance=other.m_drawIndirectFirstInstance;
+    m_graphicsFamily=other.m_graphicsFamily;
     m_graphicsQueue=other.m_graphicsQueue;
     m_instance=other.m_instance;
+    m_maxDrawIndirectCount=other.m_maxDrawIndirectCount;
+    m_multiDrawIndirect=other.m_multiDrawIndirect;
     m_surface=other.m_surface;
     m_physicalDevice=other.m_physicalDevice;
     m_presentQueue=other.m_presentQueue;
     m_surface=other.m_surface;
+    m_transferFamily=other.m_transferFamily;
+    m_transferQueue=other.m_transferQueue;
     m_validationLayers=other.m_validationLayers;
     m_windowExtensions=other.m_windowExtensions;
     other.reset();
@@ -203,19 +477,29 @@ void Device::_Device::reset() noexcept
     m_depthFormat={};
     m_device=VK_NULL_HANDLE;
     m_deviceExtensions={};
+    m_drawIndirectFirstInstance=false;
+    m_graphicsFamily=0;
     m_graphicsQueue=VK_NULL_HANDLE;
     m_instance=VK_NULL_HANDLE;
+    m_maxDrawIndirectCount=1;
+    m_multiDrawIndirect=false;
     m_surface=VK_NULL_HANDLE;
     m_physicalDevice=VK_NULL_HANDLE;
     m_presentQueue=VK_NULL_HANDLE;
     m_surface=VK_NULL_HANDLE;
+    m_transferFamily=0;
+    m_transferQueue=VK_NULL_HANDLE;
     m_validationLayers={};
     m_windowExtensions={};
 }
 
 Device::_Device::~_Device() noexcept
 {
-    if (m_device!=VK_NULL_HANDLE) vkDestroyDevice(m_device, nullptr);
+    if (m_device!=VK_NULL_HANDLE)
+    {
+        internal::Allocator::destroy(m_device);
+        vkDestroyDevice(m_device, nullptr);
+    }
     if (m_debugMessenger!=VK_NULL_HANDLE)
         destroyDebugUtilsMessengerEXT(m_instance, m_debugMessenger, nullptr);
     if (m_surface!=VK_NULL_HANDLE)
@@ -233,6 +517,7 @@ bool Device::_Device::operator==(const _Device &other) const noexcept
     if (m_physicalDevice!=other.m_physicalDevice)return false;
     if (m_presentQueue!=other.m_presentQueue)return false;
     if (m_surface!=other.m_surface)return false;
+    if (m_transferQueue!=other.m_transferQueue)return false;
     return true;
 }
 
@@ -317,15 +602,26 @@ void Device::_Device::pickPhysicalDevice() noexcept
 
 void Device::_Device::createDevice() noexcept
 {
-    internal::QueueFamilyIndices indices = getQueueFamilies(
+    internal::QueueFamilyIndices indices = internal::findQueueFamilies(
         m_physicalDevice, m_surface
     );
 
+    // Without a transfer-only family, uploads share the graphics queue.
+    m_graphicsFamily = indices.graphicsFamily;
+    m_transferFamily = indices.graphicsFamily;
+    if (indices.transferFamily>=0) m_transferFamily = indices.transferFamily;
+
     std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
     std::set<uint32_t> uniqueQueueFamilies = {
         static_cast<uint32_t>(indices.graphicsFamily),
-        static_cast<uint32_t>(indices.presentFamily)
+        m_transferFamily
     };
+    // A headless device has no present queue.
+    const bool present = indices.presentFamily>=0;
+    if (present)
+        uniqueQueueFamilies.insert(
+            static_cast<uint32_t>(indices.presentFamily)
+        );
 
     float queuePriority = 1.0f;
     for (uint32_t queueFamily : uniqueQueueFamilies) {
@@ -337,8 +633,22 @@ void Device::_Device::createDevice() noexcept
         queueCreateInfos.push_back(queueCreateInfo);
     }
 
+    // Batching many draws into one indirect draw is optional.
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(m_physicalDevice, &supportedFeatures);
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(m_physicalDevice, &properties);
+    m_multiDrawIndirect=supportedFeatures.multiDrawIndirect==VK_TRUE;
+    m_maxDrawIndirectCount=properties.limits.maxDrawIndirectCount;
+    // Instanced draw items start at their own instance.
+    m_drawIndirectFirstInstance=
+        supportedFeatures.drawIndirectFirstInstance==VK_TRUE;
+
     VkPhysicalDeviceFeatures deviceFeatures = {};
     deviceFeatures.samplerAnisotropy=VK_TRUE;
+    deviceFeatures.multiDrawIndirect=supportedFeatures.multiDrawIndirect;
+    deviceFeatures.drawIndirectFirstInstance=
+        supportedFeatures.drawIndirectFirstInstance;
 
     VkDeviceCreateInfo createInfo = {};
     createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -362,7 +672,9 @@ void Device::_Device::createDevice() noexcept
     EVK_ASSERT(result, "failed to create logical device.");
 
     vkGetDeviceQueue(m_device, indices.graphicsFamily, 0, &m_graphicsQueue);
-    vkGetDeviceQueue(m_device, indices.presentFamily, 0, &m_presentQueue);
+    if (present)
+        vkGetDeviceQueue(m_device, indices.presentFamily, 0, &m_presentQueue);
+    vkGetDeviceQueue(m_device, m_transferFamily, 0, &m_transferQueue);
 }
 
 VkResult Device::_Device::createDebugUtilsMessengerEXT(
@@ -417,8 +729,13 @@ bool Device::_Device::isDeviceSuitable(
         device, deviceExtensions
     );
 
-    bool swapChainAdequate = false;
-    if (extensionsSupported)
+    // Without a surface, only drawing is needed.
+    const bool headless = surface==VK_NULL_HANDLE;
+    const bool queuesComplete = headless ?
+        indices.graphicsFamily>=0 : indices.isComplete();
+
+    bool swapChainAdequate = headless;
+    if (extensionsSupported && !headless)
     {
         internal::SwapChainSupportDetails swapChainSupport =
             internal::querySwapChainSupport(device, surface);
@@ -429,7 +746,7 @@ bool Device::_Device::isDeviceSuitable(
     VkPhysicalDeviceFeatures supportedFeatures;
     vkGetPhysicalDeviceFeatures(device, &supportedFeatures);
 
-    return indices.isComplete() && extensionsSupported
+    return queuesComplete && extensionsSupported
         && swapChainAdequate && supportedFeatures.samplerAnisotropy;
 }
 
@@ -487,45 +804,6 @@ void Device::_Device::debugMessengerCreateInfo(
     createInfo.pUserData = nullptr;
 }
 
-internal::QueueFamilyIndices Device::_Device::getQueueFamilies(
-    VkPhysicalDevice device,
-    VkSurfaceKHR surface
-) noexcept
-{
-    internal::QueueFamilyIndices indices;
-
-    uint32_t queueFamilyCount = 0;
-    vkGetPhysicalDeviceQueueFamilyProperties(
-        device, &queueFamilyCount, nullptr
-    );
-    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-    vkGetPhysicalDeviceQueueFamilyProperties(
-        device, &queueFamilyCount, queueFamilies.data()
-    );
-
-    int i = 0;
-    for (const auto& queueFamily : queueFamilies)
-    {
-        if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
-        {
-            indices.graphicsFamily = i;
-
-            VkBool32 presentSupport = false;
-            vkGetPhysicalDeviceSurfaceSupportKHR(
-                device, i, surface, &presentSupport
-            );
-            if (presentSupport) indices.presentFamily = i;
-        }
-        if (indices.isComplete())
-        {
-            break;
-        }
-        i++;
-    }
-
-    return indices;
-}
-
 VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
     VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
     VkDebugUtilsMessageTypeFlagsEXT messageType,
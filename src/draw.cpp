@@ -3,39 +3,53 @@
 #include "buffer.h"
 #include "evk_assert.h"
 #include "pipeline.h"
+#include "vertexinput.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 
 namespace evk {
 
-void Device::draw() noexcept
+namespace {
+// The cost of recording one draw, in indices. Recording cost is dominated by
+// the number of draws, while index count, times the number of instances,
+// only matters for large items.
+const uint64_t DRAW_COST = 256;
+} // namespace
+
+bool Device::acquire() noexcept
 {
-    static size_t currentFrame=0;
-    static int previousImageIndex=-1;
+    if (m_imageAcquired) return true;
+
+    auto &currentFrame = m_currentFrame;
     const auto &device = this->device();
-    auto &frameFences = this->frameFences();
-    auto &imageFences = this->imageFences();
-    const auto &imageSemaphores = imageSempahores();
-    const auto &renderSemaphores = renderSempahores();
-    auto &frameFence = frameFences[currentFrame];
+    auto &frameFence = frameFences()[currentFrame];
 
     vkWaitForFences(device, 1, &frameFence, VK_TRUE, UINT64_MAX);
+    if (m_readback!=nullptr) m_readback->deliver(currentFrame);
 
-    uint32_t imageIndex;
-    VkResult result = vkAcquireNextImageKHR(
-        device, m_swapchain->m_swapchain, UINT64_MAX,
-        imageSemaphores[currentFrame],
-        VK_NULL_HANDLE, &imageIndex
-    );
+    // Offscreen images are drawn in turn, with no semaphore to wait on.
+    if (headless()) m_imageIndex = m_offscreen->acquire();
+    else
+    {
+        VkResult result = vkAcquireNextImageKHR(
+            device, m_swapchain->m_swapchain, UINT64_MAX,
+            imageSempahores()[currentFrame],
+            VK_NULL_HANDLE, &m_imageIndex
+        );
 
-    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
-        resizeWindow();
-        currentFrame = 0;
-        return;
+        if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+            resizeWindow();
+            currentFrame = 0;
+            return false;
+        }
+        EVK_ASSERT_IMAGE_VALID(result, "failed to acquire swap chain image");
     }
-    EVK_ASSERT_IMAGE_VALID(result, "failed to acquire swap chain image");
 
-    auto &imageFence = imageFences[imageIndex];
+    auto &imageFence = imageFences()[m_imageIndex];
 
     // Check if a previous frame is using this image. If so, wait on its fence.
+    // Once it has finished, the image's regions of ring buffers are free too.
     if (imageFence != VK_NULL_HANDLE)
     {
         vkWaitForFences(device, 1, &(imageFence), VK_TRUE, UINT64_MAX);
@@ -43,29 +57,166 @@ void Device::draw() noexcept
 
     // Mark the image as being in use.
     imageFence = frameFence;
+    m_imageAcquired = true;
+    refreshRegions(m_imageIndex);
+    return true;
+}
 
-    const auto &primaryCommandBuffers = this->primaryCommandBuffers();
+void Device::writeRegions(
+    VkBuffer buffer,
+    unsigned char *regions,
+    uint32_t numRegions,
+    VkDeviceSize stride,
+    VkDeviceSize size,
+    const void *data
+) noexcept
+{
+    std::lock_guard<std::mutex> lock(m_drawMutex);
+    // Nothing has been submitted before finalize().
+    const bool acquired = m_sync!=nullptr && !m_pipelines.empty() && acquire();
+    auto found = std::find_if(
+        m_staleRegions.begin(), m_staleRegions.end(),
+        [buffer](const StaleRegions &s){ return s.buffer==buffer; }
+    );
+    if (found!=m_staleRegions.end()) m_staleRegions.erase(found);
+
+    // Nothing is in flight, so every region is written.
+    if (!acquired)
+    {
+        for (uint32_t i = 0; i < numRegions; ++i)
+            memcpy(regions+i*stride, data, size);
+        return;
+    }
 
+    StaleRegions stale;
+    stale.buffer=buffer;
+    stale.regions=regions;
+    stale.stride=stride;
+    stale.size=size;
+    stale.latest=m_imageIndex%numRegions;
+    stale.stale.assign(numRegions, true);
+    stale.stale[stale.latest]=false;
+    memcpy(regions+stale.latest*stride, data, size);
+    m_staleRegions.push_back(stale);
+}
+
+void Device::refreshRegions(uint32_t imageIndex) noexcept
+{
+    // The GPU only reads the latest region, so it is copied from on the host.
+    for (auto &stale : m_staleRegions)
+    {
+        const uint32_t region = imageIndex%stale.stale.size();
+        if (!stale.stale[region]) continue;
+        memcpy(
+            stale.regions+region*stale.stride,
+            stale.regions+stale.latest*stale.stride, stale.size
+        );
+        stale.stale[region]=false;
+    }
+    auto upToDate = [](const StaleRegions &s)
+    {
+        return std::none_of(s.stale.begin(), s.stale.end(), [](bool b){ return b; });
+    };
+    m_staleRegions.erase(
+        std::remove_if(m_staleRegions.begin(), m_staleRegions.end(), upToDate),
+        m_staleRegions.end()
+    );
+}
+
+void Device::releaseRegions(VkBuffer buffer) noexcept
+{
+    std::lock_guard<std::mutex> lock(m_drawMutex);
+    m_staleRegions.erase(
+        std::remove_if(
+            m_staleRegions.begin(), m_staleRegions.end(),
+            [buffer](const StaleRegions &s){ return s.buffer==buffer; }
+        ),
+        m_staleRegions.end()
+    );
+}
+
+void Device::draw() noexcept
+{
+    std::lock_guard<std::mutex> lock(m_drawMutex);
+    auto &currentFrame = m_currentFrame;
+    const auto &device = this->device();
+    const auto &imageSemaphores = imageSempahores();
+    const auto &renderSemaphores = renderSempahores();
+    auto &frameFence = frameFences()[currentFrame];
+
+    // The image may already have been acquired by a DynamicBuffer update.
+    if (!acquire()) return;
+    const uint32_t imageIndex = m_imageIndex;
+    m_imageAcquired = false;
+
+    // Static command buffers are recorded per swapchain image, so submit the
+    // one that targets the acquired image's framebuffer. The image fence
+    // above guarantees it is no longer pending from an earlier frame.
+    // Per-frame command buffers are recorded now; the frame fence guarantees
+    // the frame's command pools are idle.
+    VkCommandBuffer primaryCommandBuffer;
+    if (m_recordMode==RecordMode::PER_FRAME)
+    {
+        const auto recordStart = std::chrono::steady_clock::now();
+        recordFrame(currentFrame, imageIndex);
+        m_recordTime = std::chrono::duration<float,std::milli>(
+            std::chrono::steady_clock::now() - recordStart
+        ).count();
+        primaryCommandBuffer = framePrimaryCommandBuffer(currentFrame);
+    }
+    else primaryCommandBuffer = primaryCommandBuffers()[imageIndex];
+
+    // StaticBuffer updates are copied ahead of the frame's draws.
+    std::vector<VkCommandBuffer> commandBuffers;
+    VkCommandBuffer updateCommandBuffer =
+        m_uploader->recordUpdates(currentFrame);
+    if (updateCommandBuffer!=VK_NULL_HANDLE)
+        commandBuffers.push_back(updateCommandBuffer);
+    commandBuffers.push_back(primaryCommandBuffer);
+
+    // The frame's image is copied for readback once it has been drawn.
+    if (m_readback!=nullptr)
+    {
+        const bool headless = this->headless();
+        const VkImage image = headless ?
+            m_offscreen->m_images[imageIndex] : m_swapchain->m_images[imageIndex];
+        const VkImageLayout layout = headless ?
+            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        commandBuffers.push_back(
+            m_readback->record(currentFrame, image, layout, m_frameValue+1)
+        );
+    }
+
+    // A headless frame is only tracked by its fence.
+    const uint32_t numSemaphores = headless() ? 0 : 1;
     VkSubmitInfo submitInfo = {};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     VkSemaphore waitSemaphores[] = {imageSemaphores[currentFrame]};
     VkPipelineStageFlags waitStages[] = {
         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
     };
-    submitInfo.waitSemaphoreCount = 1;
+    submitInfo.waitSemaphoreCount = numSemaphores;
     submitInfo.pWaitSemaphores = waitSemaphores;
     submitInfo.pWaitDstStageMask = waitStages;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &primaryCommandBuffers[currentFrame];
+    submitInfo.commandBufferCount = commandBuffers.size();
+    submitInfo.pCommandBuffers = commandBuffers.data();
 
     VkSemaphore signalSemaphores[] = {(renderSemaphores)[currentFrame]};
-    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.signalSemaphoreCount = numSemaphores;
     submitInfo.pSignalSemaphores = signalSemaphores;
 
     vkResetFences(device, 1, &frameFence);
 
-    result = vkQueueSubmit(graphicsQueue(), 1, &submitInfo, frameFence);
+    VkResult result = vkQueueSubmit(graphicsQueue(), 1, &submitInfo, frameFence);
     EVK_ASSERT(result,"failed to submit draw command buffer");
+    m_sync->m_frameValues[currentFrame] = ++m_frameValue;
+
+    if (headless())
+    {
+        m_offscreen->m_frameValues[imageIndex] = m_frameValue;
+        currentFrame = ((currentFrame)+1) % maxFramesInFlight();
+        return;
+    }
 
     VkPresentInfoKHR presentInfo = {};
     presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -84,161 +235,568 @@ void Device::draw() noexcept
         m_resizeRequired = false;
         resizeWindow();
     }
-    else currentFrame = ((currentFrame)+1) % swapchainSize();
-    
+    else currentFrame = ((currentFrame)+1) % maxFramesInFlight();
+
+    // Throttling is done by the frame fences alone; the host only blocks once
+    // maxFramesInFlight frames are queued on the GPU.
     EVK_EXPECT_PRESENT_VALID(
         result, "failed to present swap chain image"
     );
+}
+
+bool Device::frameComplete(uint64_t value) noexcept
+{
+    std::lock_guard<std::mutex> lock(m_drawMutex);
+    if (value>m_frameValue) return false;
+    if (m_sync==nullptr) return true;
+
+    // Frames that are no longer held by a fence have been waited on.
+    const auto &frameValues = m_sync->m_frameValues;
+    for (size_t frame = 0; frame < frameValues.size(); ++frame)
+    {
+        if (frameValues[frame]==0 || frameValues[frame]>value) continue;
+        if (vkGetFenceStatus(device(), frameFences()[frame])!=VK_SUCCESS)
+            return false;
+    }
+    return true;
+}
+
+void Device::waitForFrame(uint64_t value) noexcept
+{
+    std::lock_guard<std::mutex> lock(m_drawMutex);
+    waitFrame(value);
+}
+
+void Device::wait() noexcept
+{
+    std::lock_guard<std::mutex> lock(m_drawMutex);
+    if (m_device==nullptr || device()==VK_NULL_HANDLE) return;
+    vkDeviceWaitIdle(device());
+}
 
-    vkQueueWaitIdle(presentQueue);
+void Device::waitFrame(uint64_t value) noexcept
+{
+    if (m_sync==nullptr) return;
+    std::vector<VkFence> fences;
+    const auto &frameValues = m_sync->m_frameValues;
+    for (size_t frame = 0; frame < frameValues.size(); ++frame)
+    {
+        if (frameValues[frame]==0 || frameValues[frame]>value) continue;
+        fences.push_back(frameFences()[frame]);
+    }
+    if (fences.empty()) return;
+    vkWaitForFences(
+        device(), fences.size(), fences.data(), VK_TRUE, UINT64_MAX
+    );
+    if (m_readback!=nullptr) m_readback->deliverUpTo(value);
+}
+
+bool Device::readFrame(uint64_t value, void *pixels) noexcept
+{
+    std::lock_guard<std::mutex> lock(m_drawMutex);
+    if (!headless() || value==0) return false;
+    const auto &imageValues = m_offscreen->m_frameValues;
+    const auto it = std::find(imageValues.begin(), imageValues.end(), value);
+    if (it==imageValues.end()) return false;
+    const VkImage image = m_offscreen->m_images[it-imageValues.begin()];
+    waitFrame(value);
+
+    const VkExtent2D extent = m_offscreen->m_extent;
+    const VkDeviceSize size = VkDeviceSize(extent.width)*extent.height*4;
+    VkBuffer buffer;
+    internal::Allocation memory;
+    internal::createBuffer(
+        device(), physicalDevice(), size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        &buffer, &memory
+    );
+
+    const VkCommandPool commandPool = commandPools()[0];
+    VkCommandBuffer commandBuffer;
+    internal::beginSingleTimeCommands(device(), commandPool, &commandBuffer);
+
+    // The render pass left the image in TRANSFER_SRC_OPTIMAL.
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(
+        commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier
+    );
+
+    VkBufferImageCopy region = {};
+    region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    region.imageExtent = {extent.width, extent.height, 1};
+    vkCmdCopyImageToBuffer(
+        commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buffer, 1,
+        &region
+    );
+
+    VkMemoryBarrier hostBarrier = {};
+    hostBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(
+        commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &hostBarrier, 0, nullptr, 0, nullptr
+    );
+    internal::endSingleTimeCommands(
+        device(), graphicsQueue(), commandPool, commandBuffer
+    );
+
+    memcpy(pixels, memory.data, size);
+    vkDestroyBuffer(device(), buffer, nullptr);
+    internal::freeMemory(memory);
+    return true;
 }
 
 void Device::finalize(
     Buffer &indexBuffer,
     Buffer &vertexBuffer,
+    Buffer &instanceBuffer,
     std::vector<Pipeline*> &pipelines
 ) noexcept
 {
+    m_instanceBuffer=&instanceBuffer;
+    finalize(indexBuffer, vertexBuffer, pipelines);
+}
+
+void Device::finalize(
+    Buffer &indexBuffer,
+    Buffer &vertexBuffer,
+    std::vector<Pipeline*> &pipelines
+) noexcept
+{
+    finalize(indexBuffer, std::vector<Buffer*>{&vertexBuffer}, pipelines);
+}
+
+void Device::finalize(
+    Buffer &indexBuffer,
+    const std::vector<Buffer*> &vertexStreams,
+    Buffer &instanceBuffer,
+    std::vector<Pipeline*> &pipelines
+) noexcept
+{
+    m_instanceBuffer=&instanceBuffer;
+    finalize(indexBuffer, vertexStreams, pipelines);
+}
+
+void Device::finalize(
+    Buffer &indexBuffer,
+    const std::vector<Buffer*> &vertexStreams,
+    std::vector<Pipeline*> &pipelines
+) noexcept
+{
+    EVK_ASSERT_TRUE(!vertexStreams.empty(), "there must be a vertex stream\n");
+
+    // The first draw reads every buffer and texture.
+    waitForUploads(flushUploads());
+    buildPipelines(pipelines);
+
     auto renderpass=pipelines[0]->renderpass();
     m_framebuffer = std::make_unique<Framebuffer>(
         *this, *renderpass
     );
 
     m_indexBuffer=&indexBuffer;
-    m_vertexBuffer=&vertexBuffer;
+    m_vertexStreams=vertexStreams;
     m_pipelines=pipelines;
 
-    record();
+    std::lock_guard<std::mutex> lock(m_drawMutex);
+    partition();
+    const auto numSubpasses = renderpass->subpasses().size();
+    if (m_recordMode==RecordMode::PER_FRAME)
+        m_commands->allocateFrames(maxFramesInFlight(), numSubpasses);
+    else
+    {
+        m_commands->allocateSecondaries(numSubpasses);
+        record();
+    }
+}
+
+void Device::partition() noexcept
+{
+    if (m_drawItems.empty())
+    {
+        DrawItem drawItem;
+        drawItem.numIndices=m_indexBuffer->numElements();
+        if (m_instanceBuffer!=nullptr)
+            drawItem.numInstances=m_instanceBuffer->numElements();
+        m_drawPartitions=partitionDrawItems({drawItem}, numThreads());
+    }
+    else m_drawPartitions=partitionDrawItems(m_drawItems, numThreads());
+
+    // Indirect draws can only start at a non-zero instance when the device
+    // supports drawIndirectFirstInstance.
+    bool firstInstance=false;
+    for (const auto &part : m_drawPartitions)
+        for (const auto &drawItem : part)
+            if (drawItem.firstInstance!=0) firstInstance=true;
+    const bool indirectFirstInstance =
+        !firstInstance || m_device->m_drawIndirectFirstInstance;
+    EVK_ASSERT_TRUE(
+        m_cull==nullptr || indirectFirstInstance,
+        "culling instanced draw items requires drawIndirectFirstInstance"
+    );
+
+    // Lay each thread's items out contiguously as indirect commands, so a
+    // thread can issue all of its draws at once. Culling writes the commands
+    // on the GPU, so it always draws indirectly.
+    m_firstIndirectCommands.resize(0);
+    if ((!m_device->m_multiDrawIndirect || !indirectFirstInstance) &&
+        m_cull==nullptr)
+    {
+        m_commands->destroyIndirectCommands();
+        return;
+    }
+    std::vector<VkDrawIndexedIndirectCommand> commands;
+    for (const auto &part : m_drawPartitions)
+    {
+        m_firstIndirectCommands.push_back(commands.size());
+        for (const auto &drawItem : part)
+        {
+            VkDrawIndexedIndirectCommand command = {};
+            command.indexCount=drawItem.numIndices;
+            command.instanceCount=drawItem.numInstances;
+            command.firstIndex=drawItem.firstIndex;
+            command.vertexOffset=drawItem.vertexOffset;
+            command.firstInstance=drawItem.firstInstance;
+            commands.push_back(command);
+        }
+    }
+    m_commands->writeIndirectCommands(commands);
+
+    if (m_cull!=nullptr)
+    {
+        if (m_drawItems.empty())
+            m_cull->update(
+                std::vector<uint32_t>(commands.size(), 0),
+                m_commands->m_indirectBuffer
+            );
+        else
+            m_cull->update(
+                drawItemIndices(m_drawItems, m_drawPartitions),
+                m_commands->m_indirectBuffer
+            );
+    }
+}
+
+std::vector<uint32_t> Device::drawItemIndices(
+    const std::vector<DrawItem> &drawItems,
+    const std::vector<std::vector<DrawItem>> &parts
+) noexcept
+{
+    // The parts hold the items in order, with split items as consecutive
+    // pieces, so the pieces of item i add up to its index count.
+    std::vector<uint32_t> indices;
+    size_t item=0;
+    uint32_t remaining=drawItems.empty() ? 0 : drawItems[0].numIndices;
+    for (const auto &part : parts)
+    {
+        for (const auto &drawItem : part)
+        {
+            while (remaining==0) remaining=drawItems[++item].numIndices;
+            indices.push_back(item);
+            remaining-=drawItem.numIndices;
+        }
+    }
+    return indices;
+}
+
+std::vector<std::vector<Device::DrawItem>> Device::partitionDrawItems(
+    const std::vector<DrawItem> &drawItems,
+    size_t numParts
+) noexcept
+{
+    std::vector<std::vector<DrawItem>> parts(numParts);
+    if (numParts==0) return parts;
+
+    // Each index of an item costs once per instance.
+    auto weight = [](const DrawItem &item) -> uint64_t
+    {
+        return std::max<uint32_t>(item.numInstances, 1);
+    };
+    uint64_t totalCost=0;
+    for (const auto &item : drawItems)
+        totalCost+=DRAW_COST+item.numIndices*weight(item);
+    const uint64_t targetCost=totalCost/numParts;
+
+    // Items are dealt in order, so each part is a contiguous run of the index
+    // buffer. Part p ends once the running cost reaches its share of the
+    // total. An item smaller than a share goes to the part holding most of
+    // it; a larger item is split on triangle boundaries.
+    size_t part=0;
+    uint64_t cost=0;
+    for (const auto &item : drawItems)
+    {
+        DrawItem remaining=item;
+        const uint64_t indexCost=weight(item);
+        cost+=DRAW_COST;
+        while (remaining.numIndices>0)
+        {
+            const uint64_t boundary=totalCost*(part+1)/numParts;
+            const uint64_t remainingCost=remaining.numIndices*indexCost;
+            if (part+1==numParts || cost+remainingCost<=boundary)
+            {
+                parts[part].push_back(remaining);
+                cost+=remainingCost;
+                break;
+            }
+            if (remainingCost<targetCost)
+            {
+                if (cost+remainingCost/2<=boundary)
+                {
+                    parts[part].push_back(remaining);
+                    cost+=remainingCost;
+                    remaining.numIndices=0;
+                }
+                ++part;
+                continue;
+            }
+            const uint32_t numIndices=boundary>cost ?
+                static_cast<uint32_t>((boundary-cost)/indexCost)/3*3 : 0;
+            if (numIndices>0)
+            {
+                DrawItem piece=remaining;
+                piece.numIndices=numIndices;
+                parts[part].push_back(piece);
+                remaining.firstIndex+=numIndices;
+                remaining.numIndices-=numIndices;
+                cost+=numIndices*indexCost;
+            }
+            ++part;
+        }
+    }
+    return parts;
 }
 
 void Device::record() noexcept
 {
     const auto &primaryCommandBuffers = this->primaryCommandBuffers();
-    auto secondaryCommandBuffers = this->secondaryCommandBuffers();
-    const auto &commandPools = this->commandPools();
+
+    for (uint32_t imageIndex = 0; imageIndex < this->swapchainSize(); ++imageIndex)
+    {
+        recordCommandBuffers(
+            primaryCommandBuffers[imageIndex],
+            secondaryCommandBuffers(imageIndex),
+            imageIndex,
+            0
+        );
+    }
+}
+
+void Device::recordFrame(size_t frame, uint32_t imageIndex) noexcept
+{
+    for (auto &commandPool : frameCommandPools(frame))
+        vkResetCommandPool(device(), commandPool, 0);
+
+    recordCommandBuffers(
+        framePrimaryCommandBuffer(frame),
+        frameSecondaryCommandBuffers(frame),
+        imageIndex,
+        VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+    );
+}
+
+void Device::recordCommandBuffers(
+    VkCommandBuffer primaryCommandBuffer,
+    const std::vector<VkCommandBuffer> &secondaryCommandBuffers,
+    uint32_t imageIndex,
+    VkCommandBufferUsageFlags usage
+) noexcept
+{
     const auto numThreads = this->numThreads();
-    const size_t numIndicesEach=m_indexBuffer->numElements()/this->numThreads();
-    const auto &framebuffers = this->framebuffers();
+    const auto framebuffer = framebuffers()[imageIndex];
     auto renderpass=m_pipelines[0]->renderpass();
     const auto &clearValues = renderpass->clearValues();
-    
+    const auto &numSubpasses = renderpass->subpasses().size();
+
+    // Stream 0 and the instance buffer are at bindings 0 and 1, and the
+    // other streams follow from binding 2.
+    std::vector<VkBuffer> vertexBuffers;
+    for (const auto *stream : m_vertexStreams)
+        vertexBuffers.push_back(stream->buffer());
+    if (m_instanceBuffer!=nullptr)
+        vertexBuffers.insert(
+            vertexBuffers.begin()+1, m_instanceBuffer->buffer()
+        );
+    const std::vector<VkDeviceSize> vertexOffsets(vertexBuffers.size(), 0);
+
     VkRenderPassBeginInfo renderPassInfo = {};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
     renderPassInfo.renderPass = renderpass->renderpass();
+    renderPassInfo.framebuffer = framebuffer;
     renderPassInfo.renderArea.offset = {0,0};
     renderPassInfo.renderArea.extent = this->extent();
+
+    // Pipelines take the viewport and scissor as dynamic state.
+    VkViewport viewport = {};
+    viewport.x = 0.0f;
+    viewport.y = 0.0f;
+    viewport.width = renderPassInfo.renderArea.extent.width;
+    viewport.height = renderPassInfo.renderArea.extent.height;
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+    const VkRect2D scissor = renderPassInfo.renderArea;
     renderPassInfo.clearValueCount = clearValues.size();
     renderPassInfo.pClearValues = clearValues.data();
 
     VkCommandBufferBeginInfo beginInfo = {};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = usage;
 
-    const auto &numSubpasses = renderpass->subpasses().size();
-
-    for (size_t imageIndex = 0; imageIndex < this->swapchainSize(); ++imageIndex)
-    {
-        auto &primaryCommandBuffer = primaryCommandBuffers[imageIndex];
+    auto result = vkBeginCommandBuffer(primaryCommandBuffer, &beginInfo);
+    EVK_ASSERT(result,"failed to begin recording command buffer");
 
-        renderPassInfo.framebuffer = framebuffers[imageIndex];
-        vkBeginCommandBuffer(primaryCommandBuffer, &beginInfo);
+    if (m_cull!=nullptr) m_cull->record(primaryCommandBuffer, imageIndex);
+    const auto indirectBuffer = m_cull!=nullptr ?
+        m_cull->m_drawCommandBuffer : m_commands->m_indirectBuffer;
 
-        for (size_t pass = 0; pass < numSubpasses; ++pass)
+    for (size_t pass = 0; pass < numSubpasses; ++pass)
+    {
+        const auto &pipeline = m_pipelines[pass]->pipeline();
+        const auto &pipelineLayout = m_pipelines[pass]->layout();
+        // Ring buffers are read from the region of the image being drawn.
+        std::vector<uint32_t> dynamicOffsets;
+        if (m_pipelines[pass]->descriptor()!=nullptr)
+            dynamicOffsets=m_pipelines[pass]->descriptor()->dynamicOffsets(imageIndex);
+        if (pass == 0 )
+            vkCmdBeginRenderPass(
+                primaryCommandBuffer,
+                &renderPassInfo,
+                VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+        else
+            vkCmdNextSubpass(
+                primaryCommandBuffer,
+                VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+        const auto *passCommandBuffers =
+            &secondaryCommandBuffers[pass*numThreads];
+
+        auto createDrawCommands =[&](int i)
         {
-            const auto &pipeline = m_pipelines[pass]->pipeline();
-            const auto &pipelineLayout = m_pipelines[pass]->layout();
-            if (pass == 0 )
-                vkCmdBeginRenderPass(
-                    primaryCommandBuffer,
-                    &renderPassInfo,
-                    VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
-            else
-                vkCmdNextSubpass(
-                    primaryCommandBuffer,
-                    VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
-
-            auto createDrawCommands =[&](int i)
-            {
-                auto &secondaryCommandBuffer = secondaryCommandBuffers[i];
-
-                size_t numIndices=numIndicesEach;
-                size_t indexOffset=numIndicesEach*i;
-                if (i==(numThreads-1)) numIndices = m_indexBuffer->numElements()-(i*numIndicesEach);
-
-                VkCommandBufferAllocateInfo allocInfo = {};
-                allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-                allocInfo.commandPool = commandPools[i];
-                allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
-                allocInfo.commandBufferCount = 1;
-                auto result = vkAllocateCommandBuffers(
-                    device(), &allocInfo, &secondaryCommandBuffer
-                );
-                EVK_ASSERT(result,"failed to allocate command buffers");
+            const auto &secondaryCommandBuffer = passCommandBuffers[i];
 
-                VkCommandBufferInheritanceInfo inheritanceInfo = {};
-                inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
-                inheritanceInfo.renderPass = renderpass->renderpass();
-                inheritanceInfo.framebuffer = framebuffers[imageIndex];
-                inheritanceInfo.subpass=pass;
+            VkCommandBufferInheritanceInfo inheritanceInfo = {};
+            inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+            inheritanceInfo.renderPass = renderpass->renderpass();
+            inheritanceInfo.framebuffer = framebuffer;
+            inheritanceInfo.subpass=pass;
 
-                VkCommandBufferBeginInfo beginInfo = {};
-                beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-                beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
-                beginInfo.pInheritanceInfo = &inheritanceInfo;
+            VkCommandBufferBeginInfo beginInfo = {};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | usage;
+            beginInfo.pInheritanceInfo = &inheritanceInfo;
 
-                result = vkBeginCommandBuffer(
-                    secondaryCommandBuffer, &beginInfo
-                );
-                EVK_ASSERT(result,"failed to begin recording command buffer");
-
-                vkCmdBindPipeline(secondaryCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+            auto result = vkBeginCommandBuffer(
+                secondaryCommandBuffer, &beginInfo
+            );
+            EVK_ASSERT(result,"failed to begin recording command buffer");
 
-                VkDeviceSize offsets[] = {0};
+            vkCmdBindPipeline(secondaryCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+            vkCmdSetViewport(secondaryCommandBuffer, 0, 1, &viewport);
+            vkCmdSetScissor(secondaryCommandBuffer, 0, 1, &scissor);
 
-                auto vBuffer = m_vertexBuffer->buffer();
-                vkCmdBindVertexBuffers(secondaryCommandBuffer, 0, 1, &vBuffer, offsets);
-                vkCmdBindIndexBuffer(secondaryCommandBuffer, m_indexBuffer->buffer(), 0, VK_INDEX_TYPE_UINT32);
-                if (m_pipelines[pass]->descriptor()!=nullptr)
+            if (m_instanceBuffer!=nullptr)
+            {
+                vkCmdBindVertexBuffers(
+                    secondaryCommandBuffer, 0, vertexBuffers.size(),
+                    vertexBuffers.data(), vertexOffsets.data()
+                );
+            }
+            else
+            {
+                // Binding 1 is unused, so stream 0 is bound on its own.
+                vkCmdBindVertexBuffers(
+                    secondaryCommandBuffer, 0, 1, vertexBuffers.data(),
+                    vertexOffsets.data()
+                );
+                if (vertexBuffers.size()>1)
+                    vkCmdBindVertexBuffers(
+                        secondaryCommandBuffer, VertexInput::streamBinding(1),
+                        vertexBuffers.size()-1, vertexBuffers.data()+1,
+                        vertexOffsets.data()+1
+                    );
+            }
+            vkCmdBindIndexBuffer(
+                secondaryCommandBuffer, m_indexBuffer->buffer(), 0,
+                m_indexBuffer->indexType()
+            );
+            if (m_pipelines[pass]->descriptor()!=nullptr)
+            {
+                const auto &descriptorSets = m_pipelines[pass]->descriptor()->sets();
+                vkCmdBindDescriptorSets(
+                    secondaryCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout,
+                    0, descriptorSets.size(), descriptorSets.data(),
+                    dynamicOffsets.size(), dynamicOffsets.data());
+            }
+            const auto &drawItems = m_drawPartitions[i];
+            if (!m_firstIndirectCommands.empty())
+            {
+                const auto stride = sizeof(VkDrawIndexedIndirectCommand);
+                const uint32_t maxDrawCount = m_device->m_multiDrawIndirect ?
+                    m_device->m_maxDrawIndirectCount : 1;
+                for (size_t first = 0; first < drawItems.size(); first+=maxDrawCount)
                 {
-                    const auto &descriptorSets = m_pipelines[pass]->descriptor()->sets();
-                    vkCmdBindDescriptorSets(
-                        secondaryCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout,
-                        0, descriptorSets.size(), descriptorSets.data(), 0, nullptr);
+                    const uint32_t drawCount = std::min<size_t>(
+                        maxDrawCount, drawItems.size()-first
+                    );
+                    vkCmdDrawIndexedIndirect(
+                        secondaryCommandBuffer, indirectBuffer,
+                        (m_firstIndirectCommands[i]+first)*stride,
+                        drawCount, stride
+                    );
                 }
-                vkCmdDrawIndexed(secondaryCommandBuffer, numIndices, 1, indexOffset, 0, 0);
-
-                result = vkEndCommandBuffer(secondaryCommandBuffer);
-                EVK_ASSERT(result,"failed to record command buffer");
-            };
-
-            int counter = 0;
-            for (auto &t: this->threads())
+            }
+            else
             {
-                t->addJob(std::bind(createDrawCommands,counter++));
+                for (const auto &drawItem : drawItems)
+                {
+                    vkCmdDrawIndexed(
+                        secondaryCommandBuffer, drawItem.numIndices,
+                        drawItem.numInstances, drawItem.firstIndex,
+                        drawItem.vertexOffset, drawItem.firstInstance
+                    );
+                }
             }
-            this->wait();
-            vkCmdExecuteCommands(
-                primaryCommandBuffer, secondaryCommandBuffers.size(),
-                secondaryCommandBuffers.data()
-            );
-        }
 
-        vkCmdEndRenderPass(primaryCommandBuffer);
+            result = vkEndCommandBuffer(secondaryCommandBuffer);
+            EVK_ASSERT(result,"failed to record command buffer");
+        };
 
-        auto result = vkEndCommandBuffer(primaryCommandBuffer);
-        EVK_ASSERT(
-            result,
-            "could not end recording renderpass to primary command buffer."
+        m_threadPool.parallelFor(numThreads, createDrawCommands);
+        vkCmdExecuteCommands(
+            primaryCommandBuffer, numThreads, passCommandBuffers
         );
     }
+
+    vkCmdEndRenderPass(primaryCommandBuffer);
+
+    result = vkEndCommandBuffer(primaryCommandBuffer);
+    EVK_ASSERT(
+        result,
+        "could not end recording renderpass to primary command buffer."
+    );
 }
 
 void Device::resizeWindow() noexcept
 {
     vkDeviceWaitIdle(device());
-    m_swapchain->recreate();
+    m_uploader->releaseUpdates();
+    if (headless()) m_offscreen->recreate();
+    else m_swapchain->recreate();
+    if (m_readback!=nullptr)
+        m_readback->recreate(maxFramesInFlight(), extent());
     m_framebuffer->recreate();
     for (auto &p: m_pipelines) p->recreate();
-    record();
+    if (m_recordMode==RecordMode::STATIC) record();
 }
 
 } // namespace evk
\ No newline at end of file
@@ -0,0 +1,136 @@
+#include "device.h"
+
+#include "evk_assert.h"
+
+namespace evk {
+
+Device::Offscreen::Offscreen(
+    const VkDevice &device,
+    const VkPhysicalDevice &physicalDevice,
+    VkExtent2D extent,
+    const uint32_t size
+)
+{
+    m_device = device;
+    m_extent = extent;
+    m_physicalDevice = physicalDevice;
+    m_size = size;
+
+    setup();
+}
+
+void Device::Offscreen::setup() noexcept
+{
+    // The images replace swapchain images, so they are read back rather
+    // than presented.
+    const VkImageUsageFlags usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT
+        | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    m_images.resize(m_size);
+    m_imageMemory.resize(m_size);
+    m_imageViews.resize(m_size);
+    m_frameValues.assign(m_size, 0);
+    for (uint32_t i = 0; i < m_size; ++i)
+    {
+        internal::createImage(
+            m_device, m_physicalDevice, m_extent, m_format,
+            VK_IMAGE_TILING_OPTIMAL, usage,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &m_images[i],
+            &m_imageMemory[i]
+        );
+        internal::createImageView(
+            m_device, m_images[i], m_format, VK_IMAGE_ASPECT_COLOR_BIT,
+            &m_imageViews[i]
+        );
+    }
+    m_nextImage = 0;
+}
+
+Device::Offscreen::Offscreen(Offscreen &&other) noexcept
+{
+    *this=std::move(other);
+}
+
+Device::Offscreen& Device::Offscreen::operator=(Offscreen &&other) noexcept
+{
+    if (*this == other) return *this;
+    m_device=other.m_device;
+    m_extent=other.m_extent;
+    m_format=other.m_format;
+    m_frameValues=other.m_frameValues;
+    m_imageMemory=other.m_imageMemory;
+    m_images=other.m_images;
+    m_imageViews=other.m_imageViews;
+    m_nextImage=other.m_nextImage;
+    m_physicalDevice=other.m_physicalDevice;
+    m_size=other.m_size;
+    other.reset();
+    return *this;
+}
+
+void Device::Offscreen::reset() noexcept
+{
+    m_device=VK_NULL_HANDLE;
+    m_extent={};
+    m_format=VK_FORMAT_B8G8R8A8_SRGB;
+    m_frameValues.resize(0);
+    m_imageMemory.resize(0);
+    m_images.resize(0);
+    m_imageViews.resize(0);
+    m_nextImage=0;
+    m_physicalDevice=VK_NULL_HANDLE;
+    m_size=0;
+}
+
+bool Device::Offscreen::operator==(const Offscreen &other) const noexcept
+{
+    if (m_device!=other.m_device) return false;
+    if (m_extent.width!=other.m_extent.width) return false;
+    if (m_extent.height!=other.m_extent.height) return false;
+    if (m_format!=other.m_format) return false;
+    if (m_images.size()!=other.m_images.size()) return false;
+    if (!std::equal(
+            m_images.begin(), m_images.end(), other.m_images.begin()
+        ))
+        return false;
+    if (m_imageViews.size()!=other.m_imageViews.size()) return false;
+    if (!std::equal(
+            m_imageViews.begin(), m_imageViews.end(), other.m_imageViews.begin()
+        ))
+        return false;
+    return true;
+}
+
+bool Device::Offscreen::operator!=(const Offscreen &other) const noexcept
+{
+    return !(*this==other);
+}
+
+uint32_t Device::Offscreen::acquire() noexcept
+{
+    const uint32_t image = m_nextImage;
+    m_nextImage = (m_nextImage+1)%m_size;
+    return image;
+}
+
+void Device::Offscreen::recreate() noexcept
+{
+    destroy();
+    setup();
+}
+
+void Device::Offscreen::destroy() noexcept
+{
+    for (auto &iv : m_imageViews) vkDestroyImageView(m_device, iv, nullptr);
+    for (auto &i : m_images) vkDestroyImage(m_device, i, nullptr);
+    for (auto &m : m_imageMemory) internal::freeMemory(m);
+    m_imageViews.resize(0);
+    m_images.resize(0);
+    m_imageMemory.resize(0);
+}
+
+Device::Offscreen::~Offscreen() noexcept
+{
+    destroy();
+}
+
+} // namespace evk
@@ -42,7 +42,8 @@ Pipeline::Pipeline(
     Descriptor &descriptor,
     const VertexInput &vertexInput,
     Renderpass &renderpass,
-    const std::vector<Shader*> &shaders
+    const std::vector<Shader*> &shaders,
+    Build build
 ) noexcept
 {
     m_device = &device;
@@ -51,6 +52,7 @@ Pipeline::Pipeline(
     m_descriptor = &descriptor;
     m_shaders = shaders;
     m_renderpass = &renderpass;
+    checkVertexFormats();
 
     // Finalize descriptor sets.
     m_descriptor->finalize();
@@ -58,7 +60,7 @@ Pipeline::Pipeline(
     auto setLayouts = m_descriptor->setLayouts();
     createSetLayout(setLayouts);
 
-    setup();
+    if (build==Build::NOW) setup();
 }
 
 Pipeline::Pipeline(
@@ -66,7 +68,8 @@ Pipeline::Pipeline(
     Subpass &subpass,
     const VertexInput &vertexInput,
     Renderpass &renderpass,
-    const std::vector<Shader*> &shaders
+    const std::vector<Shader*> &shaders,
+    Build build
 ) noexcept
 {
     m_device = &device;
@@ -74,11 +77,30 @@ Pipeline::Pipeline(
     m_subpass = &subpass;
     m_shaders = shaders;
     m_renderpass = &renderpass;
+    checkVertexFormats();
 
     std::vector<VkDescriptorSetLayout> setLayouts;
     createSetLayout(setLayouts);
 
-    setup();
+    if (build==Build::NOW) setup();
+}
+
+void Pipeline::checkVertexFormats() const noexcept
+{
+    // Packed formats such as SNORM_10_10_10_2 need not be readable from a
+    // vertex buffer.
+    for (const auto &attribute : m_vertexInput.attributeDescriptions())
+    {
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(
+            m_device->physicalDevice(), attribute.format, &properties
+        );
+        EVK_ASSERT_TRUE(
+            properties.bufferFeatures & VK_FORMAT_FEATURE_VERTEX_BUFFER_BIT,
+            "the format of vertex attribute " << attribute.location <<
+            " is not supported in vertex buffers by this device\n"
+        );
+    }
 }
 
 void Pipeline::createSetLayout(
@@ -130,14 +152,13 @@ bool Pipeline::operator!=(const Pipeline &other) const noexcept
 void Pipeline::setup() noexcept
 {
     const auto &attributeDescriptions = m_vertexInput.attributeDescriptions();
-    const auto &bindingDescription = m_vertexInput.bindingDescription();
-    const auto &extent = m_device->extent(); 
+    const auto &bindingDescriptions = m_vertexInput.bindingDescriptions();
 
     // Set up input to vertex shader.
     VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
     vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertexInputInfo.vertexBindingDescriptionCount = 1;
-    vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+    vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(bindingDescriptions.size());
+    vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions.data();
     vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
     vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
 
@@ -147,27 +168,22 @@ void Pipeline::setup() noexcept
     inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
     inputAssembly.primitiveRestartEnable = VK_FALSE;
 
-    // Set up the viewport.
-    VkViewport viewport = {};
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = extent.width;
-    viewport.height = extent.height;
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
-
-    // Set up scissor.
-    VkRect2D scissor = {};
-    scissor.offset = {0,0};
-    scissor.extent = extent;
-
-    // Combine viewport and scissor.
+    // The viewport and scissor are set when draws are recorded, so the
+    // pipeline does not depend on the extent and survives a resize.
     VkPipelineViewportStateCreateInfo viewportState = {};
     viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
     viewportState.viewportCount = 1;
-    viewportState.pViewports = &viewport;
+    viewportState.pViewports = nullptr;
     viewportState.scissorCount = 1;
-    viewportState.pScissors = &scissor;
+    viewportState.pScissors = nullptr;
+
+    const std::vector<VkDynamicState> dynamicStates = {
+        VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR
+    };
+    VkPipelineDynamicStateCreateInfo dynamicState = {};
+    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamicState.dynamicStateCount = dynamicStates.size();
+    dynamicState.pDynamicStates = dynamicStates.data();
 
     // Set up the rasterizer.
     VkPipelineRasterizationStateCreateInfo rasterizer = {};
@@ -253,7 +269,7 @@ void Pipeline::setup() noexcept
     pipelineInfo.pMultisampleState = &multisampling;
     pipelineInfo.pDepthStencilState = nullptr;
     pipelineInfo.pColorBlendState = &colorBlending;
-    pipelineInfo.pDynamicState = nullptr;
+    pipelineInfo.pDynamicState = &dynamicState;
     pipelineInfo.layout = m_layout;
     pipelineInfo.renderPass = m_renderpass->renderpass();
     pipelineInfo.subpass = m_subpass->index();
@@ -262,19 +278,17 @@ void Pipeline::setup() noexcept
     pipelineInfo.pDepthStencilState = &depthStencil;
 
     auto result = vkCreateGraphicsPipelines(
-        m_device->device(), VK_NULL_HANDLE, 1, &pipelineInfo, nullptr,
-        &m_pipeline
+        m_device->device(), m_device->pipelineCache(), 1, &pipelineInfo,
+        nullptr, &m_pipeline
     );
     EVK_ASSERT(result, "failed to create graphics pipeline");
 }
 
 void Pipeline::recreate() noexcept
 {
-    if (m_pipeline!=VK_NULL_HANDLE)
-        vkDestroyPipeline(m_device->device(), m_pipeline, nullptr);
-    m_pipeline=VK_NULL_HANDLE;
+    // Only input attachments depend on the swapchain, so the pipeline is
+    // kept and just the descriptor is rebuilt.
     if (m_descriptor!=nullptr) m_descriptor->recreate();
-    setup();
 }
 
 Pipeline::~Pipeline() noexcept
@@ -0,0 +1,265 @@
+#include "device.h"
+
+#include "evk_assert.h"
+
+namespace evk {
+
+namespace {
+// The host reads every byte of a readback, which is slow from uncached
+// memory, so cached memory is used where the device has it.
+VkMemoryPropertyFlags hostReadProperties(
+    VkPhysicalDevice physicalDevice
+) noexcept
+{
+    const VkMemoryPropertyFlags cached = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+        | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+        | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+    VkPhysicalDeviceMemoryProperties memProperties;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+    for (uint32_t i = 0; i < memProperties.memoryTypeCount; ++i)
+    {
+        if ((memProperties.memoryTypes[i].propertyFlags & cached)==cached)
+            return cached;
+    }
+    return VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+        | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+}
+} // namespace
+
+Device::Readback::Readback(
+    const VkDevice &device,
+    const VkPhysicalDevice &physicalDevice,
+    const uint32_t &graphicsFamily,
+    const uint32_t &maxFramesInFlight,
+    VkExtent2D extent,
+    const ReadbackFunc &callback
+)
+{
+    m_callback = callback;
+    m_device = device;
+    m_physicalDevice = physicalDevice;
+
+    VkCommandPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.queueFamilyIndex = graphicsFamily;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    auto result = vkCreateCommandPool(
+        m_device, &poolInfo, nullptr, &m_commandPool
+    );
+    EVK_ASSERT(result, "failed to create readback command pool\n");
+
+    setup(maxFramesInFlight, extent);
+}
+
+void Device::Readback::setup(
+    uint32_t maxFramesInFlight,
+    VkExtent2D extent
+) noexcept
+{
+    m_extent = extent;
+    m_size = VkDeviceSize(extent.width)*extent.height*4;
+    m_buffers.resize(maxFramesInFlight, VK_NULL_HANDLE);
+    m_commandBuffers.resize(maxFramesInFlight, VK_NULL_HANDLE);
+    m_frameValues.assign(maxFramesInFlight, 0);
+    m_memory.resize(maxFramesInFlight);
+
+    const VkMemoryPropertyFlags properties =
+        hostReadProperties(m_physicalDevice);
+    for (uint32_t frame = 0; frame < maxFramesInFlight; ++frame)
+    {
+        internal::createBuffer(
+            m_device, m_physicalDevice, m_size,
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT, properties, &m_buffers[frame],
+            &m_memory[frame]
+        );
+    }
+
+    VkCommandBufferAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = m_commandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = maxFramesInFlight;
+    auto result = vkAllocateCommandBuffers(
+        m_device, &allocInfo, m_commandBuffers.data()
+    );
+    EVK_ASSERT(result, "failed to allocate readback command buffers\n");
+}
+
+void Device::Readback::destroy() noexcept
+{
+    if (!m_commandBuffers.empty())
+        vkFreeCommandBuffers(
+            m_device, m_commandPool, m_commandBuffers.size(),
+            m_commandBuffers.data()
+        );
+    for (auto &buffer : m_buffers) vkDestroyBuffer(m_device, buffer, nullptr);
+    for (auto &memory : m_memory) internal::freeMemory(memory);
+    m_buffers.resize(0);
+    m_commandBuffers.resize(0);
+    m_frameValues.resize(0);
+    m_memory.resize(0);
+}
+
+void Device::Readback::recreate(
+    uint32_t maxFramesInFlight,
+    VkExtent2D extent
+) noexcept
+{
+    // The device is idle, so every pending copy has finished.
+    deliverUpTo(UINT64_MAX);
+    destroy();
+    setup(maxFramesInFlight, extent);
+}
+
+Device::Readback::Readback(Readback &&other) noexcept
+{
+    *this=std::move(other);
+}
+
+Device::Readback& Device::Readback::operator=(Readback &&other) noexcept
+{
+    if (*this == other) return *this;
+    m_buffers=other.m_buffers;
+    m_callback=other.m_callback;
+    m_commandBuffers=other.m_commandBuffers;
+    m_commandPool=other.m_commandPool;
+    m_device=other.m_device;
+    m_extent=other.m_extent;
+    m_frameValues=other.m_frameValues;
+    m_memory=other.m_memory;
+    m_physicalDevice=other.m_physicalDevice;
+    m_size=other.m_size;
+    other.reset();
+    return *this;
+}
+
+void Device::Readback::reset() noexcept
+{
+    m_buffers.resize(0);
+    m_callback=nullptr;
+    m_commandBuffers.resize(0);
+    m_commandPool=VK_NULL_HANDLE;
+    m_device=VK_NULL_HANDLE;
+    m_extent={};
+    m_frameValues.resize(0);
+    m_memory.resize(0);
+    m_physicalDevice=VK_NULL_HANDLE;
+    m_size=0;
+}
+
+bool Device::Readback::operator==(const Readback &other) const noexcept
+{
+    if (m_commandPool!=other.m_commandPool) return false;
+    if (m_device!=other.m_device) return false;
+    if (m_buffers.size()!=other.m_buffers.size()) return false;
+    if (!std::equal(
+            m_buffers.begin(), m_buffers.end(), other.m_buffers.begin()
+        ))
+        return false;
+    return true;
+}
+
+bool Device::Readback::operator!=(const Readback &other) const noexcept
+{
+    return !(*this==other);
+}
+
+Device::Readback::~Readback() noexcept
+{
+    if (m_device==VK_NULL_HANDLE) return;
+    // Command buffers may still be pending on the graphics queue.
+    vkDeviceWaitIdle(m_device);
+    destroy();
+    vkDestroyCommandPool(m_device, m_commandPool, nullptr);
+}
+
+VkCommandBuffer Device::Readback::record(
+    size_t frame,
+    VkImage image,
+    VkImageLayout layout,
+    uint64_t value
+) noexcept
+{
+    const VkCommandBuffer commandBuffer = m_commandBuffers[frame];
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    auto result = vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    EVK_ASSERT(result, "failed to begin readback command buffer");
+
+    // The copy follows the render pass that wrote the image.
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = layout;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(
+        commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier
+    );
+
+    VkBufferImageCopy region = {};
+    region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    region.imageExtent = {m_extent.width, m_extent.height, 1};
+    vkCmdCopyImageToBuffer(
+        commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        m_buffers[frame], 1, &region
+    );
+
+    // The copy is made visible to the host, and a swapchain image is
+    // returned to its layout for presentation.
+    VkMemoryBarrier hostBarrier = {};
+    hostBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.newLayout = layout;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = 0;
+    const uint32_t numImageBarriers =
+        layout==VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL ? 0 : 1;
+    vkCmdPipelineBarrier(
+        commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+        1, &hostBarrier, 0, nullptr, numImageBarriers, &barrier
+    );
+
+    result = vkEndCommandBuffer(commandBuffer);
+    EVK_ASSERT(result, "failed to record readback command buffer");
+    m_frameValues[frame] = value;
+    return commandBuffer;
+}
+
+void Device::Readback::deliver(size_t frame) noexcept
+{
+    if (m_frameValues[frame]==0) return;
+    const uint64_t value = m_frameValues[frame];
+    m_frameValues[frame] = 0;
+    m_callback(value, m_memory[frame].data, m_extent);
+}
+
+void Device::Readback::deliverUpTo(uint64_t value) noexcept
+{
+    // Frames are delivered in the order they were drawn.
+    while (true)
+    {
+        size_t oldest = m_frameValues.size();
+        for (size_t frame = 0; frame < m_frameValues.size(); ++frame)
+        {
+            if (m_frameValues[frame]==0 || m_frameValues[frame]>value)
+                continue;
+            if (oldest==m_frameValues.size() ||
+                m_frameValues[frame]<m_frameValues[oldest])
+                oldest = frame;
+        }
+        if (oldest==m_frameValues.size()) return;
+        deliver(oldest);
+    }
+}
+
+} // namespace evk
@@ -85,6 +85,8 @@ VkShaderStageFlagBits Shader::stageFlags(const Stage &shaderStage) noexcept
         return VK_SHADER_STAGE_VERTEX_BIT;
     case Stage::FRAGMENT:
         return VK_SHADER_STAGE_FRAGMENT_BIT;
+    case Stage::COMPUTE:
+        return VK_SHADER_STAGE_COMPUTE_BIT;
     }
 }
 
@@ -50,7 +50,11 @@ void Device::Swapchain::setup() noexcept
     createInfo.imageColorSpace = surfaceFormat.colorSpace;
     createInfo.imageExtent = extent;
     createInfo.imageArrayLayers = 1;
-    createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    m_usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    if (swapChainSupport.capabilities.supportedUsageFlags &
+        VK_IMAGE_USAGE_TRANSFER_SRC_BIT)
+        m_usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    createInfo.imageUsage = m_usage;
 
     auto indices = internal::findQueueFamilies(m_physicalDevice, m_surface);
     uint32_t queueFamilyIndices[] = {
@@ -114,6 +118,7 @@ Device::Swapchain& Device::Swapchain::operator=(Swapchain &&other) noexcept
     m_format=other.m_format;
     m_images=other.m_images;
     m_imageViews=other.m_imageViews;
+    m_usage=other.m_usage;
     m_swapchain=other.m_swapchain;
     m_swapchainSize=other.m_swapchainSize;
     m_surface=other.m_surface;
@@ -130,6 +135,7 @@ void Device::Swapchain::reset() noexcept
     m_format={};
     m_images.resize(0);
     m_imageViews.resize(0);
+    m_usage=0;
     m_swapchain=VK_NULL_HANDLE;
     m_swapchainSize=0;
     m_surface={};
@@ -7,13 +7,14 @@ namespace evk {
 
 Device::Sync::Sync(
     const VkDevice &device,
-    const uint32_t &swapchainSize)
+    const uint32_t &swapchainSize,
+    const uint32_t &maxFramesInFlight)
 {
     m_device = device;
-    size_t maxFramesInFlight = swapchainSize;
     m_imageAvailableSemaphores.resize(maxFramesInFlight);
     m_renderFinishedSemaphores.resize(maxFramesInFlight);
     m_fencesInFlight.resize(maxFramesInFlight, VK_NULL_HANDLE);
+    m_frameValues.resize(maxFramesInFlight, 0);
     m_imagesInFlight.resize(swapchainSize, VK_NULL_HANDLE);
 
     VkSemaphoreCreateInfo semaphoreInfo = {};
@@ -51,6 +52,7 @@ Device::Sync& Device::Sync::operator=(Sync &&other) noexcept
     if (*this==other) return *this;
     m_device=other.m_device;
     m_fencesInFlight=other.m_fencesInFlight;
+    m_frameValues=other.m_frameValues;
     m_imageAvailableSemaphores=other.m_imageAvailableSemaphores;
     m_imagesInFlight=other.m_imagesInFlight;
     m_renderFinishedSemaphores=other.m_renderFinishedSemaphores;
@@ -62,6 +64,7 @@ void Device::Sync::reset() noexcept
 {
     m_device=VK_NULL_HANDLE;
     m_fencesInFlight.resize(0);
+    m_frameValues.resize(0);
     m_imageAvailableSemaphores.resize(0);
     m_imagesInFlight.resize(0);
     m_renderFinishedSemaphores.resize(0);
@@ -19,6 +19,7 @@ Texture& Texture::operator=(Texture &&other) noexcept
     m_imageSampler=std::move(other.m_imageSampler);
     m_imageView=std::move(other.m_imageView);
     m_memory=std::move(other.m_memory);
+    m_uploadValue=other.m_uploadValue;
     other.reset();
     return *this;
 }
@@ -29,7 +30,8 @@ void Texture::reset() noexcept
     m_image=VK_NULL_HANDLE;
     m_imageSampler=VK_NULL_HANDLE;
     m_imageView=VK_NULL_HANDLE;
-    m_memory=VK_NULL_HANDLE;
+    m_memory={};
+    m_uploadValue=0;
 }
 
 Texture::~Texture() noexcept
@@ -40,8 +42,7 @@ Texture::~Texture() noexcept
         vkDestroyImageView(m_device, m_imageView, nullptr);
     if (m_image!=VK_NULL_HANDLE)
         vkDestroyImage(m_device, m_image, nullptr);
-    if (m_memory!=VK_NULL_HANDLE)
-        vkFreeMemory(m_device, m_memory, nullptr);
+    internal::freeMemory(m_memory);
 }
 
 bool Texture::operator==(const Texture &other) const noexcept
@@ -65,8 +66,7 @@ Texture::Texture(
 )
 {
     m_device = device.device();
-    const auto &commandPools = device.commandPools();
-    auto &commandPool = commandPools[0];
+    Device::Uploader &uploader = device.uploader();
 
     int texWidth, texHeight, texChannels;
     stbi_uc* pixels = stbi_load(
@@ -75,19 +75,8 @@ Texture::Texture(
 
     VkDeviceSize imageSize = texWidth * texHeight * 4;
 
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    internal::createBuffer(
-        device.device(), device.physicalDevice(), imageSize,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        &stagingBuffer, &stagingBufferMemory);
-
-    void* data;
-    vkMapMemory(device.device(), stagingBufferMemory, 0, imageSize, 0, &data);
-    memcpy(data, pixels, static_cast<size_t>(imageSize));
-    vkUnmapMemory(device.device(), stagingBufferMemory);
+    const auto staging = uploader.stage(imageSize);
+    memcpy(staging.data, pixels, static_cast<size_t>(imageSize));
 
     stbi_image_free(pixels);
 
@@ -101,19 +90,25 @@ Texture::Texture(
     VkMemoryPropertyFlagBits properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
     internal::createImage(
         device.device(), device.physicalDevice(), extent, format, tiling, usage,
-        properties, &m_image, &m_memory
-    );
-
-    transitionImageLayout(
-        device, commandPool, m_image, format, Transition::INITIAL
-    );
-    copyBufferToImage(device, commandPool, stagingBuffer, m_image, extent);
-    transitionImageLayout(
-        device, commandPool, m_image, format, Transition::SHADER
+        properties, &m_image, &m_memory, device.uploadQueueFamilies()
     );
 
-    vkDestroyBuffer(device.device(), stagingBuffer, nullptr);
-    vkFreeMemory(device.device(), stagingBufferMemory, nullptr);
+    // The transitions and copy join the next batch of uploads, rather than
+    // each waiting for the queue.
+    const bool graphicsQueue = !uploader.m_separateFamily;
+    auto uploadCommands = [&](VkCommandBuffer commandBuffer)
+    {
+        transitionImageLayout(
+            commandBuffer, m_image, Transition::INITIAL, graphicsQueue
+        );
+        copyBufferToImage(
+            commandBuffer, staging.buffer, staging.offset, m_image, extent
+        );
+        transitionImageLayout(
+            commandBuffer, m_image, Transition::SHADER, graphicsQueue
+        );
+    };
+    m_uploadValue = uploader.record(uploadCommands, {staging});
 
     VkImageAspectFlags aspectFlags = VK_IMAGE_ASPECT_COLOR_BIT;
     internal::createImageView(
@@ -146,18 +141,12 @@ Texture::Texture(
 }
 
 void Texture::transitionImageLayout(
-    const Device &device,
-    VkCommandPool commandPool,
+    VkCommandBuffer commandBuffer,
     VkImage image,
-    VkFormat format,
-    Transition transition
+    Transition transition,
+    bool graphicsQueue
 ) noexcept
 {
-    VkCommandBuffer commandBuffer;
-    internal::beginSingleTimeCommands(
-        device.device(), commandPool, &commandBuffer
-    );
-
     VkImageLayout oldLayout{};
     VkImageLayout newLayout{};
 
@@ -204,6 +193,14 @@ void Texture::transitionImageLayout(
             barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
             sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
             destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+            // A transfer queue has no shader stages, so the write is only
+            // made available here. The Uploader makes it visible on the
+            // graphics queue once the upload has finished.
+            if (!graphicsQueue)
+            {
+                barrier.dstAccessMask = 0;
+                destinationStage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+            }
             break;
     }
 
@@ -211,27 +208,18 @@ void Texture::transitionImageLayout(
         commandBuffer, sourceStage, destinationStage, 0, 0, nullptr,
         0, nullptr, 1, &barrier
     );
-
-    internal::endSingleTimeCommands(
-        device.device(), device.graphicsQueue(), commandPool, commandBuffer
-    );
 }
 
 void Texture::copyBufferToImage(
-    const Device &device,
-    VkCommandPool commandPool,
+    VkCommandBuffer commandBuffer,
     VkBuffer buffer,
+    VkDeviceSize bufferOffset,
     VkImage image,
     VkExtent2D extent
 ) noexcept
 {
-    VkCommandBuffer commandBuffer;
-    internal::beginSingleTimeCommands(
-        device.device(), commandPool, &commandBuffer
-    );
-
     VkBufferImageCopy region{};
-    region.bufferOffset = 0;
+    region.bufferOffset = bufferOffset;
     region.bufferRowLength = 0;
     region.bufferImageHeight = 0;
     region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -245,10 +233,6 @@ void Texture::copyBufferToImage(
         commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
         1, &region
     );
-
-    internal::endSingleTimeCommands(
-        device.device(), device.graphicsQueue(), commandPool, commandBuffer
-    );
 }
 
 } // namespace evk
\ No newline at end of file
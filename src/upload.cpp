@@ -0,0 +1,509 @@
+#include "device.h"
+
+#include "evk_assert.h"
+#include <algorithm>
+
+namespace evk {
+
+namespace {
+// A batch is submitted once it holds this much staging memory, so large
+// loads start copying before they have all been recorded.
+const VkDeviceSize MAX_BATCH_STAGING_SIZE = 64*1024*1024;
+// Staging blocks are this large, unless a single upload needs more. Larger
+// blocks are destroyed once their upload has finished.
+const VkDeviceSize STAGING_BLOCK_SIZE = 32*1024*1024;
+
+VkDeviceSize alignUp(VkDeviceSize offset, VkDeviceSize alignment) noexcept
+{
+    return (offset+alignment-1)/alignment*alignment;
+}
+
+// The stages and accesses with which draws read StaticBuffers.
+const VkPipelineStageFlags DRAW_READ_STAGES =
+    VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+    VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+const VkAccessFlags DRAW_READ_ACCESS =
+    VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT |
+    VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT |
+    VK_ACCESS_SHADER_READ_BIT;
+
+void transferBarrier(
+    VkCommandBuffer commandBuffer,
+    VkPipelineStageFlags srcStages,
+    VkAccessFlags srcAccess,
+    VkPipelineStageFlags dstStages,
+    VkAccessFlags dstAccess
+) noexcept
+{
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+    vkCmdPipelineBarrier(
+        commandBuffer, srcStages, dstStages, 0, 1, &barrier, 0, nullptr, 0,
+        nullptr
+    );
+}
+} // namespace
+
+Device::Uploader::Uploader(
+    const VkDevice &device,
+    const VkPhysicalDevice &physicalDevice,
+    const VkQueue &queue,
+    const uint32_t &queueFamilyIndex,
+    const uint32_t &graphicsFamily
+)
+{
+    m_device = device;
+    m_physicalDevice = physicalDevice;
+    m_queue = queue;
+    m_separateFamily = queueFamilyIndex!=graphicsFamily;
+
+    // Offsets into staging blocks suit both buffer and image copies.
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(m_physicalDevice, &properties);
+    const VkDeviceSize alignment =
+        properties.limits.optimalBufferCopyOffsetAlignment;
+    if (alignment>m_stagingAlignment) m_stagingAlignment = alignment;
+
+    VkCommandPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.queueFamilyIndex = queueFamilyIndex;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT |
+        VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    auto result = vkCreateCommandPool(
+        m_device, &poolInfo, nullptr, &m_commandPool
+    );
+    EVK_ASSERT(result, "failed to create upload command pool\n");
+
+    // Updates are copied on the graphics queue, in order with the draws.
+    poolInfo.queueFamilyIndex = graphicsFamily;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    result = vkCreateCommandPool(
+        m_device, &poolInfo, nullptr, &m_updateCommandPool
+    );
+    EVK_ASSERT(result, "failed to create update command pool\n");
+}
+
+Device::Uploader::Uploader(Uploader &&other) noexcept
+{
+    *this=std::move(other);
+}
+
+Device::Uploader& Device::Uploader::operator=(Uploader &&other) noexcept
+{
+    if (*this==other) return *this;
+    m_acquiredValue=other.m_acquiredValue;
+    m_commandPool=other.m_commandPool;
+    m_completedValue=other.m_completedValue;
+    m_currentBlock=other.m_currentBlock;
+    m_device=other.m_device;
+    m_freeBlocks=other.m_freeBlocks;
+    m_freeCommandBuffers=other.m_freeCommandBuffers;
+    m_freeFences=other.m_freeFences;
+    m_frameUpdateStaging=std::move(other.m_frameUpdateStaging);
+    m_inFlight=std::move(other.m_inFlight);
+    m_open=std::move(other.m_open);
+    m_pendingUpdates=std::move(other.m_pendingUpdates);
+    m_pendingUpdateStaging=std::move(other.m_pendingUpdateStaging);
+    m_physicalDevice=other.m_physicalDevice;
+    m_queue=other.m_queue;
+    m_separateFamily=other.m_separateFamily;
+    m_stagingBlocks=other.m_stagingBlocks;
+    m_stagingAlignment=other.m_stagingAlignment;
+    m_submittedValue=other.m_submittedValue;
+    m_updateCommandBuffers=other.m_updateCommandBuffers;
+    m_updateCommandPool=other.m_updateCommandPool;
+    other.reset();
+    return *this;
+}
+
+Device::Uploader::~Uploader() noexcept
+{
+    if (m_device==VK_NULL_HANDLE) return;
+    wait(m_open.value>m_submittedValue ? m_open.value : m_submittedValue);
+    // Update command buffers may still be pending on the graphics queue, and
+    // they read from the staging blocks.
+    if (!m_updateCommandBuffers.empty()) vkDeviceWaitIdle(m_device);
+    destroyBlocks();
+    for (auto &fence : m_freeFences) vkDestroyFence(m_device, fence, nullptr);
+    vkDestroyCommandPool(m_device, m_commandPool, nullptr);
+    vkDestroyCommandPool(m_device, m_updateCommandPool, nullptr);
+}
+
+void Device::Uploader::reset() noexcept
+{
+    m_acquiredValue=0;
+    m_commandPool=VK_NULL_HANDLE;
+    m_completedValue=0;
+    m_currentBlock=-1;
+    m_device=VK_NULL_HANDLE;
+    m_freeBlocks.resize(0);
+    m_freeCommandBuffers.resize(0);
+    m_freeFences.resize(0);
+    m_frameUpdateStaging.resize(0);
+    m_inFlight.resize(0);
+    m_open=Batch();
+    m_pendingUpdates.resize(0);
+    m_pendingUpdateStaging.resize(0);
+    m_physicalDevice=VK_NULL_HANDLE;
+    m_queue=VK_NULL_HANDLE;
+    m_stagingBlocks.resize(0);
+    m_stagingAlignment=16;
+    m_submittedValue=0;
+    m_updateCommandBuffers.resize(0);
+    m_updateCommandPool=VK_NULL_HANDLE;
+}
+
+bool Device::Uploader::operator==(const Uploader &other) const noexcept
+{
+    if (m_commandPool!=other.m_commandPool) return false;
+    if (m_device!=other.m_device) return false;
+    if (m_queue!=other.m_queue) return false;
+    return true;
+}
+
+bool Device::Uploader::operator!=(const Uploader &other) const noexcept
+{
+    return !(*this==other);
+}
+
+Device::Uploader::Staging Device::Uploader::stage(
+    VkDeviceSize size
+) noexcept
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // Move on from the current block once it is full, taking a rewound
+    // block if one is large enough.
+    const auto fits = [this, size](uint32_t block)
+    {
+        const StagingBlock &b = m_stagingBlocks[block];
+        return alignUp(b.head, m_stagingAlignment)+size<=b.size;
+    };
+    if (m_currentBlock<0 || !fits(m_currentBlock))
+    {
+        const int32_t previousBlock=m_currentBlock;
+        m_currentBlock=-1;
+        if (previousBlock>=0 && m_stagingBlocks[previousBlock].numPending==0)
+            recycleBlock(previousBlock);
+        for (auto it=m_freeBlocks.begin(); it!=m_freeBlocks.end(); ++it)
+        {
+            if (!fits(*it)) continue;
+            m_currentBlock=*it;
+            m_freeBlocks.erase(it);
+            break;
+        }
+        if (m_currentBlock<0)
+        {
+            const VkDeviceSize blockSize =
+                size>STAGING_BLOCK_SIZE ? size : STAGING_BLOCK_SIZE;
+            m_currentBlock=createBlock(blockSize);
+        }
+    }
+
+    StagingBlock &block = m_stagingBlocks[m_currentBlock];
+    Staging staging;
+    staging.block=m_currentBlock;
+    staging.buffer=block.buffer;
+    staging.offset=alignUp(block.head, m_stagingAlignment);
+    staging.size=size;
+    staging.data=static_cast<char*>(block.memory.data)+staging.offset;
+    block.head=staging.offset+size;
+    ++block.numPending;
+    return staging;
+}
+
+uint32_t Device::Uploader::createBlock(VkDeviceSize size) noexcept
+{
+    StagingBlock block;
+    block.size=size;
+    internal::createBuffer(
+        m_device, m_physicalDevice, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        &block.buffer, &block.memory
+    );
+
+    // Reuse the slot of a destroyed block, so that indices stay valid.
+    for (uint32_t i = 0; i < m_stagingBlocks.size(); ++i)
+    {
+        if (m_stagingBlocks[i].buffer!=VK_NULL_HANDLE) continue;
+        m_stagingBlocks[i]=block;
+        return i;
+    }
+    m_stagingBlocks.push_back(block);
+    return m_stagingBlocks.size()-1;
+}
+
+void Device::Uploader::recycleBlock(uint32_t block) noexcept
+{
+    StagingBlock &b = m_stagingBlocks[block];
+    b.head=0;
+    if (static_cast<int32_t>(block)==m_currentBlock) return;
+
+    // Oversized blocks are only kept while they are in use.
+    if (b.size<=STAGING_BLOCK_SIZE)
+    {
+        m_freeBlocks.push_back(block);
+        return;
+    }
+    vkDestroyBuffer(m_device, b.buffer, nullptr);
+    internal::freeMemory(b.memory);
+    b=StagingBlock();
+}
+
+void Device::Uploader::destroyBlocks() noexcept
+{
+    for (auto &block : m_stagingBlocks)
+    {
+        if (block.buffer==VK_NULL_HANDLE) continue;
+        vkDestroyBuffer(m_device, block.buffer, nullptr);
+        internal::freeMemory(block.memory);
+    }
+    m_stagingBlocks.resize(0);
+    m_freeBlocks.resize(0);
+    m_currentBlock=-1;
+}
+
+uint64_t Device::Uploader::record(
+    const std::function<void(VkCommandBuffer)> &commands,
+    const std::vector<Staging> &staging
+) noexcept
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_open.commandBuffer==VK_NULL_HANDLE) beginBatch();
+
+    commands(m_open.commandBuffer);
+    for (const auto &s : staging)
+    {
+        m_open.staging.push_back(s);
+        m_open.stagingSize+=s.size;
+    }
+
+    const uint64_t value = m_open.value;
+    if (m_open.stagingSize>=MAX_BATCH_STAGING_SIZE) flushLocked();
+    return value;
+}
+
+uint64_t Device::Uploader::flush() noexcept
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return flushLocked();
+}
+
+uint64_t Device::Uploader::completedValue() noexcept
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    retire(false, 0);
+    return m_completedValue;
+}
+
+void Device::Uploader::wait(uint64_t value) noexcept
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_open.commandBuffer!=VK_NULL_HANDLE && m_open.value<=value)
+        flushLocked();
+    retire(true, value);
+}
+
+void Device::Uploader::beginBatch() noexcept
+{
+    m_open.value=m_submittedValue+1;
+    if (m_freeCommandBuffers.empty())
+    {
+        internal::beginSingleTimeCommands(
+            m_device, m_commandPool, &m_open.commandBuffer
+        );
+        return;
+    }
+
+    // Beginning a command buffer from this pool resets it.
+    m_open.commandBuffer=m_freeCommandBuffers.back();
+    m_freeCommandBuffers.pop_back();
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(m_open.commandBuffer, &beginInfo);
+}
+
+uint64_t Device::Uploader::flushLocked() noexcept
+{
+    if (m_open.commandBuffer==VK_NULL_HANDLE) return m_submittedValue;
+    vkEndCommandBuffer(m_open.commandBuffer);
+
+    VkResult result;
+    if (m_freeFences.empty())
+    {
+        VkFenceCreateInfo fenceInfo = {};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        result = vkCreateFence(m_device, &fenceInfo, nullptr, &m_open.fence);
+        EVK_ASSERT(result, "failed to create upload fence\n");
+    }
+    else
+    {
+        m_open.fence=m_freeFences.back();
+        m_freeFences.pop_back();
+        vkResetFences(m_device, 1, &m_open.fence);
+    }
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &m_open.commandBuffer;
+    result = vkQueueSubmit(m_queue, 1, &submitInfo, m_open.fence);
+    EVK_ASSERT(result, "failed to submit uploads\n");
+
+    m_submittedValue=m_open.value;
+    m_inFlight.push_back(std::move(m_open));
+    m_open=Batch();
+
+    // Free the staging memory of batches that have already finished.
+    retire(false, 0);
+    return m_submittedValue;
+}
+
+void Device::Uploader::retire(bool wait, uint64_t value) noexcept
+{
+    size_t numRetired = 0;
+    for (auto &batch : m_inFlight)
+    {
+        if (wait && batch.value<=value)
+            vkWaitForFences(m_device, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+        else if (vkGetFenceStatus(m_device, batch.fence)!=VK_SUCCESS) break;
+        release(batch);
+        m_completedValue=batch.value;
+        ++numRetired;
+    }
+    m_inFlight.erase(m_inFlight.begin(), m_inFlight.begin()+numRetired);
+}
+
+void Device::Uploader::release(Batch &batch) noexcept
+{
+    m_freeCommandBuffers.push_back(batch.commandBuffer);
+    m_freeFences.push_back(batch.fence);
+    releaseStaging(batch.staging);
+}
+
+void Device::Uploader::releaseStaging(
+    const std::vector<Staging> &staging
+) noexcept
+{
+    // Rewind blocks that no longer hold pending ranges.
+    for (const auto &s : staging)
+        if (--m_stagingBlocks[s.block].numPending==0) recycleBlock(s.block);
+}
+
+void Device::Uploader::update(
+    VkBuffer buffer,
+    const std::vector<VkBufferCopy> &regions,
+    const Staging &staging
+) noexcept
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Update update;
+    update.buffer=buffer;
+    update.regions=regions;
+    m_pendingUpdates.push_back(update);
+    m_pendingUpdateStaging.push_back(staging);
+}
+
+VkCommandBuffer Device::Uploader::recordUpdates(size_t frame) noexcept
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (frame>=m_frameUpdateStaging.size())
+    {
+        m_frameUpdateStaging.resize(frame+1);
+        m_updateCommandBuffers.resize(frame+1, VK_NULL_HANDLE);
+    }
+
+    // The frame's last updates have been copied.
+    releaseStaging(m_frameUpdateStaging[frame]);
+    m_frameUpdateStaging[frame].resize(0);
+    retire(false, 0);
+    const bool acquire =
+        m_separateFamily && m_completedValue>m_acquiredValue;
+    if (m_pendingUpdates.empty() && !acquire) return VK_NULL_HANDLE;
+
+    auto &commandBuffer = m_updateCommandBuffers[frame];
+    if (commandBuffer==VK_NULL_HANDLE)
+    {
+        VkCommandBufferAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = m_updateCommandPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+        auto result = vkAllocateCommandBuffers(
+            m_device, &allocInfo, &commandBuffer
+        );
+        EVK_ASSERT(result, "failed to allocate update command buffer\n");
+    }
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+    // The transfer queue made its writes available, and the host has seen
+    // them complete. They are made visible to this frame's draws.
+    if (acquire)
+    {
+        transferBarrier(
+            commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0,
+            DRAW_READ_STAGES, DRAW_READ_ACCESS
+        );
+        m_acquiredValue = m_completedValue;
+    }
+    if (m_pendingUpdates.empty())
+    {
+        vkEndCommandBuffer(commandBuffer);
+        return commandBuffer;
+    }
+
+    // Earlier frames may still be drawing from, or copying to, the buffers.
+    transferBarrier(
+        commandBuffer, DRAW_READ_STAGES | VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_ACCESS_TRANSFER_WRITE_BIT
+    );
+    std::vector<VkBuffer> written;
+    for (size_t i = 0; i < m_pendingUpdates.size(); ++i)
+    {
+        // Later updates of a buffer may overwrite earlier ones.
+        const auto &update = m_pendingUpdates[i];
+        if (std::find(written.begin(), written.end(), update.buffer)!=
+            written.end())
+        {
+            transferBarrier(
+                commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_ACCESS_TRANSFER_WRITE_BIT
+            );
+            written.resize(0);
+        }
+        written.push_back(update.buffer);
+        vkCmdCopyBuffer(
+            commandBuffer, m_pendingUpdateStaging[i].buffer, update.buffer,
+            update.regions.size(), update.regions.data()
+        );
+    }
+    transferBarrier(
+        commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_ACCESS_TRANSFER_WRITE_BIT, DRAW_READ_STAGES, DRAW_READ_ACCESS
+    );
+    vkEndCommandBuffer(commandBuffer);
+
+    m_frameUpdateStaging[frame].swap(m_pendingUpdateStaging);
+    m_pendingUpdates.resize(0);
+    return commandBuffer;
+}
+
+void Device::Uploader::releaseUpdates() noexcept
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto &staging : m_frameUpdateStaging)
+    {
+        releaseStaging(staging);
+        staging.resize(0);
+    }
+}
+
+} // namespace evk
@@ -15,7 +15,8 @@ void createImage(
     const VkImageUsageFlags &usage,
     const VkMemoryPropertyFlags &properties,
     VkImage *pImage,
-    VkDeviceMemory *pImageMemory
+    Allocation *pImageMemory,
+    const std::vector<uint32_t> &queueFamilies
 ) noexcept
 {
     VkImageCreateInfo imageInfo = {};
@@ -31,6 +32,12 @@ void createImage(
     imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
     imageInfo.usage = usage;
     imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if (queueFamilies.size()>1)
+    {
+        imageInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        imageInfo.queueFamilyIndexCount = queueFamilies.size();
+        imageInfo.pQueueFamilyIndices = queueFamilies.data();
+    }
     imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
     imageInfo.flags = 0;
 
@@ -39,17 +46,14 @@ void createImage(
 
     VkMemoryRequirements memRequirements;
     vkGetImageMemoryRequirements(device, *pImage, &memRequirements);
-    VkMemoryAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(
-        physicalDevice, memRequirements.memoryTypeBits, properties
+    *pImageMemory = Allocator::get(device, physicalDevice).allocate(
+        memRequirements, properties, true
     );
 
-    result = vkAllocateMemory(device, &allocInfo, nullptr, pImageMemory);
-    EVK_ASSERT(result, "failed to allocate image memory");
-
-    vkBindImageMemory(device, *pImage, *pImageMemory, 0);
+    result = vkBindImageMemory(
+        device, *pImage, pImageMemory->memory, pImageMemory->offset
+    );
+    EVK_ASSERT(result, "failed to bind image memory");
 }
 
 void createImageView(
@@ -82,7 +86,8 @@ void createBuffer(
     VkBufferUsageFlags usage,
     VkMemoryPropertyFlags properties,
     VkBuffer *pBuffer,
-    VkDeviceMemory *pBufferMemory
+    Allocation *pBufferMemory,
+    const std::vector<uint32_t> &queueFamilies
 ) noexcept
 {
     VkBufferCreateInfo bufferInfo = {};
@@ -90,26 +95,33 @@ void createBuffer(
     bufferInfo.size = size;
     bufferInfo.usage = usage;
     bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if (queueFamilies.size()>1)
+    {
+        bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        bufferInfo.queueFamilyIndexCount = queueFamilies.size();
+        bufferInfo.pQueueFamilyIndices = queueFamilies.data();
+    }
 
     auto result = vkCreateBuffer(device, &bufferInfo, nullptr, pBuffer);
     EVK_ASSERT(result,"failed to create buffer\n");
 
     VkMemoryRequirements memRequirements;
     vkGetBufferMemoryRequirements(device, *pBuffer, &memRequirements);
-
-    VkMemoryAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(
-        physicalDevice, memRequirements.memoryTypeBits, properties
+    *pBufferMemory = Allocator::get(device, physicalDevice).allocate(
+        memRequirements, properties, false
     );
 
-    result = vkAllocateMemory(device, &allocInfo, nullptr, pBufferMemory);
-    EVK_ASSERT(result, "failed to allocate buffer memory");
-    result = vkBindBufferMemory(device, *pBuffer, *pBufferMemory, 0);
+    result = vkBindBufferMemory(
+        device, *pBuffer, pBufferMemory->memory, pBufferMemory->offset
+    );
     EVK_ASSERT(result, "failed to bind buffer memory");
 }
 
+void freeMemory(const Allocation &allocation) noexcept
+{
+    if (allocation.allocator!=nullptr) allocation.allocator->free(allocation);
+}
+
 uint32_t findMemoryType(
     VkPhysicalDevice physicalDevice,
     uint32_t typeFilter,
@@ -235,6 +247,8 @@ QueueFamilyIndices findQueueFamilies(
         if (family.queueFlags & VK_QUEUE_GRAPHICS_BIT)
         {
             indices.graphicsFamily = i;
+            // Without a surface there is nothing to present to.
+            if (surface==VK_NULL_HANDLE) break;
             VkBool32 presentSupport = false;
             vkGetPhysicalDeviceSurfaceSupportKHR(
                 device, i, surface, &presentSupport
@@ -244,6 +258,17 @@ QueueFamilyIndices findQueueFamilies(
         if (indices.isComplete()) break;
         ++i;
     }
+
+    // Prefer a family with neither graphics nor compute support, which is
+    // the most likely to be a dedicated copy engine.
+    for (i = 0; i < queueFamilyCount; ++i)
+    {
+        const VkQueueFlags flags = queueFamilies[i].queueFlags;
+        if (!(flags & VK_QUEUE_TRANSFER_BIT)) continue;
+        if (flags & VK_QUEUE_GRAPHICS_BIT) continue;
+        if (indices.transferFamily<0 || !(flags & VK_QUEUE_COMPUTE_BIT))
+            indices.transferFamily = i;
+    }
     return indices;
 }
 
@@ -1,5 +1,9 @@
 #include "vertexinput.h"
 
+#include <cstring>
+#include <glm/gtc/packing.hpp>
+#include "vertex.h"
+
 namespace evk {
 
 VertexInput::VertexInput(uint32_t stride) noexcept
@@ -21,6 +25,14 @@ bool VertexInput::operator==(const VertexInput &other) const noexcept
         return false;
     if (m_bindingDescription.stride!=other.m_bindingDescription.stride)
         return false;
+    if (m_instanceBindingDescription.stride!=
+        other.m_instanceBindingDescription.stride)
+        return false;
+    const auto &streams = m_streamBindingDescriptions;
+    const auto &otherStreams = other.m_streamBindingDescriptions;
+    if (streams.size()!=otherStreams.size()) return false;
+    for (size_t i = 0; i < streams.size(); ++i)
+        if (streams[i].stride!=otherStreams[i].stride) return false;
     return true;
 }
 
@@ -46,27 +58,172 @@ void VertexInput::setVertexAttributeVec3(
     uint32_t offset
 ) noexcept
 {
-    VkVertexInputAttributeDescription desc;
-    desc.binding=0;
-    desc.location=location;
-    desc.format=VK_FORMAT_R32G32B32_SFLOAT;
-    desc.offset=offset;
-    setAttributeDescription(location, desc);
+    setAttribute(0, location, offset, Format::VEC3);
 }
 
 void VertexInput::setVertexAttributeVec2(
     uint32_t location,
     uint32_t offset
 ) noexcept
+{
+    setAttribute(0, location, offset, Format::VEC2);
+}
+
+void VertexInput::setVertexAttribute(
+    uint32_t location,
+    uint32_t offset,
+    Format format
+) noexcept
+{
+    setAttribute(0, location, offset, format);
+}
+
+void VertexInput::setStreamStride(uint32_t stream, uint32_t stride) noexcept
+{
+    if (stream==0)
+    {
+        setBindingDescription(stride);
+        return;
+    }
+    if (m_streamBindingDescriptions.size()<stream)
+        m_streamBindingDescriptions.resize(stream, {});
+    VkVertexInputBindingDescription bindingDescription = {};
+    bindingDescription.binding = streamBinding(stream);
+    bindingDescription.stride = stride;
+    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+    m_streamBindingDescriptions[stream-1]=bindingDescription;
+}
+
+void VertexInput::setStreamAttribute(
+    uint32_t stream,
+    uint32_t location,
+    uint32_t offset,
+    Format format
+) noexcept
+{
+    setAttribute(streamBinding(stream), location, offset, format);
+}
+
+void VertexInput::setInstanceStride(uint32_t stride) noexcept
+{
+    VkVertexInputBindingDescription bindingDescription = {};
+    bindingDescription.binding = 1;
+    bindingDescription.stride = stride;
+    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+    m_instanceBindingDescription=bindingDescription;
+}
+
+void VertexInput::setInstanceAttributeVec3(
+    uint32_t location,
+    uint32_t offset
+) noexcept
+{
+    setAttribute(1, location, offset, Format::VEC3);
+}
+
+void VertexInput::setInstanceAttributeVec4(
+    uint32_t location,
+    uint32_t offset
+) noexcept
+{
+    setAttribute(1, location, offset, Format::VEC4);
+}
+
+void VertexInput::setInstanceAttributeMat4(
+    uint32_t location,
+    uint32_t offset
+) noexcept
+{
+    const uint32_t columnSize = 4*sizeof(float);
+    for (uint32_t column = 0; column < 4; ++column)
+        setInstanceAttributeVec4(location+column, offset+column*columnSize);
+}
+
+void VertexInput::setInstanceAttribute(
+    uint32_t location,
+    uint32_t offset,
+    Format format
+) noexcept
+{
+    setAttribute(1, location, offset, format);
+}
+
+uint32_t VertexInput::formatSize(Format format) noexcept
+{
+    switch(format)
+    {
+        case Format::VEC2:
+        case Format::HALF4:
+            return 8;
+        case Format::VEC3:
+            return 12;
+        case Format::VEC4:
+            return 16;
+        case Format::HALF2:
+        case Format::UNORM16_2:
+        case Format::SNORM8_4:
+        case Format::UNORM8_4:
+        case Format::SNORM_10_10_10_2:
+        case Format::UNORM_10_10_10_2:
+            return 4;
+    }
+}
+
+VkFormat VertexInput::vkFormat(Format format) noexcept
+{
+    switch(format)
+    {
+        case Format::VEC2:
+            return VK_FORMAT_R32G32_SFLOAT;
+        case Format::VEC3:
+            return VK_FORMAT_R32G32B32_SFLOAT;
+        case Format::VEC4:
+            return VK_FORMAT_R32G32B32A32_SFLOAT;
+        case Format::HALF2:
+            return VK_FORMAT_R16G16_SFLOAT;
+        case Format::HALF4:
+            return VK_FORMAT_R16G16B16A16_SFLOAT;
+        case Format::UNORM16_2:
+            return VK_FORMAT_R16G16_UNORM;
+        case Format::SNORM8_4:
+            return VK_FORMAT_R8G8B8A8_SNORM;
+        case Format::UNORM8_4:
+            return VK_FORMAT_R8G8B8A8_UNORM;
+        case Format::SNORM_10_10_10_2:
+            return VK_FORMAT_A2B10G10R10_SNORM_PACK32;
+        case Format::UNORM_10_10_10_2:
+            return VK_FORMAT_A2B10G10R10_UNORM_PACK32;
+    }
+}
+
+void VertexInput::setAttribute(
+    uint32_t binding,
+    uint32_t location,
+    uint32_t offset,
+    Format format
+) noexcept
 {
     VkVertexInputAttributeDescription desc;
-    desc.binding=0;
+    desc.binding=binding;
     desc.location=location;
-    desc.format=VK_FORMAT_R32G32_SFLOAT;
+    desc.format=vkFormat(format);
     desc.offset=offset;
     setAttributeDescription(location, desc);
 }
 
+std::vector<VkVertexInputBindingDescription> VertexInput::bindingDescriptions()
+    const noexcept
+{
+    std::vector<VkVertexInputBindingDescription> descriptions = {
+        m_bindingDescription
+    };
+    if (m_instanceBindingDescription.stride>0)
+        descriptions.push_back(m_instanceBindingDescription);
+    for (const auto &description : m_streamBindingDescriptions)
+        if (description.stride>0) descriptions.push_back(description);
+    return descriptions;
+}
+
 void VertexInput::setAttributeDescription(
     uint32_t location,
     VkVertexInputAttributeDescription desc
@@ -86,4 +243,126 @@ void VertexInput::setBindingDescription(uint32_t stride) noexcept
     m_bindingDescription=bindingDescription;
 }
 
-} // namespace evk
\ No newline at end of file
+bool VertexLayout::operator==(const VertexLayout &other) const noexcept
+{
+    if (m_stride!=other.m_stride) return false;
+    if (m_elements.size()!=other.m_elements.size()) return false;
+    for (size_t i = 0; i < m_elements.size(); ++i)
+    {
+        if (m_elements[i].attribute!=other.m_elements[i].attribute)
+            return false;
+        if (m_elements[i].format!=other.m_elements[i].format) return false;
+    }
+    return true;
+}
+
+bool VertexLayout::operator!=(const VertexLayout &other) const noexcept
+{
+    return !(*this==other);
+}
+
+void VertexLayout::add(
+    Attribute attribute,
+    VertexInput::Format format
+) noexcept
+{
+    // Every Format is a multiple of 4 bytes, so attributes stay aligned.
+    Element element;
+    element.attribute=attribute;
+    element.format=format;
+    element.offset=m_stride;
+    m_elements.push_back(element);
+    m_stride+=VertexInput::formatSize(format);
+}
+
+VertexInput VertexLayout::vertexInput() const noexcept
+{
+    VertexInput vertexInput(m_stride);
+    for (uint32_t location = 0; location < m_elements.size(); ++location)
+    {
+        const auto &element = m_elements[location];
+        vertexInput.setVertexAttribute(
+            location, element.offset, element.format
+        );
+    }
+    return vertexInput;
+}
+
+void VertexLayout::pack(
+    const Vertex *vertices,
+    size_t numVertices,
+    void *dst
+) const noexcept
+{
+    using Format = VertexInput::Format;
+    auto *bytes = static_cast<unsigned char*>(dst);
+    for (size_t i = 0; i < numVertices; ++i)
+    {
+        const Vertex &vertex = vertices[i];
+        unsigned char *packed = bytes+i*m_stride;
+        for (const auto &element : m_elements)
+        {
+            // Missing components are 0, except a w of 1 for positions and
+            // colors.
+            glm::vec4 value;
+            switch(element.attribute)
+            {
+                case Attribute::POSITION:
+                    value=glm::vec4(vertex.pos, 1.0f);
+                    break;
+                case Attribute::COLOR:
+                    value=glm::vec4(vertex.color, 1.0f);
+                    break;
+                case Attribute::TEX_COORD:
+                    value=glm::vec4(
+                        vertex.texCoord.x, vertex.texCoord.y, 0.0f, 0.0f
+                    );
+                    break;
+                case Attribute::NORMAL:
+                    value=glm::vec4(vertex.normal, 0.0f);
+                    break;
+            }
+
+            const glm::vec2 xy(value.x, value.y);
+            unsigned char *out = packed+element.offset;
+            uint32_t word=0;
+            switch(element.format)
+            {
+                case Format::VEC2:
+                case Format::VEC3:
+                case Format::VEC4:
+                    memcpy(
+                        out, &value.x, VertexInput::formatSize(element.format)
+                    );
+                    continue;
+                case Format::HALF4:
+                {
+                    const uint64_t halves = glm::packHalf4x16(value);
+                    memcpy(out, &halves, sizeof(halves));
+                    continue;
+                }
+                case Format::HALF2:
+                    word=glm::packHalf2x16(xy);
+                    break;
+                case Format::UNORM16_2:
+                    word=glm::packUnorm2x16(xy);
+                    break;
+                case Format::SNORM8_4:
+                    word=glm::packSnorm4x8(value);
+                    break;
+                case Format::UNORM8_4:
+                    word=glm::packUnorm4x8(value);
+                    break;
+                case Format::SNORM_10_10_10_2:
+                    word=glm::packSnorm3x10_1x2(value);
+                    break;
+                case Format::UNORM_10_10_10_2:
+                    word=glm::packUnorm3x10_1x2(value);
+                    break;
+            }
+            memcpy(out, &word, sizeof(word));
+        }
+    }
+}
+
+} // namespace evk
@@ -0,0 +1,112 @@
+#include "evulkan.h"
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <gtest/gtest.h>
+
+using namespace internal;
+
+namespace evk {
+
+class AllocatorTest : public  ::testing::Test
+{
+    protected:
+    virtual void SetUp() override
+    {
+        glfwInit();
+        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+        glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
+        window=glfwCreateWindow(800, 600, "Vulkan", nullptr, nullptr);
+        device = {1, deviceExtensions, 2, validationLayers};
+        uint32_t glfwExtensionCount = 0;
+        auto glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+        std::vector<const char*> surfaceExtensions(
+            glfwExtensions, glfwExtensions + glfwExtensionCount
+        );
+        auto surfaceFunc = [&](){
+            glfwCreateWindowSurface(
+                device.instance(), window, nullptr, &device.surface()
+            );
+        };
+        device.createSurface(surfaceFunc,800,600,surfaceExtensions);
+    }
+
+    virtual void TearDown() override
+    {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+    }
+
+    std::vector<const char*> deviceExtensions = 
+    {
+        VK_KHR_SWAPCHAIN_EXTENSION_NAME
+    };
+    std::vector<const char*> validationLayers =
+    {
+        "VK_LAYER_LUNARG_standard_validation"
+    };
+
+    GLFWwindow *window;
+    Device device;
+};
+
+TEST_F(AllocatorTest, freeList)
+{
+    FreeList freeList(1024);
+    VkDeviceSize a, b, c;
+
+    // Ranges are placed first-fit at aligned offsets.
+    EXPECT_TRUE(freeList.allocate(100, 1, &a));
+    EXPECT_EQ(a, 0);
+    EXPECT_TRUE(freeList.allocate(100, 256, &b));
+    EXPECT_EQ(b, 256);
+    EXPECT_TRUE(freeList.allocate(100, 4, &c));
+    EXPECT_EQ(c, 100); // Fits in the padding before b.
+    EXPECT_EQ(freeList.used(), 300);
+    EXPECT_FALSE(freeList.allocate(1024, 1, &a));
+
+    // Freed ranges merge with their free neighbours.
+    freeList.free(b, 100);
+    freeList.free(0, 100);
+    EXPECT_EQ(freeList.numFreeRanges(), 2);
+    freeList.free(c, 100);
+    EXPECT_EQ(freeList.numFreeRanges(), 1);
+    EXPECT_EQ(freeList.largestFreeRange(), 1024);
+    EXPECT_EQ(freeList.used(), 0);
+}
+
+TEST_F(AllocatorTest, allocate)
+{
+    auto stats = device.memoryStats();
+    const uint32_t numDeviceAllocations = stats.numDeviceAllocations;
+
+    // Small buffers share a block of device memory.
+    std::vector<VkBuffer> buffers(100);
+    std::vector<Allocation> memory(buffers.size());
+    for (size_t i=0; i<buffers.size(); ++i)
+    {
+        createBuffer(
+            device.device(), device.physicalDevice(), 256,
+            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            &buffers[i], &memory[i]
+        );
+        EXPECT_TRUE(memory[i].data);
+        EXPECT_EQ(memory[i].memory, memory[0].memory);
+    }
+    stats = device.memoryStats();
+    EXPECT_EQ(stats.numDeviceAllocations, numDeviceAllocations+1);
+    EXPECT_EQ(stats.numAllocations, buffers.size());
+
+    for (size_t i=0; i<buffers.size(); ++i)
+    {
+        vkDestroyBuffer(device.device(), buffers[i], nullptr);
+        freeMemory(memory[i]);
+    }
+    stats = device.memoryStats();
+    EXPECT_EQ(stats.numAllocations, 0);
+    EXPECT_EQ(stats.bytesUsed, 0);
+}
+
+} // namespace evk
@@ -62,12 +62,12 @@ TEST_F(AttachmentTest, ctor)
     b=Attachment(device, 1, Attachment::Type::COLOR);
     EXPECT_TRUE(b.m_image);
     EXPECT_TRUE(b.m_imageView);
-    EXPECT_TRUE(b.m_imageMemory);
+    EXPECT_TRUE(b.m_imageMemory.memory);
 
     c=Attachment(device, 2, Attachment::Type::DEPTH);
     EXPECT_TRUE(c.m_image);
     EXPECT_TRUE(c.m_imageView);
-    EXPECT_TRUE(c.m_imageMemory);
+    EXPECT_TRUE(c.m_imageMemory.memory);
 
     EXPECT_TRUE(b==b);
     EXPECT_FALSE(b!=b);
@@ -96,7 +96,7 @@ TEST_F(AttachmentTest, move)
     EXPECT_EQ(b.index(),0);
     
     if (b.m_image!=VK_NULL_HANDLE) FAIL();
-    if (b.m_imageMemory!=VK_NULL_HANDLE) FAIL();
+    if (b.m_imageMemory.memory!=VK_NULL_HANDLE) FAIL();
     if (b.m_imageView!=VK_NULL_HANDLE) FAIL();
 }
 
@@ -4,6 +4,9 @@
 #include <GLFW/glfw3.h>
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <atomic>
+
 namespace evk {
 
 class BufferTest : public  ::testing::Test
@@ -61,7 +64,7 @@ TEST_F(BufferTest, ctor)
         device, &data, sizeof(data), 1, Buffer::Type::UBO
     );
     EXPECT_TRUE(dynamicBuffer.buffer());
-    EXPECT_TRUE(dynamicBuffer.m_bufferMemory);
+    EXPECT_TRUE(dynamicBuffer.m_bufferMemory.memory);
     EXPECT_EQ(dynamicBuffer.m_bufferSize, sizeof(data));
     EXPECT_TRUE(dynamicBuffer.m_device);
     EXPECT_EQ(dynamicBuffer.m_numElements, 1);
@@ -75,7 +78,7 @@ TEST_F(BufferTest, ctor)
         device, &data, sizeof(data), 1, Buffer::Type::VERTEX
     );
     EXPECT_TRUE(staticBuffer.buffer());
-    EXPECT_TRUE(staticBuffer.m_bufferMemory);
+    EXPECT_TRUE(staticBuffer.m_bufferMemory.memory);
     EXPECT_EQ(staticBuffer.m_bufferSize, sizeof(data));
     EXPECT_TRUE(staticBuffer.m_device);
     EXPECT_EQ(staticBuffer.m_numElements, 1);
@@ -84,6 +87,41 @@ TEST_F(BufferTest, ctor)
     EXPECT_TRUE(staticBuffer.m_queue);
     EXPECT_TRUE(staticBuffer==staticBuffer);
     EXPECT_FALSE(staticBuffer!=staticBuffer);
+
+    // Buffers point back to the Device, which counts them so that it is not
+    // moved from under them.
+    EXPECT_EQ(device.m_numBuffers, 2);
+    StaticBuffer movedBuffer = std::move(staticBuffer);
+    EXPECT_EQ(device.m_numBuffers, 2);
+}
+
+TEST_F(BufferTest, indexType)
+{
+    // Indices that fit in 16 bits are stored as 16-bit indices.
+    std::vector<uint32_t> indices = {0, 1, 2, 2, 3, 65535};
+    StaticBuffer narrow(device, indices);
+    EXPECT_EQ(narrow.m_indexType, VK_INDEX_TYPE_UINT16);
+    EXPECT_EQ(narrow.m_elementSize, sizeof(uint16_t));
+    EXPECT_EQ(narrow.m_bufferSize, indices.size()*sizeof(uint16_t));
+    EXPECT_EQ(narrow.m_numElements, indices.size());
+
+    indices.push_back(65536);
+    StaticBuffer wide(device, indices);
+    EXPECT_EQ(wide.m_indexType, VK_INDEX_TYPE_UINT32);
+    EXPECT_EQ(wide.m_bufferSize, indices.size()*sizeof(uint32_t));
+
+    // Otherwise the element size gives the index type.
+    std::vector<uint16_t> indices16 = {0, 1, 2};
+    StaticBuffer span(
+        device, indices16.data(), sizeof(indices16[0]), indices16.size(),
+        Buffer::Type::INDEX
+    );
+    EXPECT_EQ(span.m_indexType, VK_INDEX_TYPE_UINT16);
+    StaticBuffer vertex(
+        device, indices16.data(), sizeof(indices16[0]), indices16.size(),
+        Buffer::Type::VERTEX
+    );
+    EXPECT_EQ(vertex.m_indexType, VK_INDEX_TYPE_UINT32);
 }
 
 TEST_F(BufferTest, update)
@@ -91,19 +129,52 @@ TEST_F(BufferTest, update)
     struct Data{int a;};
     Data data{0};
     DynamicBuffer dynamic(device, &data, sizeof(data), 1, Buffer::Type::UBO);
-    ASSERT_EQ(static_cast<Data*>(dynamic.m_bufferData)->a, data.a);
+    auto region = [&dynamic](uint32_t i)
+    {
+        auto *regions = static_cast<char*>(dynamic.m_bufferMemory.data);
+        return reinterpret_cast<Data*>(regions+dynamic.dynamicOffset(i));
+    };
+    ASSERT_EQ(dynamic.m_numRegions, 2);
+    ASSERT_EQ(region(0)->a, data.a);
     data.a=1;
-    EXPECT_EQ(static_cast<Data*>(dynamic.m_bufferData)->a, 0);
+    EXPECT_EQ(region(0)->a, 0);
+    // Without pipelines nothing is in flight, so every region is written.
     dynamic.update(&data);
-    EXPECT_EQ(static_cast<Data*>(dynamic.m_bufferData)->a, 1);
+    for (uint32_t i = 0; i < dynamic.m_numRegions; ++i)
+        EXPECT_EQ(region(i)->a, 1);
+}
 
-    data.a=0;
-    StaticBuffer staticBuffer(
-        device, &data, sizeof(data), 1, Buffer::Type::UBO
+TEST_F(BufferTest, ownership)
+{
+    std::vector<uint32_t> data(100, 7);
+    DataSpan span{data.data(), sizeof(data[0]), data.size()};
+
+    StaticBuffer released(device, span, Buffer::Type::VERTEX);
+    EXPECT_TRUE(released.buffer());
+    EXPECT_EQ(released.m_bufferSize, sizeof(data[0])*data.size());
+    EXPECT_FALSE(released.m_fill);
+
+    StaticBuffer borrowed(
+        device, span, Buffer::Type::VERTEX, StaticBuffer::Ownership::BORROW
     );
-    ASSERT_EQ(static_cast<Data*>(staticBuffer.m_bufferData)->a, data.a);
-    data.a=1;
-    EXPECT_EQ(static_cast<Data*>(staticBuffer.m_bufferData)->a, 0);
+    EXPECT_TRUE(borrowed.m_fill);
+    std::vector<uint32_t> dst(data.size());
+    borrowed.m_fill(dst.data(), 0, dst.size());
+    EXPECT_EQ(dst, data);
+
+    // The callback covers every element, once per upload.
+    std::atomic<size_t> numFilled{0};
+    auto fill = [&numFilled](void *dst, size_t, size_t numElements)
+    {
+        std::fill_n(static_cast<uint32_t*>(dst), numElements, 7);
+        numFilled+=numElements;
+    };
+    StaticBuffer callback(
+        device, fill, sizeof(uint32_t), data.size(), Buffer::Type::VERTEX
+    );
+    EXPECT_EQ(numFilled, data.size());
+    callback.reupload(device);
+    EXPECT_EQ(numFilled, 2*data.size());
 }
 
 } // namespace evk
\ No newline at end of file
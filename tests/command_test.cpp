@@ -62,14 +62,121 @@ TEST_F(CommandTest, ctor)
     EXPECT_EQ(
         commands->m_primaryCommandBuffers.size(), swapchainSize
     );
+    EXPECT_TRUE(commands->m_secondaryCommandBuffers.empty());
+
+    const size_t numSubpasses = 2;
+    commands->allocateSecondaries(numSubpasses);
     EXPECT_EQ(
-        commands->m_secondaryCommandBuffers.size(), numThreads
+        commands->m_secondaryCommandBuffers.size(), swapchainSize
     );
+    for (const auto &cbs : commands->m_secondaryCommandBuffers)
+    {
+        EXPECT_EQ(cbs.size(), numSubpasses*numThreads);
+        for (const auto &cb : cbs) EXPECT_TRUE(cb);
+    }
+
+    // Buffers are reused while the number of subpasses is unchanged.
+    auto secondaryCommandBuffers = commands->m_secondaryCommandBuffers;
+    commands->allocateSecondaries(numSubpasses);
+    EXPECT_EQ(commands->m_secondaryCommandBuffers, secondaryCommandBuffers);
+
+    commands->allocateSecondaries(numSubpasses+1);
+    for (const auto &cbs : commands->m_secondaryCommandBuffers)
+        EXPECT_EQ(cbs.size(), (numSubpasses+1)*numThreads);
+
+    commands->freeSecondaries();
+    EXPECT_TRUE(commands->m_secondaryCommandBuffers.empty());
 
     EXPECT_TRUE(commands==commands);
     EXPECT_FALSE(commands!=commands);
 }
 
+TEST_F(CommandTest, frames)
+{
+    const uint32_t numThreads = 2;
+    const uint32_t swapchainSize = 2;
+    device = {
+        numThreads, deviceExtensions,
+        swapchainSize, validationLayers
+    };
+    uint32_t glfwExtensionCount = 0;
+    auto glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    std::vector<const char*> surfaceExtensions(
+        glfwExtensions, glfwExtensions + glfwExtensionCount
+    );
+    auto surfaceFunc = [&](){
+        glfwCreateWindowSurface(
+            device.instance(), window, nullptr, &device.surface()
+        );
+    };
+    device.createSurface(surfaceFunc,800,600,surfaceExtensions);
+
+    auto &commands = device.m_commands;
+    EXPECT_TRUE(commands->m_frameCommandPools.empty());
+
+    const uint32_t maxFramesInFlight = 3;
+    const size_t numSubpasses = 2;
+    commands->allocateFrames(maxFramesInFlight, numSubpasses);
+
+    EXPECT_EQ(commands->m_frameCommandPools.size(), maxFramesInFlight);
+    EXPECT_EQ(
+        commands->m_framePrimaryCommandBuffers.size(), maxFramesInFlight
+    );
+    EXPECT_EQ(
+        commands->m_frameSecondaryCommandBuffers.size(), maxFramesInFlight
+    );
+    for (const auto &pools : commands->m_frameCommandPools)
+    {
+        EXPECT_EQ(pools.size(), numThreads);
+        for (const auto &p : pools) EXPECT_TRUE(p);
+    }
+    for (const auto &cb : commands->m_framePrimaryCommandBuffers)
+        EXPECT_TRUE(cb);
+    for (const auto &cbs : commands->m_frameSecondaryCommandBuffers)
+    {
+        EXPECT_EQ(cbs.size(), numSubpasses*numThreads);
+        for (const auto &cb : cbs) EXPECT_TRUE(cb);
+    }
+
+    commands->destroyFrames();
+    EXPECT_TRUE(commands->m_frameCommandPools.empty());
+    EXPECT_TRUE(commands->m_framePrimaryCommandBuffers.empty());
+    EXPECT_TRUE(commands->m_frameSecondaryCommandBuffers.empty());
+}
+
+TEST_F(CommandTest, indirectCommands)
+{
+    const uint32_t numThreads = 1;
+    const uint32_t swapchainSize = 2;
+    device = {
+        numThreads, deviceExtensions,
+        swapchainSize, validationLayers
+    };
+    uint32_t glfwExtensionCount = 0;
+    auto glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    std::vector<const char*> surfaceExtensions(
+        glfwExtensions, glfwExtensions + glfwExtensionCount
+    );
+    auto surfaceFunc = [&](){
+        glfwCreateWindowSurface(
+            device.instance(), window, nullptr, &device.surface()
+        );
+    };
+    device.createSurface(surfaceFunc,800,600,surfaceExtensions);
+
+    auto &commands = device.m_commands;
+    EXPECT_EQ(commands->m_indirectBuffer, VK_NULL_HANDLE);
+
+    std::vector<VkDrawIndexedIndirectCommand> indirectCommands(4);
+    commands->writeIndirectCommands(indirectCommands);
+    EXPECT_NE(commands->m_indirectBuffer, VK_NULL_HANDLE);
+    EXPECT_NE(commands->m_indirectBufferMemory.memory, VK_NULL_HANDLE);
+
+    commands->destroyIndirectCommands();
+    EXPECT_EQ(commands->m_indirectBuffer, VK_NULL_HANDLE);
+    EXPECT_EQ(commands->m_indirectBufferMemory.memory, VK_NULL_HANDLE);
+}
+
 TEST_F(CommandTest, move)
 {
     const uint32_t numThreads = 2;
@@ -98,9 +205,7 @@ TEST_F(CommandTest, move)
     EXPECT_EQ(
         commands->m_primaryCommandBuffers.size(), swapchainSize
     );
-    EXPECT_EQ(
-        commands->m_secondaryCommandBuffers.size(), numThreads
-    );
+    EXPECT_TRUE(commands->m_secondaryCommandBuffers.empty());
 }
 
 } // namespace evk
\ No newline at end of file
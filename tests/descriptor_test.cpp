@@ -63,11 +63,14 @@ TEST_F(DescriptorTest, ctor)
     EXPECT_EQ(descriptor.m_swapchainSize,2);
     EXPECT_EQ(descriptor.m_writeSetVertex.size(),0);
     EXPECT_EQ(descriptor.m_writeSetFragment.size(),0);
-    EXPECT_EQ(descriptor.m_poolSizes.size(),3);
+    EXPECT_EQ(descriptor.m_poolSizes.size(),6);
     auto types = {
         Descriptor::Type::INPUT_ATTACHMENT,
         Descriptor::Type::TEXTURE_SAMPLER,
-        Descriptor::Type::UNIFORM_BUFFER
+        Descriptor::Type::UNIFORM_BUFFER,
+        Descriptor::Type::UNIFORM_BUFFER_DYNAMIC,
+        Descriptor::Type::STORAGE_BUFFER,
+        Descriptor::Type::STORAGE_BUFFER_DYNAMIC
     };
     for (const auto &t : types)
     {
@@ -94,4 +97,62 @@ TEST_F(DescriptorTest, multipleUniformBuffers)
     EXPECT_EQ(descriptor.m_bufferInfo.size(), 2);
 }
 
+TEST_F(DescriptorTest, dynamicUniformBuffers)
+{
+    struct UniformBuffer {float a[3];};
+    UniformBuffer a{};
+
+    DynamicBuffer uboA(device, &a, sizeof(a), 1, Buffer::Type::UBO);
+    DynamicBuffer uboB(device, &a, sizeof(a), 1, Buffer::Type::UBO);
+
+    descriptor.addUniformBuffer(1, uboA, Shader::Stage::FRAGMENT);
+    descriptor.addUniformBuffer(1, uboB, Shader::Stage::VERTEX);
+    descriptor.addUniformBuffer(0, uboA, Shader::Stage::VERTEX);
+
+    auto index = static_cast<uint32_t>(Descriptor::Type::UNIFORM_BUFFER_DYNAMIC);
+    EXPECT_EQ(descriptor.m_poolSizes[index].descriptorCount, 3*2);
+
+    // Offsets are ordered by set, then binding.
+    auto offsets = descriptor.dynamicOffsets(1);
+    ASSERT_EQ(offsets.size(), 3);
+    EXPECT_GE(offsets[0], sizeof(a));
+    EXPECT_EQ(offsets[1], offsets[0]);
+    EXPECT_EQ(offsets[2], offsets[0]);
+    EXPECT_EQ(descriptor.dynamicOffsets(0), std::vector<uint32_t>(3, 0));
+}
+
+TEST_F(DescriptorTest, storageBuffers)
+{
+    std::vector<float> transforms(16*1000, 1.0f);
+    StaticBuffer objects(
+        device, transforms.data(), sizeof(transforms[0]), transforms.size(),
+        Buffer::Type::STORAGE
+    );
+    DynamicBuffer frameObjects(
+        device, transforms.data(), sizeof(transforms[0]), transforms.size(),
+        Buffer::Type::STORAGE
+    );
+
+    descriptor.addStorageBuffer(0, objects, Shader::Stage::VERTEX);
+    descriptor.addStorageBuffer(1, frameObjects, Shader::Stage::VERTEX);
+
+    auto index = static_cast<uint32_t>(Descriptor::Type::STORAGE_BUFFER);
+    EXPECT_EQ(descriptor.m_poolSizes[index].descriptorCount, 2);
+    index = static_cast<uint32_t>(Descriptor::Type::STORAGE_BUFFER_DYNAMIC);
+    EXPECT_EQ(descriptor.m_poolSizes[index].descriptorCount, 2);
+    ASSERT_EQ(descriptor.m_writeSetVertex.size(), 2);
+    EXPECT_EQ(
+        descriptor.m_writeSetVertex[0].descriptorType,
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
+    );
+    EXPECT_EQ(
+        descriptor.m_writeSetVertex[1].descriptorType,
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC
+    );
+    EXPECT_EQ(descriptor.dynamicOffsets(0), std::vector<uint32_t>(1, 0));
+    EXPECT_GE(
+        descriptor.dynamicOffsets(1)[0], sizeof(transforms[0])*transforms.size()
+    );
+}
+
 } // namespace evk
\ No newline at end of file
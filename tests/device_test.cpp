@@ -1,5 +1,9 @@
 #include "evulkan.h"
 
+#include <cstdio>
+#include <fstream>
+#include <thread>
+
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 #include <gtest/gtest.h>
@@ -32,6 +36,77 @@ class DeviceTest : public  ::testing::Test
         "VK_LAYER_LUNARG_standard_validation"
     };
     GLFWwindow *window;
+
+    // A triangle of one color, drawn by a headless Device without a depth
+    // buffer. The indices are repeated numCopies times, so that each copy
+    // can be added as a mesh before finalize().
+    struct HeadlessTriangle
+    {
+        HeadlessTriangle(
+            Device &device, const glm::vec3 &color, size_t numCopies=1
+        ) : device(device)
+        {
+            std::vector<Vertex> vertices(3);
+            vertices[0].pos={0,-0.5,0};
+            vertices[1].pos={-0.5,0.5,0};
+            vertices[2].pos={0.5,0.5,0};
+            for (auto &v : vertices) v.color=color;
+            std::vector<uint32_t> indices;
+            for (size_t i = 0; i < numCopies; ++i)
+                indices.insert(indices.end(), {0,1,2});
+
+            framebufferAttachment = Attachment(
+                device, 0, Attachment::Type::FRAMEBUFFER
+            );
+            std::vector<Attachment*> colorAttachments = {&framebufferAttachment};
+            std::vector<Attachment*> depthAttachments;
+            std::vector<Attachment*> inputAttachments;
+            std::vector<Subpass::Dependency> dependencies;
+            subpass = Subpass(
+                0, dependencies, colorAttachments, depthAttachments,
+                inputAttachments
+            );
+            std::vector<Subpass*> subpasses = {&subpass};
+            renderpass = Renderpass(device, subpasses);
+
+            vertexInput = VertexInput(sizeof(Vertex));
+            vertexInput.setVertexAttributeVec3(0,offsetof(Vertex,pos));
+            vertexInput.setVertexAttributeVec3(1,offsetof(Vertex,color));
+            indexBuffer = StaticBuffer(device, indices);
+            vertexBuffer = StaticBuffer(
+                device, vertices.data(), sizeof(vertices[0]), vertices.size(),
+                Buffer::Type::VERTEX
+            );
+            vertexShader = Shader(
+                device, "shader_vert.spv", Shader::Stage::VERTEX
+            );
+            fragmentShader = Shader(
+                device, "shader_frag.spv", Shader::Stage::FRAGMENT
+            );
+            std::vector<Shader*> shaders = {&vertexShader,&fragmentShader};
+            pipeline = Pipeline(
+                device, subpass, vertexInput, renderpass, shaders
+            );
+            pipelines = {&pipeline};
+        }
+
+        void finalize()
+        {
+            device.finalize(indexBuffer,vertexBuffer,pipelines);
+        }
+
+        Device &device;
+        Attachment framebufferAttachment;
+        Subpass subpass;
+        Renderpass renderpass;
+        VertexInput vertexInput;
+        StaticBuffer indexBuffer;
+        StaticBuffer vertexBuffer;
+        Shader vertexShader;
+        Shader fragmentShader;
+        Pipeline pipeline;
+        std::vector<Pipeline*> pipelines;
+    };
 };
 
 
@@ -221,8 +296,413 @@ TEST_F(DeviceTest, draw)
     Pipeline pipeline(device, subpass, vertexInput, renderpass, shaders);
     std::vector<Pipeline*> pipelines = {&pipeline};
     
+    EXPECT_EQ(device.addMesh(0,3,0),0);
     device.finalize(indexBuffer,vertexBuffer,pipelines);
+    EXPECT_EQ(device.m_drawPartitions.size(),numThreads);
+    EXPECT_EQ(device.m_currentFrame,0);
+    device.draw();
+    EXPECT_EQ(device.m_currentFrame,1);
+    device.draw();
+    EXPECT_EQ(device.m_currentFrame,0);
+
+    device.setRecordMode(Device::RecordMode::PER_FRAME);
+    device.draw();
+    EXPECT_EQ(device.m_currentFrame,1);
+    device.draw();
+    EXPECT_EQ(device.m_currentFrame,0);
+    device.wait();
+}
+
+TEST_F(DeviceTest, headless)
+{
+    // No surface or swapchain extensions are needed.
+    const uint32_t swapchainSize = 2;
+    Device device(1, {}, swapchainSize, validationLayers);
+    device.createHeadless(64,64);
+    EXPECT_EQ(device.m_swapchain.get(), nullptr);
+    ASSERT_NE(device.m_offscreen.get(), nullptr);
+    EXPECT_EQ(device.m_offscreen->m_images.size(), swapchainSize);
+    EXPECT_EQ(device.extent().width, 64);
+
+    HeadlessTriangle triangle(device, {1,0,0});
+    EXPECT_EQ(
+        triangle.framebufferAttachment.m_description.finalLayout,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+    );
+    triangle.finalize();
+
+    EXPECT_EQ(device.frameValue(), 0);
+    device.draw();
+    EXPECT_EQ(device.frameValue(), 1);
+    device.waitForFrame(1);
+    EXPECT_TRUE(device.frameComplete(1));
+    EXPECT_FALSE(device.frameComplete(2));
+
+    // The centre of the image is covered by the red triangle.
+    std::vector<uint8_t> pixels(64*64*4);
+    EXPECT_TRUE(device.readFrame(1, pixels.data()));
+    const size_t centre = (32*64+32)*4;
+    EXPECT_EQ(pixels[centre+2], 255); // B8G8R8A8, so red is the third byte.
+    EXPECT_EQ(pixels[centre], 0);
+    EXPECT_FALSE(device.readFrame(2, pixels.data()));
+
+    // Each image of the ring keeps only the frame last drawn into it.
+    device.draw();
+    device.draw();
+    EXPECT_EQ(device.frameValue(), 3);
+    EXPECT_FALSE(device.readFrame(1, pixels.data()));
+    EXPECT_TRUE(device.readFrame(3, pixels.data()));
+
+    // A resize keeps the pipeline, whose viewport and scissor are dynamic.
+    const VkPipeline handle = triangle.pipeline.m_pipeline;
+    device.resizeWindow();
+    EXPECT_EQ(triangle.pipeline.m_pipeline, handle);
+    device.draw();
+    device.waitForFrame(device.frameValue());
+    EXPECT_TRUE(device.frameComplete(4));
+}
+
+TEST_F(DeviceTest, concurrent)
+{
+    // Each Device is driven by its own thread, for a different number of
+    // frames, and records its frame state after every draw.
+    struct FrameState
+    {
+        size_t currentFrame;
+        uint64_t frameValue;
+    };
+    auto run = [](Device &device, size_t numFrames)
+    {
+        std::vector<FrameState> states;
+        for (size_t i = 0; i < numFrames; ++i)
+        {
+            device.draw();
+            states.push_back({device.m_currentFrame, device.frameValue()});
+        }
+        device.wait();
+        return states;
+    };
+
+    Device device0(1, {}, 2, validationLayers);
+    device0.createHeadless(64,64);
+    device0.setMaxFramesInFlight(2);
+    HeadlessTriangle triangle0(device0, {1,0,0});
+    triangle0.finalize();
+    Device device1(1, {}, 3, validationLayers);
+    device1.createHeadless(64,64);
+    device1.setMaxFramesInFlight(3);
+    HeadlessTriangle triangle1(device1, {0,1,0});
+    triangle1.finalize();
+
+    std::vector<FrameState> states0, states1;
+    std::thread thread0([&](){ states0 = run(device0, 5); });
+    std::thread thread1([&](){ states1 = run(device1, 8); });
+    thread0.join();
+    thread1.join();
+
+    ASSERT_EQ(states0.size(), 5);
+    for (size_t i = 0; i < states0.size(); ++i)
+    {
+        EXPECT_EQ(states0[i].currentFrame, (i+1)%2);
+        EXPECT_EQ(states0[i].frameValue, i+1);
+    }
+    ASSERT_EQ(states1.size(), 8);
+    for (size_t i = 0; i < states1.size(); ++i)
+    {
+        EXPECT_EQ(states1[i].currentFrame, (i+1)%3);
+        EXPECT_EQ(states1[i].frameValue, i+1);
+    }
+    EXPECT_TRUE(device0.frameComplete(5));
+    EXPECT_TRUE(device1.frameComplete(8));
+}
+
+TEST_F(DeviceTest, readback)
+{
+    Device device(1, {}, 3, validationLayers);
+    device.createHeadless(64,64);
+    HeadlessTriangle triangle(device, {0,1,0});
+    triangle.finalize();
+
+    std::vector<uint64_t> frames;
+    std::vector<uint8_t> centre;
+    device.setReadback([&](uint64_t frame, const void *pixels, VkExtent2D extent)
+    {
+        frames.push_back(frame);
+        const auto *p = static_cast<const uint8_t*>(pixels);
+        centre.push_back(p[(extent.height/2*extent.width+extent.width/2)*4+1]);
+    });
+    ASSERT_NE(device.m_readback.get(), nullptr);
+    EXPECT_EQ(device.m_readback->m_buffers.size(), device.maxFramesInFlight());
+
+    // A frame is delivered when its frame in flight is next waited on.
+    device.draw();
+    device.draw();
+    EXPECT_TRUE(frames.empty());
     device.draw();
+    ASSERT_EQ(frames.size(), 1);
+    EXPECT_EQ(frames[0], 1);
+    EXPECT_EQ(centre[0], 255);
+
+    // Waiting for a frame delivers every frame up to it, in order.
+    device.waitForFrame(device.frameValue());
+    EXPECT_EQ(frames, std::vector<uint64_t>({1,2,3}));
+
+    device.setReadback(nullptr);
+    EXPECT_EQ(device.m_readback.get(), nullptr);
+    device.draw();
+    device.waitForFrame(device.frameValue());
+    EXPECT_EQ(frames.size(), 3);
+}
+
+TEST_F(DeviceTest, regions)
+{
+    Device device(1, {}, 2, validationLayers);
+    device.createHeadless(64,64);
+    HeadlessTriangle triangle(device, {1,0,0});
+    struct Data{int a;};
+    Data data{0};
+    DynamicBuffer ubo(device, &data, sizeof(data), 1, Buffer::Type::UBO);
+    auto region = [&ubo](uint32_t i)
+    {
+        auto *regions = static_cast<char*>(ubo.m_bufferMemory.data);
+        return reinterpret_cast<Data*>(regions+ubo.dynamicOffset(i));
+    };
+    ASSERT_EQ(ubo.m_numRegions, 2);
+    triangle.finalize();
+
+    // An update is written to the region of the next draw only.
+    data.a=1;
+    ubo.update(&data);
+    const uint32_t first = device.m_imageIndex;
+    EXPECT_EQ(region(first)->a, 1);
+    EXPECT_EQ(region(1-first)->a, 0);
+    EXPECT_EQ(device.m_staleRegions.size(), 1);
+
+    // The other region catches up once its image is acquired.
+    device.draw();
+    device.draw();
+    EXPECT_EQ(region(0)->a, 1);
+    EXPECT_EQ(region(1)->a, 1);
+    EXPECT_TRUE(device.m_staleRegions.empty());
+
+    // A destroyed Buffer leaves nothing to refresh.
+    {
+        DynamicBuffer other(device, &data, sizeof(data), 1, Buffer::Type::UBO);
+        other.update(&data);
+        EXPECT_EQ(device.m_staleRegions.size(), 1);
+        device.wait();
+    }
+    EXPECT_TRUE(device.m_staleRegions.empty());
+    device.draw();
+    device.wait();
+}
+
+TEST_F(DeviceTest, pipelineCache)
+{
+    const std::string fileName = "pipeline_cache_test.bin";
+    std::remove(fileName.c_str());
+    VkPhysicalDeviceProperties properties;
+    {
+        Device device(1, {}, 2, validationLayers);
+        device.createHeadless(64,64);
+        ASSERT_NE(device.m_pipelineCache.get(), nullptr);
+        EXPECT_TRUE(device.pipelineCache());
+        vkGetPhysicalDeviceProperties(device.physicalDevice(), &properties);
+
+        // A missing file leaves an empty cache to be saved on shutdown.
+        device.setPipelineCacheFile(fileName);
+        EXPECT_TRUE(device.pipelineCache());
+        EXPECT_EQ(device.m_pipelineCache->m_fileName, fileName);
+    }
+
+    std::ifstream file(fileName, std::ios::ate | std::ios::binary);
+    ASSERT_TRUE(file.is_open());
+    std::vector<char> data(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(data.data(), data.size());
+    file.close();
+    EXPECT_TRUE(Device::PipelineCache::validHeader(data, properties));
+
+    // Data from another device or a truncated file is rejected.
+    std::vector<char> other = data;
+    other[16] = ~other[16];
+    EXPECT_FALSE(Device::PipelineCache::validHeader(other, properties));
+    other.assign(data.begin(), data.begin()+16);
+    EXPECT_FALSE(Device::PipelineCache::validHeader(other, properties));
+
+    // The saved cache is loaded by the next run.
+    {
+        Device device(1, {}, 2, validationLayers);
+        device.createHeadless(64,64);
+        device.setPipelineCacheFile(fileName);
+        EXPECT_TRUE(device.pipelineCache());
+    }
+    std::remove(fileName.c_str());
+}
+
+TEST_F(DeviceTest, cull)
+{
+    Device device(1, {}, 2, validationLayers);
+    device.createHeadless(64,64);
+    HeadlessTriangle triangle(device, {1,0,0}, 2);
+
+    // The frustum is the cube from -1 to 1, as planes (normal, distance).
+    std::vector<glm::vec4> planes = {
+        {1,0,0,1}, {-1,0,0,1}, {0,1,0,1}, {0,-1,0,1}, {0,0,1,1}, {0,0,-1,1}
+    };
+    DynamicBuffer camera(
+        device, planes.data(), sizeof(planes[0]), planes.size(),
+        Buffer::Type::UBO
+    );
+    Shader cullShader(device, "cull_comp.spv", Shader::Stage::COMPUTE);
+    std::vector<Device::BoundingSphere> boundingSpheres(2);
+    boundingSpheres[0].center={0,0,0};
+    boundingSpheres[0].radius=0.5f;
+    boundingSpheres[1].center={10,0,0};
+    boundingSpheres[1].radius=0.5f;
+
+    device.addMesh(0,3,0);
+    device.addMesh(3,3,0);
+    device.setCulling(cullShader, camera, boundingSpheres);
+    triangle.finalize();
+    ASSERT_NE(device.m_cull.get(), nullptr);
+    ASSERT_EQ(device.m_cull->m_numDraws, 2);
+
+    device.draw();
+    device.waitForFrame(device.frameValue());
+
+    // The culled commands live in device memory, so they are copied out.
+    const VkDeviceSize size = 2*sizeof(VkDrawIndexedIndirectCommand);
+    VkBuffer readBuffer;
+    internal::Allocation readMemory;
+    internal::createBuffer(
+        device.device(), device.physicalDevice(), size,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        &readBuffer, &readMemory
+    );
+    VkCommandPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.queueFamilyIndex = device.m_device->m_graphicsFamily;
+    VkCommandPool commandPool;
+    vkCreateCommandPool(device.device(), &poolInfo, nullptr, &commandPool);
+    VkCommandBuffer commandBuffer;
+    internal::beginSingleTimeCommands(
+        device.device(), commandPool, &commandBuffer
+    );
+    VkBufferCopy region = {};
+    region.size = size;
+    vkCmdCopyBuffer(
+        commandBuffer, device.m_cull->m_drawCommandBuffer, readBuffer, 1,
+        &region
+    );
+    internal::endSingleTimeCommands(
+        device.device(), device.graphicsQueue(), commandPool, commandBuffer
+    );
+
+    const auto *commands =
+        static_cast<const VkDrawIndexedIndirectCommand*>(readMemory.data);
+    EXPECT_EQ(commands[0].indexCount, 3);
+    EXPECT_NE(commands[0].instanceCount, 0);
+    EXPECT_EQ(commands[1].indexCount, 3);
+    EXPECT_EQ(commands[1].firstIndex, 3);
+    EXPECT_EQ(commands[1].instanceCount, 0);
+
+    vkDestroyCommandPool(device.device(), commandPool, nullptr);
+    vkDestroyBuffer(device.device(), readBuffer, nullptr);
+    internal::freeMemory(readMemory);
+}
+
+TEST_F(DeviceTest, partitionDrawItems)
+{
+    // A single item is split evenly on triangle boundaries.
+    Device::DrawItem item;
+    item.numIndices=30000;
+    auto parts = Device::partitionDrawItems({item}, 4);
+    ASSERT_EQ(parts.size(), 4);
+    uint32_t firstIndex=0;
+    for (const auto &part : parts)
+    {
+        ASSERT_EQ(part.size(), 1);
+        EXPECT_EQ(part[0].firstIndex, firstIndex);
+        EXPECT_EQ(part[0].numIndices%3, 0);
+        EXPECT_NEAR(part[0].numIndices, 7500, 300);
+        firstIndex+=part[0].numIndices;
+    }
+    EXPECT_EQ(firstIndex, 30000);
+
+    // Many small items are kept whole and dealt out in equal numbers.
+    std::vector<Device::DrawItem> items(1000);
+    for (size_t i=0; i<items.size(); ++i)
+    {
+        items[i].firstIndex=i*36;
+        items[i].numIndices=36;
+    }
+    parts = Device::partitionDrawItems(items, 3);
+    ASSERT_EQ(parts.size(), 3);
+    size_t numItems=0;
+    for (const auto &part : parts)
+    {
+        EXPECT_NEAR(part.size(), 333, 1);
+        for (const auto &drawItem : part)
+        {
+            EXPECT_EQ(drawItem.firstIndex, numItems*36);
+            EXPECT_EQ(drawItem.numIndices, 36);
+            ++numItems;
+        }
+    }
+    EXPECT_EQ(numItems, items.size());
+
+    // Split items keep their vertex offset.
+    item.vertexOffset=8;
+    parts = Device::partitionDrawItems({item}, 2);
+    for (const auto &part : parts)
+        for (const auto &drawItem : part) EXPECT_EQ(drawItem.vertexOffset, 8);
+
+    // One large item among small ones is split, the rest stay whole.
+    items.resize(10);
+    items.back().numIndices=36000;
+    parts = Device::partitionDrawItems(items, 2);
+    numItems=0;
+    uint32_t numIndices=0;
+    for (const auto &part : parts)
+    {
+        numItems+=part.size();
+        for (const auto &drawItem : part) numIndices+=drawItem.numIndices;
+    }
+    EXPECT_EQ(numItems, 11);
+    EXPECT_EQ(numIndices, 9*36+36000);
+
+    // Instanced items cost once per instance.
+    items.resize(2);
+    items[0].firstIndex=0;
+    items[0].numIndices=3000;
+    items[0].numInstances=3;
+    items[1].firstIndex=3000;
+    items[1].numIndices=9000;
+    parts = Device::partitionDrawItems(items, 2);
+    ASSERT_EQ(parts[0].size(), 1);
+    ASSERT_EQ(parts[1].size(), 1);
+    EXPECT_EQ(parts[0][0].numInstances, 3);
+    EXPECT_EQ(parts[1][0].numIndices, 9000);
+}
+
+TEST_F(DeviceTest, drawItemIndices)
+{
+    // The second item is split in two, the first and third are whole.
+    std::vector<Device::DrawItem> items(3);
+    items[0].numIndices=36;
+    items[1].firstIndex=36;
+    items[1].numIndices=30000;
+    items[2].firstIndex=30036;
+    items[2].numIndices=36;
+    auto parts = Device::partitionDrawItems(items, 2);
+    ASSERT_EQ(parts[0].size(), 2);
+    ASSERT_EQ(parts[1].size(), 2);
+
+    auto indices = Device::drawItemIndices(items, parts);
+    std::vector<uint32_t> expected = {0,1,1,2};
+    EXPECT_EQ(indices, expected);
 }
 
-} // namespace evk
\ No newline at end of file
+} // namespace evk
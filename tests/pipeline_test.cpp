@@ -156,4 +156,30 @@ TEST_F(PipelineTest,ctor)
     EXPECT_TRUE(pipeline0!=pipeline1);
 }
 
+TEST_F(PipelineTest,deferred)
+{
+    pipeline0 = {
+        device, subpass, vertexInput, renderpass, shaders,
+        Pipeline::Build::DEFERRED
+    };
+    pipeline1 = {
+        device, subpass, vertexInput, renderpass, shaders,
+        Pipeline::Build::DEFERRED
+    };
+    EXPECT_TRUE(pipeline0.m_layout);
+    EXPECT_FALSE(pipeline0.m_pipeline);
+    EXPECT_FALSE(pipeline1.m_pipeline);
+
+    std::vector<Pipeline*> pipelines = {&pipeline0, &pipeline1};
+    device.buildPipelines(pipelines);
+    EXPECT_TRUE(pipeline0.m_pipeline);
+    EXPECT_TRUE(pipeline1.m_pipeline);
+    EXPECT_NE(pipeline0.m_pipeline, pipeline1.m_pipeline);
+
+    // Compiled Pipelines are kept.
+    const VkPipeline handle = pipeline0.m_pipeline;
+    device.buildPipelines(pipelines);
+    EXPECT_EQ(pipeline0.m_pipeline, handle);
+}
+
 } // namespace evk
\ No newline at end of file
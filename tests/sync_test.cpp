@@ -57,11 +57,43 @@ TEST_F(SyncTest,ctor)
     for (const auto &s : sync->m_imageAvailableSemaphores) EXPECT_TRUE(s);
     for (const auto &f : sync->m_imagesInFlight) EXPECT_TRUE(f==VK_NULL_HANDLE);
     for (const auto &s : sync->m_renderFinishedSemaphores) EXPECT_TRUE(s);
+    EXPECT_EQ(sync->m_fencesInFlight.size(),device.m_maxFramesInFlight);
+    EXPECT_EQ(sync->m_imagesInFlight.size(),2);
 
     EXPECT_TRUE(sync==sync);
     EXPECT_FALSE(sync!=sync);
 }
 
+TEST_F(SyncTest,maxFramesInFlight)
+{
+    device = {1, deviceExtensions, 2, validationLayers};
+    device.setMaxFramesInFlight(3);
+    uint32_t glfwExtensionCount = 0;
+    auto glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    std::vector<const char*> surfaceExtensions(
+        glfwExtensions, glfwExtensions + glfwExtensionCount
+    );
+    auto surfaceFunc = [&](){
+        glfwCreateWindowSurface(
+            device.instance(), window, nullptr, &device.surface()
+        );
+    };
+    device.createSurface(surfaceFunc,800,600,surfaceExtensions);
+
+    auto &sync = device.m_sync;
+    EXPECT_EQ(sync->m_fencesInFlight.size(),3);
+    EXPECT_EQ(sync->m_imageAvailableSemaphores.size(),3);
+    EXPECT_EQ(sync->m_renderFinishedSemaphores.size(),3);
+    EXPECT_EQ(sync->m_imagesInFlight.size(),2);
+
+    device.setMaxFramesInFlight(1);
+    EXPECT_EQ(sync->m_fencesInFlight.size(),1);
+    EXPECT_EQ(sync->m_imageAvailableSemaphores.size(),1);
+    EXPECT_EQ(sync->m_renderFinishedSemaphores.size(),1);
+    EXPECT_EQ(sync->m_imagesInFlight.size(),2);
+    for (const auto &f : sync->m_fencesInFlight) EXPECT_TRUE(f);
+}
+
 TEST_F(SyncTest,move)
 {
     device = {1, deviceExtensions, 2, validationLayers};
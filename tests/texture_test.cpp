@@ -57,7 +57,7 @@ TEST_F(TextureTest,ctor)
     EXPECT_TRUE(texture.m_image);
     EXPECT_TRUE(texture.m_imageSampler);
     EXPECT_TRUE(texture.m_imageView);
-    EXPECT_TRUE(texture.m_memory);
+    EXPECT_TRUE(texture.m_memory.memory);
 
     EXPECT_TRUE(texture==texture);
     EXPECT_FALSE(texture!=texture);
@@ -78,14 +78,14 @@ TEST_F(TextureTest,move)
     EXPECT_TRUE(texture1.m_image);
     EXPECT_TRUE(texture1.m_imageSampler);
     EXPECT_TRUE(texture1.m_imageView);
-    EXPECT_TRUE(texture1.m_memory);
+    EXPECT_TRUE(texture1.m_memory.memory);
 
     texture=std::move(texture1);
     EXPECT_TRUE(texture.m_device);
     EXPECT_TRUE(texture.m_image);
     EXPECT_TRUE(texture.m_imageSampler);
     EXPECT_TRUE(texture.m_imageView);
-    EXPECT_TRUE(texture.m_memory);
+    EXPECT_TRUE(texture.m_memory.memory);
 }
 
 } // namespace evk
\ No newline at end of file
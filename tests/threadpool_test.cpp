@@ -0,0 +1,72 @@
+#include "threadpool.h"
+
+#include <gtest/gtest.h>
+
+TEST(ThreadPoolTest, parallelFor)
+{
+    const uint32_t numJobs = 37;
+    for (uint32_t numThreads = 0; numThreads <= 4; ++numThreads)
+    {
+        ThreadPool pool;
+        pool.setThreadCount(numThreads);
+        EXPECT_EQ(pool.threadCount(), numThreads);
+
+        std::vector<uint32_t> results(numJobs, 0);
+        pool.parallelFor(numJobs, [&](uint32_t i){ results[i]=i+1; });
+        for (uint32_t i = 0; i < numJobs; ++i) EXPECT_EQ(results[i], i+1);
+    }
+}
+
+TEST(ThreadPoolTest, counter)
+{
+    ThreadPool pool;
+    pool.setThreadCount(4);
+
+    std::atomic<uint32_t> sum{0};
+    std::function<void(uint32_t)> add = [&](uint32_t i){ sum+=i; };
+    JobCounter counter;
+    pool.addJobs(0, 10, add, counter);
+    pool.addJobs(10, 20, add, counter);
+    pool.wait(counter);
+    EXPECT_EQ(counter.count(), 0);
+    EXPECT_EQ(sum, 190);
+}
+
+TEST(ThreadPoolTest, addJob)
+{
+    ThreadPool pool;
+    pool.setThreadCount(2);
+
+    std::atomic<uint32_t> count{0};
+    JobCounter counter;
+    for (uint32_t i = 0; i < 3000; ++i) pool.addJob([&count](){ count++; }, counter);
+    pool.wait(counter);
+    EXPECT_EQ(count, 3000);
+}
+
+TEST(ThreadPoolTest, nested)
+{
+    ThreadPool pool;
+    pool.setThreadCount(2);
+
+    std::atomic<uint32_t> count{0};
+    pool.parallelFor(8, [&](uint32_t){
+        pool.parallelFor(8, [&](uint32_t){ count++; });
+    });
+    EXPECT_EQ(count, 64);
+}
+
+TEST(ThreadPoolTest, move)
+{
+    ThreadPool pool;
+    pool.setThreadCount(2);
+
+    ThreadPool pool1;
+    pool1 = std::move(pool);
+    EXPECT_EQ(pool1.threadCount(), 2);
+    EXPECT_EQ(pool.threadCount(), 0);
+
+    std::atomic<uint32_t> count{0};
+    pool1.parallelFor(4, [&](uint32_t){ count++; });
+    EXPECT_EQ(count, 4);
+}
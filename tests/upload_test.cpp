@@ -0,0 +1,184 @@
+#include "evulkan.h"
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <gtest/gtest.h>
+
+namespace evk {
+
+class UploaderTest : public  ::testing::Test
+{
+    protected:
+    virtual void SetUp() override
+    {
+        glfwInit();
+        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+        glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
+        window=glfwCreateWindow(800, 600, "Vulkan", nullptr, nullptr);
+
+        device = {2, deviceExtensions, 2, validationLayers};
+        uint32_t glfwExtensionCount = 0;
+        auto glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+        std::vector<const char*> surfaceExtensions(
+            glfwExtensions, glfwExtensions + glfwExtensionCount
+        );
+        auto surfaceFunc = [&](){
+            glfwCreateWindowSurface(
+                device.instance(), window, nullptr, &device.surface()
+            );
+        };
+        device.createSurface(surfaceFunc,800,600,surfaceExtensions);
+    }
+
+    virtual void TearDown() override
+    {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+    }
+
+    std::vector<const char*> deviceExtensions =
+    {
+        VK_KHR_SWAPCHAIN_EXTENSION_NAME
+    };
+    std::vector<const char*> validationLayers =
+    {
+        "VK_LAYER_LUNARG_standard_validation"
+    };
+
+    GLFWwindow *window;
+    Device device;
+};
+
+TEST_F(UploaderTest,batch)
+{
+    auto &uploader = device.m_uploader;
+    EXPECT_TRUE(uploader->m_commandPool);
+    EXPECT_TRUE(uploader->m_queue);
+    EXPECT_EQ(uploader->m_submittedValue, 0);
+
+    // Uploads recorded together share a batch and an upload value.
+    std::vector<uint32_t> data(64, 1);
+    StaticBuffer a(
+        device, data.data(), sizeof(data[0]), data.size(), Buffer::Type::VERTEX
+    );
+    StaticBuffer b(
+        device, data.data(), sizeof(data[0]), data.size(), Buffer::Type::INDEX
+    );
+    EXPECT_EQ(a.uploadValue(), 1);
+    EXPECT_EQ(b.uploadValue(), 1);
+    EXPECT_TRUE(uploader->m_open.commandBuffer);
+    EXPECT_EQ(uploader->m_open.staging.size(), 2*device.numThreads());
+    EXPECT_FALSE(device.uploadComplete(1));
+
+    EXPECT_EQ(device.flushUploads(), 1);
+    EXPECT_FALSE(uploader->m_open.commandBuffer);
+    device.waitForUploads(1);
+    EXPECT_TRUE(device.uploadComplete(1));
+    EXPECT_EQ(uploader->m_inFlight.size(), 0);
+
+    // Nothing is submitted without new uploads.
+    EXPECT_EQ(device.flushUploads(), 1);
+
+    Texture texture(device, "viking_room.png");
+    EXPECT_EQ(texture.uploadValue(), 2);
+    device.waitForUploads(texture.uploadValue());
+    EXPECT_TRUE(device.uploadComplete(2));
+
+    // Uploads on a separate transfer family are made visible to the draws
+    // of the next frame, once.
+    const bool separate =
+        device.m_device->m_transferFamily!=device.m_device->m_graphicsFamily;
+    EXPECT_EQ(uploader->m_separateFamily, separate);
+    EXPECT_EQ(uploader->recordUpdates(0)!=VK_NULL_HANDLE, separate);
+    EXPECT_EQ(uploader->m_acquiredValue, separate ? 2 : 0);
+    EXPECT_FALSE(uploader->recordUpdates(0));
+}
+
+TEST_F(UploaderTest,move)
+{
+    auto &uploader = device.m_uploader;
+    const VkCommandPool commandPool = uploader->m_commandPool;
+
+    Device::Uploader uploader1 = std::move(*uploader);
+    EXPECT_EQ(uploader1.m_commandPool, commandPool);
+    EXPECT_TRUE(uploader1.m_device);
+    EXPECT_FALSE(uploader->m_commandPool);
+    EXPECT_FALSE(uploader->m_device);
+
+    *uploader = std::move(uploader1);
+    EXPECT_EQ(uploader->m_commandPool, commandPool);
+    EXPECT_FALSE(uploader1.m_device);
+}
+
+TEST_F(UploaderTest,staging)
+{
+    auto &uploader = device.m_uploader;
+    EXPECT_EQ(uploader->m_stagingBlocks.size(), 0);
+
+    // Ranges are allocated from one block, at aligned offsets.
+    std::vector<uint32_t> data(1000, 1);
+    StaticBuffer a(
+        device, data.data(), sizeof(data[0]), data.size(), Buffer::Type::VERTEX
+    );
+    EXPECT_EQ(uploader->m_stagingBlocks.size(), 1);
+    EXPECT_EQ(uploader->m_currentBlock, 0);
+    for (const auto &s : uploader->m_open.staging)
+    {
+        EXPECT_EQ(s.block, 0);
+        EXPECT_EQ(s.offset%uploader->m_stagingAlignment, 0);
+    }
+    EXPECT_EQ(uploader->m_stagingBlocks[0].numPending, device.numThreads());
+    device.waitForUploads(device.flushUploads());
+    EXPECT_EQ(uploader->m_stagingBlocks[0].numPending, 0);
+    EXPECT_EQ(uploader->m_stagingBlocks[0].head, 0);
+    EXPECT_EQ(uploader->m_freeCommandBuffers.size(), 1);
+    EXPECT_EQ(uploader->m_freeFences.size(), 1);
+
+    // A second upload reuses the block, command buffer and fence.
+    const VkBuffer block = uploader->m_stagingBlocks[0].buffer;
+    StaticBuffer b(
+        device, data.data(), sizeof(data[0]), data.size(), Buffer::Type::VERTEX
+    );
+    EXPECT_EQ(uploader->m_stagingBlocks.size(), 1);
+    EXPECT_EQ(uploader->m_stagingBlocks[0].buffer, block);
+    EXPECT_EQ(uploader->m_freeCommandBuffers.size(), 0);
+    device.waitForUploads(device.flushUploads());
+    EXPECT_EQ(uploader->m_freeFences.size(), 1);
+    EXPECT_EQ(uploader->m_stagingBlocks.size(), 1);
+}
+
+TEST_F(UploaderTest,updates)
+{
+    auto &uploader = device.m_uploader;
+    std::vector<uint32_t> data(1024, 1);
+    StaticBuffer buffer(
+        device, data.data(), sizeof(data[0]), data.size(), Buffer::Type::VERTEX
+    );
+    device.waitForUploads(device.flushUploads());
+
+    // Overlapping and adjacent ranges are merged into one copy region each.
+    buffer.update(16, 64, data.data());
+    buffer.updateRanges({{512, 128}, {0, 32}, {32, 32}, {600, 100}}, data.data());
+    ASSERT_EQ(uploader->m_pendingUpdates.size(), 2);
+    EXPECT_EQ(uploader->m_pendingUpdates[0].regions.size(), 1);
+    EXPECT_EQ(uploader->m_pendingUpdates[0].regions[0].dstOffset, 16);
+    const auto &regions = uploader->m_pendingUpdates[1].regions;
+    ASSERT_EQ(regions.size(), 2);
+    EXPECT_EQ(regions[0].dstOffset, 0);
+    EXPECT_EQ(regions[0].size, 64);
+    EXPECT_EQ(regions[1].dstOffset, 512);
+    EXPECT_EQ(regions[1].size, 188);
+    EXPECT_EQ(regions[1].srcOffset-regions[0].srcOffset, 64);
+
+    // The copies are recorded for the next frame, whose staging is held
+    // until that frame comes round again.
+    const auto block = uploader->m_pendingUpdateStaging[0].block;
+    EXPECT_TRUE(uploader->recordUpdates(0));
+    EXPECT_EQ(uploader->m_pendingUpdates.size(), 0);
+    EXPECT_EQ(uploader->m_frameUpdateStaging[0].size(), 2);
+    EXPECT_EQ(uploader->m_stagingBlocks[block].numPending, 2);
+    EXPECT_FALSE(uploader->recordUpdates(0));
+    EXPECT_EQ(uploader->m_stagingBlocks[block].numPending, 0);
+}
+
+} // namespace evk
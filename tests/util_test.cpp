@@ -53,7 +53,7 @@ class UtilTest : public  ::testing::Test
 TEST_F(UtilTest, createImage)
 {
     VkImage image;
-    VkDeviceMemory memory;
+    Allocation memory;
 
     // Test color attachment image creation.
     createImage(
@@ -64,9 +64,9 @@ TEST_F(UtilTest, createImage)
         &image, &memory
     );
     EXPECT_TRUE(image);
-    EXPECT_TRUE(memory);
+    EXPECT_TRUE(memory.memory);
     vkDestroyImage(device.device(), image, nullptr);
-    vkFreeMemory(device.device(), memory, nullptr);
+    freeMemory(memory);
 
     // Test depth stencil attachment image creation.
     createImage(
@@ -77,16 +77,16 @@ TEST_F(UtilTest, createImage)
         &image, &memory
     );
     EXPECT_TRUE(image);
-    EXPECT_TRUE(memory);
+    EXPECT_TRUE(memory.memory);
     vkDestroyImage(device.device(), image, nullptr);
-    vkFreeMemory(device.device(), memory, nullptr);
+    freeMemory(memory);
 }
 
 TEST_F(UtilTest, createImageView)
 {
     VkImage image;
     VkImageView imageView;
-    VkDeviceMemory memory;
+    Allocation memory;
 
     // Test color attachment image view creation.
     createImage(
@@ -103,7 +103,7 @@ TEST_F(UtilTest, createImageView)
     EXPECT_TRUE(imageView);
     vkDestroyImageView(device.device(), imageView, nullptr);
     vkDestroyImage(device.device(), image, nullptr);
-    vkFreeMemory(device.device(), memory, nullptr);
+    freeMemory(memory);
 
     // Test depth stencil attachment image view creation.
     createImage(
@@ -120,13 +120,13 @@ TEST_F(UtilTest, createImageView)
     EXPECT_TRUE(imageView);
     vkDestroyImageView(device.device(), imageView, nullptr);
     vkDestroyImage(device.device(), image, nullptr);
-    vkFreeMemory(device.device(), memory, nullptr);
+    freeMemory(memory);
 }
 
 TEST_F(UtilTest, createBuffer)
 {
     VkBuffer buffer;
-    VkDeviceMemory memory;
+    Allocation memory;
 
     VkBufferUsageFlags usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
     VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
@@ -135,9 +135,9 @@ TEST_F(UtilTest, createBuffer)
         &memory 
     );
     EXPECT_TRUE(buffer);
-    EXPECT_TRUE(memory);
+    EXPECT_TRUE(memory.memory);
     vkDestroyBuffer(device.device(),buffer,nullptr);
-    vkFreeMemory(device.device(), memory, nullptr);
+    freeMemory(memory);
 
     usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
     properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
@@ -146,9 +146,9 @@ TEST_F(UtilTest, createBuffer)
         &memory 
     );
     EXPECT_TRUE(buffer);
-    EXPECT_TRUE(memory);
+    EXPECT_TRUE(memory.memory);
     vkDestroyBuffer(device.device(),buffer,nullptr);
-    vkFreeMemory(device.device(), memory, nullptr);
+    freeMemory(memory);
 }
 
 TEST_F(UtilTest, findMemoryType)
@@ -240,6 +240,14 @@ TEST_F(UtilTest, findQueueFamilies)
         device.surface(), &presentSupport
     );
     EXPECT_TRUE(presentSupport);
+
+    // Check a transfer queue, if any, is separate from graphics.
+    if (families.transferFamily>=0)
+    {
+        selectedFamily = expected[families.transferFamily];
+        EXPECT_TRUE(selectedFamily.queueFlags & VK_QUEUE_TRANSFER_BIT);
+        EXPECT_FALSE(selectedFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT);
+    }
 }
 
 bool capabilitiesEqual(
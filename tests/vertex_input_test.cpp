@@ -67,4 +67,129 @@ TEST_F(VertexInputTest, ctor)
     EXPECT_FALSE(v!=v);
 }
 
-} // namespace evk
\ No newline at end of file
+TEST_F(VertexInputTest, instance)
+{
+    VertexInput v(100);
+    EXPECT_EQ(v.bindingDescriptions().size(),1);
+
+    v.setInstanceStride(64);
+    auto &instanceBinding = v.m_instanceBindingDescription;
+    EXPECT_EQ(instanceBinding.binding,1);
+    EXPECT_EQ(instanceBinding.stride,64);
+    EXPECT_EQ(instanceBinding.inputRate,VK_VERTEX_INPUT_RATE_INSTANCE);
+    EXPECT_EQ(v.bindingDescriptions().size(),2);
+
+    auto &attributeDescriptions = v.m_attributeDescriptions;
+    v.setVertexAttributeVec3(0,0);
+    v.setInstanceAttributeMat4(1,0); // A matrix takes four locations.
+    EXPECT_EQ(attributeDescriptions.size(),5);
+    for (uint32_t i=0; i<4; ++i)
+    {
+        EXPECT_EQ(attributeDescriptions[i+1].location,i+1);
+        EXPECT_EQ(attributeDescriptions[i+1].binding,1);
+        EXPECT_EQ(attributeDescriptions[i+1].format,VK_FORMAT_R32G32B32A32_SFLOAT);
+        EXPECT_EQ(attributeDescriptions[i+1].offset,i*16);
+    }
+    EXPECT_EQ(attributeDescriptions[0].binding,0);
+
+    VertexInput w(100);
+    EXPECT_TRUE(v!=w);
+}
+
+TEST_F(VertexInputTest, formats)
+{
+    VertexInput v(20);
+    auto &attributeDescriptions = v.m_attributeDescriptions;
+    v.setVertexAttribute(0,0,VertexInput::Format::VEC3);
+    v.setVertexAttribute(1,12,VertexInput::Format::SNORM_10_10_10_2);
+    v.setVertexAttribute(2,16,VertexInput::Format::HALF2);
+    v.setInstanceAttribute(3,0,VertexInput::Format::UNORM8_4);
+    EXPECT_EQ(attributeDescriptions.size(),4);
+    EXPECT_EQ(attributeDescriptions[0].format,VK_FORMAT_R32G32B32_SFLOAT);
+    EXPECT_EQ(
+        attributeDescriptions[1].format,VK_FORMAT_A2B10G10R10_SNORM_PACK32
+    );
+    EXPECT_EQ(attributeDescriptions[1].offset,12);
+    EXPECT_EQ(attributeDescriptions[2].format,VK_FORMAT_R16G16_SFLOAT);
+    EXPECT_EQ(attributeDescriptions[2].binding,0);
+    EXPECT_EQ(attributeDescriptions[3].format,VK_FORMAT_R8G8B8A8_UNORM);
+    EXPECT_EQ(attributeDescriptions[3].binding,1);
+
+    EXPECT_EQ(VertexInput::formatSize(VertexInput::Format::VEC3),12);
+    EXPECT_EQ(VertexInput::formatSize(VertexInput::Format::HALF4),8);
+    EXPECT_EQ(VertexInput::formatSize(VertexInput::Format::UNORM8_4),4);
+}
+
+TEST_F(VertexInputTest, layout)
+{
+    VertexLayout layout;
+    layout.add(VertexLayout::Attribute::POSITION, VertexInput::Format::VEC3);
+    layout.add(
+        VertexLayout::Attribute::NORMAL, VertexInput::Format::SNORM_10_10_10_2
+    );
+    layout.add(VertexLayout::Attribute::TEX_COORD, VertexInput::Format::HALF2);
+    EXPECT_EQ(layout.stride(),20);
+    EXPECT_EQ(layout.m_elements[1].offset,12);
+    EXPECT_EQ(layout.m_elements[2].offset,16);
+
+    VertexInput v = layout.vertexInput();
+    EXPECT_EQ(v.m_bindingDescription.stride,20);
+    EXPECT_EQ(v.m_attributeDescriptions.size(),3);
+    EXPECT_EQ(
+        v.m_attributeDescriptions[1].format,VK_FORMAT_A2B10G10R10_SNORM_PACK32
+    );
+    EXPECT_EQ(v.m_attributeDescriptions[2].offset,16);
+
+    Vertex vertices[2] = {};
+    vertices[0].pos={1.0f,2.0f,3.0f};
+    vertices[0].normal={0.0f,0.0f,1.0f};
+    vertices[1].pos={4.0f,5.0f,6.0f};
+    vertices[1].texCoord={1.0f,0.5f};
+    std::vector<unsigned char> packed(2*layout.stride());
+    layout.pack(vertices, 2, packed.data());
+
+    float pos[3];
+    memcpy(pos, &packed[20], sizeof(pos));
+    EXPECT_FLOAT_EQ(pos[0],4.0f);
+    EXPECT_FLOAT_EQ(pos[2],6.0f);
+    uint32_t normal;
+    memcpy(&normal, &packed[12], sizeof(normal));
+    EXPECT_EQ(normal, 511u<<20); // z=1 is the largest 10-bit SNORM.
+    uint32_t texCoord;
+    memcpy(&texCoord, &packed[36], sizeof(texCoord));
+    EXPECT_EQ(texCoord, 0x38003C00u); // Half floats 1.0 and 0.5.
+
+    VertexLayout other;
+    EXPECT_TRUE(layout==layout);
+    EXPECT_TRUE(layout!=other);
+}
+
+TEST_F(VertexInputTest, streams)
+{
+    // Positions in stream 0 and packed normals in stream 1.
+    VertexInput v(sizeof(glm::vec3));
+    v.setVertexAttributeVec3(0,0);
+    v.setStreamStride(1,4);
+    v.setStreamAttribute(1,1,0,VertexInput::Format::SNORM_10_10_10_2);
+    EXPECT_EQ(VertexInput::streamBinding(0),0);
+    EXPECT_EQ(VertexInput::streamBinding(1),2);
+
+    auto bindingDescriptions = v.bindingDescriptions();
+    ASSERT_EQ(bindingDescriptions.size(),2);
+    EXPECT_EQ(bindingDescriptions[1].binding,2);
+    EXPECT_EQ(bindingDescriptions[1].stride,4);
+    EXPECT_EQ(
+        bindingDescriptions[1].inputRate,VK_VERTEX_INPUT_RATE_VERTEX
+    );
+    EXPECT_EQ(v.m_attributeDescriptions[1].binding,2);
+
+    // Streams and instances are both bound.
+    v.setInstanceStride(sizeof(glm::mat4));
+    EXPECT_EQ(v.bindingDescriptions().size(),3);
+
+    VertexInput other(sizeof(glm::vec3));
+    other.setVertexAttributeVec3(0,0);
+    EXPECT_TRUE(v!=other);
+}
+
+} // namespace evk